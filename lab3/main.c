@@ -1,54 +1,100 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
+#include <getopt.h>
 
 #define SLEEP_DURATION 10
 #define PROGRAM_NAME "[myfork]"
-static pid_t child_pid = 0;
+#define MAX_CHILDREN 4096
+
+// Объявления функций из placement.c
+extern int placement_set_affinity(const char *mode);
+extern void placement_set_cgroup(const char *root, const char *cpu_max, const char *memory_max);
+extern int placement_init(int children);
+extern int placement_child_cpu(int index);
+extern void placement_prepare_child(int index);
+extern pid_t placement_fork_child(int index);
+extern void placement_enter_child(int index, pid_t parent_pid);
+extern void placement_release_child(int index);
+extern void placement_cleanup(void);
+
+// Объявления функций из zygote.c
+extern int zygote_serve(const char *path);
+extern int zygote_launch(const char *path, int sleep_seconds);
+extern int zygote_bench(const char *self_path, int launches);
+
+// Учёт ресурсов одного дочернего процесса
+struct child_record {
+    pid_t pid;
+    struct timespec started;   // момент перед fork (CLOCK_MONOTONIC)
+    double wall_ms;            // время от fork до завершения
+    int wstatus;
+    struct rusage usage;       // заполняется wait4
+    int finished;
+};
+
+// Описание метрики для сводного отчёта
+struct metric {
+    const char *name;
+    double (*value)(const struct child_record *rec);
+};
+
+static struct child_record *children = NULL;
+static int children_count = 0;
+static int quiet = 0;
 
 void print_pid_at_exit(void){
-    printf("%s: process %d exits\n", PROGRAM_NAME, getpid());
+    if (!quiet) {
+        printf("%s: process %d exits\n", PROGRAM_NAME, getpid());
+    }
+}
+
+// Пересылает сигнал всем ещё работающим дочерним процессам
+static void forward_signal(int sig) {
+    for (int i = 0; i < children_count; i++) {
+        if (children[i].pid > 0 && !children[i].finished) {
+            if (kill(children[i].pid, sig) == -1) {
+                perror("kill");
+            }
+        }
+    }
 }
 
 // Обработчик сигнала SIGINT
 void catch_sigint(int sig) {
     (void)sig; // Подавляем предупреждение о неиспользуемом параметре
-    printf("%s: process %d interrupted with SIGINT signal! Abort\n", 
-           PROGRAM_NAME, getpid()); 
-    
-    if (child_pid > 0) {
-        if (kill(child_pid, SIGINT) == -1) {
-            perror("kill");
-        }
-    }
+    printf("%s: process %d interrupted with SIGINT signal! Abort\n",
+           PROGRAM_NAME, getpid());
+
+    forward_signal(SIGINT);
     exit(EXIT_FAILURE);
 }
 
 // Обработчик сигнала SIGTERM
 void catch_sigterm(int sig){
     (void)sig; // Подавляем предупреждение о неиспользуемом параметре
-    printf("%s: process %d interrupted with SIGTERM signal! Abort\n", 
-           PROGRAM_NAME, getpid()); 
-    
-    if (child_pid > 0) {
-        if (kill(child_pid, SIGTERM) == -1) {
-            perror("kill");
-        }
-    }
+    printf("%s: process %d interrupted with SIGTERM signal! Abort\n",
+           PROGRAM_NAME, getpid());
+
+    forward_signal(SIGTERM);
     exit(EXIT_FAILURE);
 }
 
 // Установка обработчика сигнала
 int setup_signal_handler(int sig, void (*handler)(int)){
     struct sigaction sa;
-    
+
     sa.sa_handler = handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
-    
+
     if (sigaction(sig, &sa, NULL) == -1) {
         perror("sigaction");
         return -1;
@@ -56,13 +102,279 @@ int setup_signal_handler(int sig, void (*handler)(int)){
     return 0;
 }
 
+static double elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) * 1e3 +
+           (double)(to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+static double timeval_us(const struct timeval *tv) {
+    return (double)tv->tv_sec * 1e6 + (double)tv->tv_usec;
+}
+
+static double metric_wall_ms(const struct child_record *r)   { return r->wall_ms; }
+static double metric_utime_us(const struct child_record *r)  { return timeval_us(&r->usage.ru_utime); }
+static double metric_stime_us(const struct child_record *r)  { return timeval_us(&r->usage.ru_stime); }
+static double metric_maxrss_kb(const struct child_record *r) { return (double)r->usage.ru_maxrss; }
+static double metric_nvcsw(const struct child_record *r)     { return (double)r->usage.ru_nvcsw; }
+static double metric_nivcsw(const struct child_record *r)    { return (double)r->usage.ru_nivcsw; }
+static double metric_minflt(const struct child_record *r)    { return (double)r->usage.ru_minflt; }
+static double metric_majflt(const struct child_record *r)    { return (double)r->usage.ru_majflt; }
+
+static const struct metric metrics[] = {
+    {"wall_ms",   metric_wall_ms},
+    {"utime_us",  metric_utime_us},
+    {"stime_us",  metric_stime_us},
+    {"maxrss_kb", metric_maxrss_kb},
+    {"nvcsw",     metric_nvcsw},
+    {"nivcsw",    metric_nivcsw},
+    {"minflt",    metric_minflt},
+    {"majflt",    metric_majflt},
+};
+#define METRIC_COUNT (sizeof(metrics) / sizeof(metrics[0]))
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Перцентиль методом ближайшего ранга по отсортированному массиву
+double percentile(const double *sorted, int n, double p) {
+    int rank = (int)((p / 100.0) * n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+// Пишет отчёт в формате JSON: записи по каждому процессу и сводку перцентилей
+static int write_report(FILE *out, int sleep_seconds) {
+    double *values = malloc(sizeof(double) * (size_t)children_count);
+    if (values == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"children\": %d,\n  \"sleep_s\": %d,\n  \"per_child\": [\n",
+            children_count, sleep_seconds);
+    for (int i = 0; i < children_count; i++) {
+        const struct child_record *r = &children[i];
+        const char *how = "abnormal";
+        int code = -1;
+        if (WIFEXITED(r->wstatus)) {
+            how = "exited";
+            code = WEXITSTATUS(r->wstatus);
+        } else if (WIFSIGNALED(r->wstatus)) {
+            how = "signaled";
+            code = WTERMSIG(r->wstatus);
+        }
+        fprintf(out, "    {\"pid\": %d, \"cpu\": %d, \"status\": \"%s\", \"code\": %d",
+                (int)r->pid, placement_child_cpu(i), how, code);
+        for (size_t m = 0; m < METRIC_COUNT; m++) {
+            fprintf(out, ", \"%s\": %.3f", metrics[m].name, metrics[m].value(r));
+        }
+        fprintf(out, "}%s\n", i + 1 < children_count ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"summary\": {\n");
+
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        double sum = 0;
+        for (int i = 0; i < children_count; i++) {
+            values[i] = metrics[m].value(&children[i]);
+            sum += values[i];
+        }
+        qsort(values, (size_t)children_count, sizeof(double), compare_doubles);
+        fprintf(out, "    \"%s\": {\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+                     "\"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f}%s\n",
+                metrics[m].name, values[0],
+                percentile(values, children_count, 50),
+                percentile(values, children_count, 90),
+                percentile(values, children_count, 99),
+                values[children_count - 1], sum / children_count,
+                m + 1 < METRIC_COUNT ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+
+    free(values);
+    return 0;
+}
+
+// Тело дочернего процесса
+void run_child(int sleep_seconds) {
+    if (!quiet) {
+        printf("%s: child process id - %d\n", PROGRAM_NAME, getpid());
+        printf("%s: parent process id - %d\n", PROGRAM_NAME, getppid());
+        printf("%s: child will be sleeping for %d seconds\n",
+               PROGRAM_NAME, sleep_seconds);
+    }
+
+    if (sleep((unsigned int)sleep_seconds) > 0)  {
+        // sleep был прерван сигналом
+        printf("%s: child sleep was interrupted\n", PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!quiet) {
+        printf("%s: child finished sleeping\n", PROGRAM_NAME);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+static void print_child_status(const struct child_record *r) {
+    if (WIFEXITED(r->wstatus)) {
+        printf("%s: child %d exited normally with code %d\n",
+               PROGRAM_NAME, r->pid, WEXITSTATUS(r->wstatus));
+    }
+    else if (WIFSIGNALED(r->wstatus)) {
+        printf("%s: child %d was terminated by signal %d\n",
+               PROGRAM_NAME, r->pid, WTERMSIG(r->wstatus));
+    }
+    else {
+        printf("%s: child %d terminated abnormally\n", PROGRAM_NAME, r->pid);
+    }
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n, --children N    number of children to fork (default 1, max %d)\n"
+            "  -s, --sleep SEC     child sleep duration (default %d)\n"
+            "  -o, --report FILE   write JSON resource report to FILE ('-' for stdout)\n"
+            "  -a, --affinity MODE pin children to CPUs: none, rr or numa (default none)\n"
+            "  -g, --cgroup DIR    place each child into its own cgroup v2 under DIR\n"
+            "      --cpu-max SPEC  cpu.max for child cgroups, e.g. \"50000 100000\"\n"
+            "      --memory-max N  memory.max for child cgroups, e.g. 256M\n"
+            "  -Z, --zygote SOCK   run as a zygote server forking children on request\n"
+            "  -L, --launch SOCK   launch one child through the zygote at SOCK\n"
+            "  -B, --bench N       compare N zygote launches against cold fork+exec\n"
+            "  -q, --quiet         do not print per-process messages\n"
+            "  -h, --help          show this help\n",
+            prog, MAX_CHILDREN, SLEEP_DURATION);
+}
 
 int main(int argc, char **argv){
-    (void)argc;
-    (void)argv;
-    
-    int wstatus;
-    pid_t fork_result;
+    int children_requested = 1;
+    int sleep_seconds = SLEEP_DURATION;
+    const char *report_path = NULL;
+    const char *cgroup_root = NULL;
+    const char *cpu_max = NULL;
+    const char *memory_max = NULL;
+    const char *zygote_path = NULL;
+    int placement_requested = 0;
+    const char *launch_path = NULL;
+    int bench_launches = 0;
+    int exec_child = 0;
+
+    static struct option long_options[] = {
+        {"children", required_argument, 0, 'n'},
+        {"sleep",    required_argument, 0, 's'},
+        {"report",   required_argument, 0, 'o'},
+        {"affinity", required_argument, 0, 'a'},
+        {"cgroup",   required_argument, 0, 'g'},
+        {"cpu-max",  required_argument, 0, 'C'},
+        {"memory-max", required_argument, 0, 'M'},
+        {"zygote",   required_argument, 0, 'Z'},
+        {"launch",   required_argument, 0, 'L'},
+        {"bench",    required_argument, 0, 'B'},
+        {"child",    no_argument,       0, 'X'},
+        {"quiet",    no_argument,       0, 'q'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:s:o:a:g:Z:L:B:qh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                children_requested = atoi(optarg);
+                break;
+            case 's':
+                sleep_seconds = atoi(optarg);
+                break;
+            case 'o':
+                report_path = optarg;
+                break;
+            case 'a':
+                if (placement_set_affinity(optarg) == -1) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                placement_requested |= strcmp(optarg, "none") != 0;
+                break;
+            case 'g':
+                cgroup_root = optarg;
+                placement_requested = 1;
+                break;
+            case 'C':
+                cpu_max = optarg;
+                placement_requested = 1;
+                break;
+            case 'M':
+                memory_max = optarg;
+                placement_requested = 1;
+                break;
+            case 'Z':
+                zygote_path = optarg;
+                break;
+            case 'L':
+                launch_path = optarg;
+                break;
+            case 'B':
+                bench_launches = atoi(optarg);
+                if (bench_launches < 1) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'X':
+                // Служебный режим: так бенчмарк запускает «холодный» fork+exec
+                exec_child = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (children_requested < 1 || children_requested > MAX_CHILDREN || sleep_seconds < 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Потомков зиготы создаёт её сервер без размещения — параметры были бы молча проигнорированы
+    if ((zygote_path != NULL || launch_path != NULL || bench_launches > 0) && placement_requested) {
+        fprintf(stderr, "%s: --affinity/--cgroup/--cpu-max/--memory-max cannot be combined with "
+                        "--zygote/--launch/--bench\n", PROGRAM_NAME);
+        return EXIT_FAILURE;
+    }
+
+    if (launch_path != NULL) {
+        return zygote_launch(launch_path, sleep_seconds);
+    }
+    if (bench_launches > 0) {
+        quiet = 1;
+        return zygote_bench("/proc/self/exe", bench_launches);
+    }
+
+    if ((cpu_max || memory_max) && cgroup_root == NULL) {
+        fprintf(stderr, "%s: --cpu-max/--memory-max require --cgroup\n", PROGRAM_NAME);
+        return EXIT_FAILURE;
+    }
+    placement_set_cgroup(cgroup_root, cpu_max, memory_max);
+    if (placement_init(children_requested) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    children = calloc((size_t)children_requested, sizeof(*children));
+    if (children == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
 
     if (atexit(print_pid_at_exit) != 0) {
         perror("atexit");
@@ -73,56 +385,105 @@ int main(int argc, char **argv){
     if (setup_signal_handler(SIGTERM, catch_sigterm) == -1) {
         exit(EXIT_FAILURE);
     }
-    
+
     if (setup_signal_handler(SIGINT, catch_sigint) == -1) {
         exit(EXIT_FAILURE);
     }
 
-    // Создаем дочерний процесс
-    fork_result = fork();
-    if (fork_result == -1) {
-        perror("fork");
-        exit(EXIT_FAILURE);
+    if (exec_child) {
+        run_child(sleep_seconds);
     }
 
-    if (fork_result == 0)  {
-        printf("%s: child process id - %d\n", PROGRAM_NAME, getpid());
-        printf("%s: parent process id - %d\n", PROGRAM_NAME, getppid());
-        printf("%s: child will be sleeping for %d seconds\n", 
-               PROGRAM_NAME, SLEEP_DURATION);
-        
-        if (sleep(SLEEP_DURATION) > 0)  {
-            // sleep был прерван сигналом
-            printf("%s: child sleep was interrupted\n", PROGRAM_NAME);
-            exit(EXIT_FAILURE);
+    if (zygote_path != NULL) {
+        if (!quiet) {
+            printf("%s: zygote %d listening on %s\n", PROGRAM_NAME, getpid(), zygote_path);
         }
-        
-        printf("%s: child finished sleeping\n", PROGRAM_NAME);
-        exit(EXIT_SUCCESS);
+        return zygote_serve(zygote_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    else {
-        child_pid = fork_result;
-        
+
+    if (!quiet) {
         printf("%s: parent process id - %d\n", PROGRAM_NAME, getpid());
-        printf("%s: child process id - %d\n", PROGRAM_NAME, child_pid);
+    }
+
+    // Создаем дочерние процессы
+    pid_t parent_pid = getpid();
+    for (int i = 0; i < children_requested; i++) {
+        struct child_record *rec = &children[i];
+
+        // Иначе буфер stdout продублируется в каждом потомке
+        fflush(stdout);
+        placement_prepare_child(i);
+        clock_gettime(CLOCK_MONOTONIC, &rec->started);
+
+        pid_t fork_result = placement_fork_child(i);
+        if (fork_result == -1) {
+            perror("fork");
+            forward_signal(SIGTERM);
+            exit(EXIT_FAILURE);
+        }
 
-        // Ждем завершения дочернего процесса
-        if (wait(&wstatus) == -1) {
-            perror("wait");
+        if (fork_result == 0) {
+            // Потомку не нужны чужие pid: иначе он перешлёт сигнал братьям
+            children_count = 0;
+            placement_enter_child(i, parent_pid);
+            run_child(sleep_seconds);
+        }
+
+        rec->pid = fork_result;
+        children_count = i + 1;
+        if (!quiet) {
+            printf("%s: child process id - %d\n", PROGRAM_NAME, rec->pid);
+        }
+    }
+
+    // Ждем завершения дочерних процессов и собираем rusage каждого
+    for (int reaped = 0; reaped < children_count; ) {
+        int wstatus;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &wstatus, 0, &usage);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            perror("wait4");
             exit(EXIT_FAILURE);
         }
-        
-        if (WIFEXITED(wstatus)) {
-            printf("%s: child exited normally with code %d\n", 
-                   PROGRAM_NAME, WEXITSTATUS(wstatus));
+
+        struct timespec finished;
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+
+        for (int i = 0; i < children_count; i++) {
+            struct child_record *rec = &children[i];
+            if (rec->pid != pid || rec->finished) continue;
+            rec->wstatus = wstatus;
+            rec->usage = usage;
+            rec->wall_ms = elapsed_ms(&rec->started, &finished);
+            rec->finished = 1;
+            reaped++;
+            placement_release_child(i);
+            if (!quiet) {
+                print_child_status(rec);
+            }
+            break;
         }
-        else if (WIFSIGNALED(wstatus)) {
-            printf("%s: child was terminated by signal %d\n", 
-                   PROGRAM_NAME, WTERMSIG(wstatus));
+    }
+
+    if (report_path != NULL) {
+        FILE *out = strcmp(report_path, "-") == 0 ? stdout : fopen(report_path, "w");
+        if (out == NULL) {
+            perror(report_path);
+            exit(EXIT_FAILURE);
         }
-        else {
-            printf("%s: child terminated abnormally\n", PROGRAM_NAME);
+        int rc = write_report(out, sleep_seconds);
+        if (out != stdout) {
+            fclose(out);
+        }
+        if (rc == -1) {
+            exit(EXIT_FAILURE);
         }
     }
+
+    placement_cleanup();
+    free(children);
+    children = NULL;
+    children_count = 0;
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <linux/sched.h>
+
+#define PROGRAM_NAME "[myfork]"
+#define MAX_NUMA_NODES 64
+
+/* ========== Размещение дочерних процессов: CPU affinity и cgroup v2 ========== */
+
+enum affinity_mode {
+    AFFINITY_NONE,
+    AFFINITY_ROUND_ROBIN,
+    AFFINITY_NUMA
+};
+
+static enum affinity_mode affinity = AFFINITY_NONE;
+static int *cpu_plan = NULL;        // CPU для каждого потомка (по индексу)
+static int cpu_plan_size = 0;
+
+static const char *cgroup_root = NULL;
+static const char *cgroup_cpu_max = NULL;
+static const char *cgroup_memory_max = NULL;
+static int cgroup_enabled = 0;
+static int child_cgroup_fd = -1;    // cgroup очередного потомка для clone3
+static int joined_at_clone = 0;     // в потомке: clone3 уже поместил его в cgroup
+
+int placement_set_affinity(const char *mode) {
+    if (strcmp(mode, "none") == 0) affinity = AFFINITY_NONE;
+    else if (strcmp(mode, "rr") == 0) affinity = AFFINITY_ROUND_ROBIN;
+    else if (strcmp(mode, "numa") == 0) affinity = AFFINITY_NUMA;
+    else return -1;
+    return 0;
+}
+
+void placement_set_cgroup(const char *root, const char *cpu_max, const char *memory_max) {
+    cgroup_root = root;
+    cgroup_cpu_max = cpu_max;
+    cgroup_memory_max = memory_max;
+}
+
+/*
+ * Разбирает список CPU в формате ядра ("0-3,8,10-11") и оставляет
+ * только те, что разрешены родителю.
+ */
+static int parse_cpulist(const char *list, const cpu_set_t *allowed, int *out, int max) {
+    int count = 0;
+    const char *p = list;
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && count < max; cpu++) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET((int)cpu, allowed)) {
+                out[count++] = (int)cpu;
+            }
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+// Потомок i получает i-й разрешённый CPU по кругу
+static int plan_round_robin(const cpu_set_t *allowed, int children) {
+    int cpus[CPU_SETSIZE];
+    int ncpus = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, allowed)) cpus[ncpus++] = cpu;
+    }
+    if (ncpus == 0) return -1;
+    for (int i = 0; i < children; i++) {
+        cpu_plan[i] = cpus[i % ncpus];
+    }
+    return 0;
+}
+
+/*
+ * Потомки распределяются по NUMA-узлам по очереди, внутри узла — по кругу
+ * по его CPU. Так соседние потомки не делят один контроллер памяти.
+ */
+static int plan_numa(const cpu_set_t *allowed, int children) {
+    static int node_cpus[MAX_NUMA_NODES][CPU_SETSIZE];
+    int node_size[MAX_NUMA_NODES];
+    int nodes = 0;
+
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) continue;
+        char list[4096];
+        if (fgets(list, sizeof(list), f) != NULL) {
+            int n = parse_cpulist(list, allowed, node_cpus[nodes], CPU_SETSIZE);
+            if (n > 0) {
+                node_size[nodes++] = n;
+            }
+        }
+        fclose(f);
+    }
+
+    if (nodes == 0) {
+        fprintf(stderr, "%s: NUMA topology unavailable, using round-robin affinity\n",
+                PROGRAM_NAME);
+        return plan_round_robin(allowed, children);
+    }
+
+    for (int i = 0; i < children; i++) {
+        int node = i % nodes;
+        cpu_plan[i] = node_cpus[node][(i / nodes) % node_size[node]];
+    }
+    return 0;
+}
+
+static int write_cgroup_file(const char *dir, const char *name, const char *value) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY);
+    if (fd == -1) return -1;
+    ssize_t len = (ssize_t)strlen(value);
+    ssize_t w = write(fd, value, (size_t)len);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return w == len ? 0 : -1;
+}
+
+static void child_cgroup_path(int index, char *buf, size_t bufsz) {
+    snprintf(buf, bufsz, "%s/myfork-%d-%d", cgroup_root, (int)getpid(), index);
+}
+
+/*
+ * Проверяет, что cgroup_root лежит на записываемой cgroup2 и включает
+ * нужные контроллеры. Любая неудача лишь отключает размещение по cgroup.
+ */
+static void init_cgroup(void) {
+    if (mkdir(cgroup_root, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "%s: cannot create cgroup %s: %s; cgroup placement disabled\n",
+                PROGRAM_NAME, cgroup_root, strerror(errno));
+        return;
+    }
+
+    struct statfs fs;
+    if (statfs(cgroup_root, &fs) == -1 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+        fprintf(stderr, "%s: %s is not on a cgroup v2 filesystem; cgroup placement disabled\n",
+                PROGRAM_NAME, cgroup_root);
+        return;
+    }
+    if (access(cgroup_root, W_OK) == -1) {
+        fprintf(stderr, "%s: %s is not writable; cgroup placement disabled\n",
+                PROGRAM_NAME, cgroup_root);
+        return;
+    }
+
+    if (cgroup_cpu_max && write_cgroup_file(cgroup_root, "cgroup.subtree_control", "+cpu") == -1) {
+        fprintf(stderr, "%s: cannot enable cpu controller in %s: %s; cpu.max ignored\n",
+                PROGRAM_NAME, cgroup_root, strerror(errno));
+        cgroup_cpu_max = NULL;
+    }
+    if (cgroup_memory_max && write_cgroup_file(cgroup_root, "cgroup.subtree_control", "+memory") == -1) {
+        fprintf(stderr, "%s: cannot enable memory controller in %s: %s; memory.max ignored\n",
+                PROGRAM_NAME, cgroup_root, strerror(errno));
+        cgroup_memory_max = NULL;
+    }
+    cgroup_enabled = 1;
+}
+
+/*
+ * Готовит план размещения для children потомков.
+ * Возвращает 0 при успехе, -1 если план построить нельзя.
+ */
+int placement_init(int children) {
+    if (affinity != AFFINITY_NONE) {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+            perror("sched_getaffinity");
+            return -1;
+        }
+        cpu_plan = malloc(sizeof(int) * (size_t)children);
+        if (cpu_plan == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        cpu_plan_size = children;
+        int rc = (affinity == AFFINITY_NUMA) ? plan_numa(&allowed, children)
+                                             : plan_round_robin(&allowed, children);
+        if (rc == -1) {
+            fprintf(stderr, "%s: no CPUs available for pinning\n", PROGRAM_NAME);
+            return -1;
+        }
+    }
+
+    if (cgroup_root != NULL) {
+        init_cgroup();
+    }
+    return 0;
+}
+
+int placement_child_cpu(int index) {
+    return (cpu_plan != NULL && index < cpu_plan_size) ? cpu_plan[index] : -1;
+}
+
+/*
+ * Вызывается в родителе до placement_fork_child: создаёт cgroup потомка,
+ * выставляет лимиты и открывает её каталог для clone3.
+ */
+void placement_prepare_child(int index) {
+    if (child_cgroup_fd != -1) {
+        close(child_cgroup_fd);
+        child_cgroup_fd = -1;
+    }
+    if (!cgroup_enabled) return;
+
+    char path[4096];
+    child_cgroup_path(index, path, sizeof(path));
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "%s: cannot create %s: %s\n", PROGRAM_NAME, path, strerror(errno));
+        return;
+    }
+    if (cgroup_cpu_max && write_cgroup_file(path, "cpu.max", cgroup_cpu_max) == -1) {
+        fprintf(stderr, "%s: cannot set cpu.max for %s: %s\n", PROGRAM_NAME, path, strerror(errno));
+    }
+    if (cgroup_memory_max && write_cgroup_file(path, "memory.max", cgroup_memory_max) == -1) {
+        fprintf(stderr, "%s: cannot set memory.max for %s: %s\n", PROGRAM_NAME, path, strerror(errno));
+    }
+    child_cgroup_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/*
+ * Создаёт потомка index. Если для него есть cgroup, используется
+ * clone3(CLONE_INTO_CGROUP): ядро создаёт процесс сразу в ней, и потомок
+ * с первой инструкции работает под её лимитами. Без clone3 (старое ядро
+ * или заголовки) или при его отказе — обычный fork; тогда потомок сам
+ * переходит в cgroup в placement_enter_child и до этого лимитов не имеет.
+ * Возвращает то же, что fork.
+ */
+pid_t placement_fork_child(int index) {
+    (void)index;
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+    if (child_cgroup_fd != -1) {
+        struct clone_args args;
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = (unsigned long long)child_cgroup_fd;
+        long pid = syscall(SYS_clone3, &args, sizeof(args));
+        if (pid == 0) {
+            joined_at_clone = 1;
+            return 0;
+        }
+        if (pid > 0) {
+            return (pid_t)pid;
+        }
+    }
+#endif
+    return fork();
+}
+
+/*
+ * Вызывается в потомке сразу после placement_fork_child: закрепляет его на
+ * CPU и, если clone3 этого не сделал, переносит в его cgroup. Ошибки не
+ * фатальны — потомок продолжает работу без размещения.
+ * parent_pid нужен, чтобы построить имя cgroup, созданной родителем.
+ */
+void placement_enter_child(int index, pid_t parent_pid) {
+    int cpu = placement_child_cpu(index);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            perror("sched_setaffinity");
+        }
+    }
+
+    if (child_cgroup_fd != -1) {
+        close(child_cgroup_fd);
+        child_cgroup_fd = -1;
+    }
+    if (cgroup_enabled && !joined_at_clone) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/myfork-%d-%d", cgroup_root, (int)parent_pid, index);
+        // "0" в cgroup.procs переносит сам пишущий процесс
+        if (write_cgroup_file(path, "cgroup.procs", "0") == -1) {
+            fprintf(stderr, "%s: cannot join %s: %s\n", PROGRAM_NAME, path, strerror(errno));
+        }
+    }
+}
+
+// Удаляет cgroup потомка после того, как он был дождан
+void placement_release_child(int index) {
+    if (!cgroup_enabled) return;
+
+    char path[4096];
+    child_cgroup_path(index, path, sizeof(path));
+    if (rmdir(path) == -1 && errno != ENOENT) {
+        fprintf(stderr, "%s: cannot remove %s: %s\n", PROGRAM_NAME, path, strerror(errno));
+    }
+}
+
+void placement_cleanup(void) {
+    if (child_cgroup_fd != -1) {
+        close(child_cgroup_fd);
+        child_cgroup_fd = -1;
+    }
+    free(cpu_plan);
+    cpu_plan = NULL;
+    cpu_plan_size = 0;
+}
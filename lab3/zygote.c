@@ -0,0 +1,477 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/pidfd.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define PROGRAM_NAME "[myfork]"
+#define ZYGOTE_MAX_LAUNCHES 1024
+#define ZYGOTE_BACKLOG 64
+#define ZYGOTE_REQUEST_TIMEOUT_MS 1000
+#define STDIO_FDS 3
+
+// Объявления функций из main.c
+extern void run_child(int sleep_seconds);
+extern int compare_doubles(const void *a, const void *b);
+extern double percentile(const double *sorted, int n, double p);
+
+/* ========== Протокол zygote (SOCK_SEQPACKET, одно сообщение — одна структура) ========== */
+
+// Запрос клиента; вместе с ним по SCM_RIGHTS приходят stdin, stdout и stderr клиента
+struct zygote_request {
+    int32_t sleep_seconds;
+};
+
+// Ответ на запуск; при успехе к нему приложен pidfd потомка
+struct zygote_reply {
+    int32_t pid;
+    int32_t error;      // errno, если запуск не удался
+};
+
+// Итог работы потомка, отправляется после его завершения
+struct zygote_status {
+    int32_t pid;
+    int32_t code;       // si_code из waitid: CLD_EXITED, CLD_KILLED, ...
+    int32_t status;     // код возврата или номер сигнала
+};
+
+// Запуск, за которым сервер следит до завершения потомка
+struct zygote_launch {
+    int conn_fd;
+    int pidfd;
+    pid_t pid;
+};
+
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pid_t server_pid = 0;
+
+static void unlink_socket_at_exit(void) {
+    // atexit наследуется потомками zygote, сокет удаляет только сам сервер
+    if (server_pid == getpid()) {
+        unlink(socket_path);
+    }
+}
+
+static int fill_address(struct sockaddr_un *addr, const char *path) {
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path too long: %s\n", PROGRAM_NAME, path);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/*
+ * Отправляет сообщение с приложенными дескрипторами (SCM_RIGHTS).
+ */
+static int send_with_fds(int sock, const void *msg, size_t len, const int *fds, int nfds) {
+    char control[CMSG_SPACE(sizeof(int) * STDIO_FDS)];
+    struct iovec iov = { (void *)msg, len };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    if (nfds > 0) {
+        memset(control, 0, sizeof(control));
+        mh.msg_control = control;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * (size_t)nfds);
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    return sent == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * Принимает сообщение ровно из len байт и до max_fds дескрипторов.
+ * Возвращает число полученных дескрипторов или -1.
+ */
+static int recv_with_fds(int sock, void *msg, size_t len, int *fds, int max_fds) {
+    char control[CMSG_SPACE(sizeof(int) * STDIO_FDS)];
+    struct iovec iov = { msg, len };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+
+    ssize_t got;
+    do {
+        got = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (got == -1 && errno == EINTR);
+
+    int nfds = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int count = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int *received = (int *)CMSG_DATA(cm);
+        for (int i = 0; i < count; i++) {
+            if (nfds < max_fds) fds[nfds++] = received[i];
+            else close(received[i]);
+        }
+    }
+
+    if (got != (ssize_t)len) {
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        if (got >= 0) errno = EPROTO;
+        return -1;
+    }
+    return nfds;
+}
+
+/*
+ * Обрабатывает запрос на запуск: форкает потомка с stdio клиента и
+ * возвращает клиенту pidfd. Возвращает 0, если потомок запущен.
+ */
+static int zygote_spawn(int conn_fd, struct zygote_launch *launch,
+                        int listen_fd, struct zygote_launch *launches, int nlaunches) {
+    struct zygote_request req;
+    int fds[STDIO_FDS];
+    int nfds = recv_with_fds(conn_fd, &req, sizeof(req), fds, STDIO_FDS);
+    if (nfds == -1) return -1;
+
+    struct zygote_reply reply = { 0, 0 };
+    if (nfds != STDIO_FDS || req.sleep_seconds < 0) {
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        reply.error = (nfds != STDIO_FDS) ? EBADF : EINVAL;
+        send_with_fds(conn_fd, &reply, sizeof(reply), NULL, 0);
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Потомку не нужны сокеты сервера и pidfd соседей
+        close(listen_fd);
+        for (int i = 0; i < nlaunches; i++) {
+            if (launches[i].conn_fd >= 0) close(launches[i].conn_fd);
+            if (launches[i].pidfd >= 0) close(launches[i].pidfd);
+        }
+        close(conn_fd);
+        for (int i = 0; i < STDIO_FDS; i++) {
+            if (dup2(fds[i], i) == -1) _exit(EXIT_FAILURE);
+            close(fds[i]);
+        }
+        run_child(req.sleep_seconds);
+    }
+
+    for (int i = 0; i < STDIO_FDS; i++) close(fds[i]);
+
+    int pidfd = -1;
+    if (pid == -1 || (pidfd = pidfd_open(pid, 0)) == -1) {
+        reply.error = errno;
+        send_with_fds(conn_fd, &reply, sizeof(reply), NULL, 0);
+        if (pid > 0) waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    reply.pid = pid;
+    if (send_with_fds(conn_fd, &reply, sizeof(reply), &pidfd, 1) == -1) {
+        perror("zygote: sendmsg");
+    }
+
+    launch->conn_fd = conn_fd;
+    launch->pidfd = pidfd;
+    launch->pid = pid;
+    return 0;
+}
+
+// Дожидается потомка через pidfd и сообщает клиенту итог
+static void zygote_reap(struct zygote_launch *launch) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid((idtype_t)P_PIDFD, (id_t)launch->pidfd, &info, WEXITED) == -1) {
+        perror("zygote: waitid");
+    }
+
+    if (launch->conn_fd >= 0) {
+        struct zygote_status st = { launch->pid, info.si_code, info.si_status };
+        send_with_fds(launch->conn_fd, &st, sizeof(st), NULL, 0);
+        close(launch->conn_fd);
+    }
+    close(launch->pidfd);
+    launch->conn_fd = -1;
+    launch->pidfd = -1;
+}
+
+/*
+ * Сервер zygote: всё дорогое (разбор опций, обработчики сигналов, размещение)
+ * уже сделано, поэтому каждый запуск стоит одного fork.
+ */
+int zygote_serve(const char *path) {
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) == -1) return -1;
+
+    int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, ZYGOTE_BACKLOG) == -1) {
+        perror("zygote: bind/listen");
+        close(listen_fd);
+        return -1;
+    }
+
+    strcpy(socket_path, path);
+    server_pid = getpid();
+    atexit(unlink_socket_at_exit);
+
+    static struct zygote_launch launches[ZYGOTE_MAX_LAUNCHES];
+    static struct pollfd pfds[1 + 2 * ZYGOTE_MAX_LAUNCHES];
+    int nlaunches = 0;
+
+    for (;;) {
+        int npfds = 0;
+        pfds[npfds++] = (struct pollfd){ listen_fd, nlaunches < ZYGOTE_MAX_LAUNCHES ? POLLIN : 0, 0 };
+        for (int i = 0; i < nlaunches; i++) {
+            pfds[npfds++] = (struct pollfd){ launches[i].pidfd, POLLIN, 0 };
+            pfds[npfds++] = (struct pollfd){ launches[i].conn_fd, 0, 0 };
+        }
+
+        if (poll(pfds, (nfds_t)npfds, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("zygote: poll");
+            close(listen_fd);
+            return -1;
+        }
+
+        // Завершившиеся потомки; закрытое клиентом соединение просто забываем
+        for (int i = nlaunches - 1; i >= 0; i--) {
+            if (pfds[2 + 2 * i].revents & (POLLHUP | POLLERR)) {
+                close(launches[i].conn_fd);
+                launches[i].conn_fd = -1;
+            }
+            if (pfds[1 + 2 * i].revents & POLLIN) {
+                zygote_reap(&launches[i]);
+                launches[i] = launches[--nlaunches];
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int conn_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (conn_fd == -1) {
+                if (errno != EINTR) perror("zygote: accept");
+                continue;
+            }
+            // Запрос читается блокирующе: молчащий клиент не должен останавливать сервер
+            struct timeval timeout = { ZYGOTE_REQUEST_TIMEOUT_MS / 1000, (ZYGOTE_REQUEST_TIMEOUT_MS % 1000) * 1000 };
+            if (setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+                perror("zygote: setsockopt");
+                close(conn_fd);
+                continue;
+            }
+            if (zygote_spawn(conn_fd, &launches[nlaunches], listen_fd, launches, nlaunches) == 0) {
+                nlaunches++;
+            } else {
+                close(conn_fd);
+            }
+        }
+    }
+}
+
+/*
+ * Просит zygote запустить потомка с нашими stdio. Возвращает соединение,
+ * по которому придёт итог, и pidfd/pid потомка; -1 при ошибке.
+ */
+static int zygote_request_launch(const char *path, int sleep_seconds, int *pidfd, pid_t *pid) {
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) == -1) return -1;
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(sock);
+        return -1;
+    }
+
+    struct zygote_request req = { sleep_seconds };
+    int stdio[STDIO_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    struct zygote_reply reply;
+    int nfds = -1;
+    if (send_with_fds(sock, &req, sizeof(req), stdio, STDIO_FDS) == 0) {
+        nfds = recv_with_fds(sock, &reply, sizeof(reply), pidfd, 1);
+    }
+    if (nfds == -1) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    // Ответ с ошибкой приходит без pidfd, поэтому сначала смотрим на error
+    if (reply.error != 0 || nfds != 1) {
+        if (nfds == 1) close(*pidfd);
+        close(sock);
+        errno = (reply.error != 0) ? reply.error : EPROTO;
+        return -1;
+    }
+    *pid = reply.pid;
+    return sock;
+}
+
+static int read_status(int sock, struct zygote_status *st) {
+    return recv_with_fds(sock, st, sizeof(*st), NULL, 0) == 0 ? 0 : -1;
+}
+
+/*
+ * Клиент: запускает одного потомка через zygote и ждёт его завершения.
+ * Возвращает код завершения для main.
+ */
+int zygote_launch(const char *path, int sleep_seconds) {
+    int pidfd;
+    pid_t pid;
+    int sock = zygote_request_launch(path, sleep_seconds, &pidfd, &pid);
+    if (sock == -1) {
+        perror("zygote launch");
+        return EXIT_FAILURE;
+    }
+    printf("%s: zygote started child %d\n", PROGRAM_NAME, (int)pid);
+
+    struct zygote_status st;
+    int rc = read_status(sock, &st);
+    close(pidfd);
+    close(sock);
+    if (rc == -1) {
+        perror("zygote: status");
+        return EXIT_FAILURE;
+    }
+
+    if (st.code == CLD_EXITED) {
+        printf("%s: child %d exited normally with code %d\n", PROGRAM_NAME, st.pid, st.status);
+        return st.status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    printf("%s: child %d was terminated by signal %d\n", PROGRAM_NAME, st.pid, st.status);
+    return EXIT_FAILURE;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static void print_latency(const char *name, double *samples, int n, int last) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += samples[i];
+    qsort(samples, (size_t)n, sizeof(double), compare_doubles);
+    printf("  \"%s\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+           "\"max\": %.1f, \"mean\": %.1f}%s\n",
+           name, samples[0], percentile(samples, n, 50), percentile(samples, n, 90),
+           percentile(samples, n, 99), samples[n - 1], sum / n, last ? "" : ",");
+}
+
+/*
+ * Сравнивает задержку запуска (от запроса до завершения потомка) через
+ * zygote и через обычный fork+exec этой же программы. Печатает JSON в мкс.
+ */
+int zygote_bench(const char *self_path, int launches) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/myfork-zygote-%d.sock", (int)getpid());
+
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == -1) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (server == 0) {
+        exit(zygote_serve(path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    double *zygote_us = malloc(sizeof(double) * (size_t)launches);
+    double *cold_us = malloc(sizeof(double) * (size_t)launches);
+    int rc = EXIT_FAILURE;
+    if (zygote_us == NULL || cold_us == NULL) {
+        perror("malloc");
+        goto out;
+    }
+
+    // Ждём, пока сервер начнёт слушать сокет
+    int pidfd, sock = -1;
+    pid_t pid;
+    for (int attempt = 0; attempt < 1000 && sock == -1; attempt++) {
+        sock = zygote_request_launch(path, 0, &pidfd, &pid);
+        if (sock == -1) usleep(1000);
+    }
+    if (sock == -1) {
+        perror("zygote bench: connect");
+        goto out;
+    }
+    struct zygote_status st;
+    read_status(sock, &st);
+    close(pidfd);
+    close(sock);
+
+    for (int i = 0; i < launches; i++) {
+        double start = now_us();
+        sock = zygote_request_launch(path, 0, &pidfd, &pid);
+        if (sock == -1) {
+            perror("zygote bench: launch");
+            goto out;
+        }
+        struct pollfd pfd = { pidfd, POLLIN, 0 };
+        while (poll(&pfd, 1, -1) == -1 && errno == EINTR) {}
+        zygote_us[i] = now_us() - start;
+        read_status(sock, &st);
+        close(pidfd);
+        close(sock);
+    }
+
+    for (int i = 0; i < launches; i++) {
+        double start = now_us();
+        pid_t child = fork();
+        if (child == -1) {
+            perror("fork");
+            goto out;
+        }
+        if (child == 0) {
+            execl(self_path, "myfork", "--child", "-q", "-s", "0", (char *)NULL);
+            _exit(127);
+        }
+        int wstatus;
+        while (waitpid(child, &wstatus, 0) == -1 && errno == EINTR) {}
+        cold_us[i] = now_us() - start;
+    }
+
+    printf("{\n  \"launches\": %d,\n", launches);
+    print_latency("zygote_us", zygote_us, launches, 0);
+    print_latency("fork_exec_us", cold_us, launches, 1);
+    printf("}\n");
+    rc = EXIT_SUCCESS;
+
+out:
+    // SIGTERM убивает сервер раньше его atexit, сокет удаляем сами
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(path);
+    free(zygote_us);
+    free(cold_us);
+    return rc;
+}
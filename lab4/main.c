@@ -1,8 +1,10 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #define FAILURE 1
@@ -27,11 +29,60 @@
 #define READ_PERM 'r'
 #define WRITE_PERM 'w'
 #define EXECUTE_PERM 'x'
-
-void display_error(const char *message) {
-    perror(message);
-    exit(EXIT_FAILURE);
-}
+#define CONDITIONAL_EXECUTE_PERM 'X'
+#define SETID_PERM 's'
+#define STICKY_PERM 't'
+
+/* Разделитель предложений в записи вида "u+rwx,g-w,o=" */
+#define CLAUSE_SEPARATOR ','
+
+#define ALL_EXECUTE_BITS (S_IXUSR | S_IXGRP | S_IXOTH)
+#define PERMISSION_BITS 07777
+
+/* Глубина очереди io_uring по умолчанию */
+#define DEFAULT_QUEUE_DEPTH 256
+
+/* Наибольшее число операций в скомпилированной программе режима */
+#define MAX_MODE_OPS 32
+
+/*
+ * Операция над режимом: сбросить clear_mask, затем выставить set_mask.
+ * x_clear_mask/x_set_mask — то же для X: применяются, только если файл
+ * является каталогом или уже имел хотя бы один бит выполнения.
+ */
+struct mode_op {
+    mode_t clear_mask;
+    mode_t set_mask;
+    mode_t x_clear_mask;
+    mode_t x_set_mask;
+};
+
+/*
+ * Режим, разобранный один раз на весь запуск. Для восьмеричной записи
+ * absolute = 1 и текущий режим файла не нужен.
+ */
+struct mode_program {
+    int absolute;
+    mode_t absolute_mode;
+    int op_count;
+    struct mode_op ops[MAX_MODE_OPS];
+};
+
+/* Права одного действия: r/w/x, размноженные на u, g и o, и признаки X, s, t */
+struct permission_set {
+    mode_t rwx;
+    int conditional_x;
+    int setid;
+    int sticky;
+};
+
+/* Объявления функций из walk.c */
+extern int walk_tree(const struct mode_program *prog, int dir_fd, const char *root_path, int workers,
+                     mode_t root_final);
+extern mode_t walk_descent_mode(mode_t current, int known, mode_t updated);
+
+/* Объявления функций из uring.c */
+extern int apply_batch_uring(const struct mode_program *prog, char **paths, size_t count, unsigned depth);
 
 int validate_octal_string(const char *str) {
     for (int i = 0; str[i]; i++) {
@@ -42,19 +93,8 @@ int validate_octal_string(const char *str) {
     return 1;
 }
 
-int apply_numeric_mode(const char *mode_input, const char *file_path) {
-    char *terminator;
-    long mode_value = strtol(mode_input, &terminator, 8);
-
-    if (*terminator != '\0' || mode_value < 0 || mode_value > 07777) {
-        fprintf(stderr, "mychmod: invalid mode '%s'\n", mode_input);
-        return FAILURE;
-    }
-
-    if (chmod(file_path, (mode_t)mode_value) == -1) {
-        display_error(file_path);
-    }
-    return SUCCESS;
+int is_operator(char c) {
+    return c == OPERATOR_ADD || c == OPERATOR_SUBTRACT || c == OPERATOR_SET;
 }
 
 int determine_user_mask(const char **input_ptr) {
@@ -76,27 +116,35 @@ int determine_user_mask(const char **input_ptr) {
     return user_mask ? user_mask : ALL_USERS;
 }
 
-mode_t extract_permission_bits(const char **input_ptr, const char *mode_input) {
-    mode_t permission_mask = 0;
+/*
+ * Читает права после оператора — до следующего оператора, ',' или конца
+ * строки. Пустой список допустим: "o=" снимает все права у остальных.
+ */
+int extract_permission_bits(const char **input_ptr, const char *mode_input, struct permission_set *perms) {
     const char *ptr = *input_ptr;
-    const char perm_chars[] = {READ_PERM, WRITE_PERM, EXECUTE_PERM, '\0'};
+    const char perm_chars[] = {READ_PERM, WRITE_PERM, EXECUTE_PERM,
+                               CONDITIONAL_EXECUTE_PERM, SETID_PERM, STICKY_PERM, '\0'};
 
-    while (*ptr) {
+    memset(perms, 0, sizeof(*perms));
+    while (*ptr && *ptr != CLAUSE_SEPARATOR && !is_operator(*ptr)) {
         if (!strchr(perm_chars, *ptr)) {
             fprintf(stderr, "mychmod: invalid permission '%c' in '%s'\n", *ptr, mode_input);
-            return 0;
+            return FAILURE;
         }
 
         switch (*ptr) {
-            case READ_PERM: permission_mask |= S_IRUSR | S_IRGRP | S_IROTH; break;
-            case WRITE_PERM: permission_mask |= S_IWUSR | S_IWGRP | S_IWOTH; break;
-            case EXECUTE_PERM: permission_mask |= S_IXUSR | S_IXGRP | S_IXOTH; break;
+            case READ_PERM: perms->rwx |= S_IRUSR | S_IRGRP | S_IROTH; break;
+            case WRITE_PERM: perms->rwx |= S_IWUSR | S_IWGRP | S_IWOTH; break;
+            case EXECUTE_PERM: perms->rwx |= S_IXUSR | S_IXGRP | S_IXOTH; break;
+            case CONDITIONAL_EXECUTE_PERM: perms->conditional_x = 1; break;
+            case SETID_PERM: perms->setid = 1; break;
+            case STICKY_PERM: perms->sticky = 1; break;
         }
         ptr++;
     }
 
     *input_ptr = ptr;
-    return permission_mask;
+    return SUCCESS;
 }
 
 mode_t compute_affected_bits(int user_mask, mode_t permission_mask) {
@@ -109,76 +157,444 @@ mode_t compute_affected_bits(int user_mask, mode_t permission_mask) {
     return result;
 }
 
+/* Биты s и t, которые затрагивает действие для выбранных классов */
+mode_t compute_special_bits(int user_mask, const struct permission_set *perms) {
+    mode_t result = 0;
+
+    if (perms->setid && (user_mask & USER_BIT)) result |= S_ISUID;
+    if (perms->setid && (user_mask & GROUP_BIT)) result |= S_ISGID;
+    if (perms->sticky && (user_mask & OTHER_BIT)) result |= S_ISVTX;
+
+    return result;
+}
+
 mode_t compute_mask_bits(int user_mask) {
     mode_t mask = 0;
 
-    if (user_mask & USER_BIT) mask |= S_IRWXU;
-    if (user_mask & GROUP_BIT) mask |= S_IRWXG;
-    if (user_mask & OTHER_BIT) mask |= S_IRWXO;
+    if (user_mask & USER_BIT) mask |= S_IRWXU | S_ISUID;
+    if (user_mask & GROUP_BIT) mask |= S_IRWXG | S_ISGID;
+    if (user_mask & OTHER_BIT) mask |= S_IRWXO | S_ISVTX;
 
     return mask;
 }
 
-mode_t calculate_new_mode(mode_t current, char operation, mode_t affected, mode_t mask) {
+/*
+ * Переводит одно действие над правами в пары масок:
+ * новый режим = (текущий & ~clear_mask) | set_mask.
+ */
+struct mode_op make_mode_op(char operation, int user_mask, const struct permission_set *perms) {
+    struct mode_op op = {0, 0, 0, 0};
+    mode_t affected = compute_affected_bits(user_mask, perms->rwx) |
+                      compute_special_bits(user_mask, perms);
+    mode_t conditional = perms->conditional_x ? compute_affected_bits(user_mask, ALL_EXECUTE_BITS) : 0;
+
     switch (operation) {
-        case OPERATOR_ADD: return current | affected;
-        case OPERATOR_SUBTRACT: return current & ~affected;
-        case OPERATOR_SET: return (current & ~mask) | affected;
-        default: return current;
+        case OPERATOR_ADD:
+            op.set_mask = affected;
+            op.x_set_mask = conditional;
+            break;
+        case OPERATOR_SUBTRACT:
+            op.clear_mask = affected;
+            op.x_clear_mask = conditional;
+            break;
+        case OPERATOR_SET:
+            op.clear_mask = compute_mask_bits(user_mask);
+            op.set_mask = affected;
+            op.x_set_mask = conditional;
+            break;
+    }
+    return op;
+}
+
+/*
+ * Разбирает символьную запись mode_input ("u+rwx,g-w,o=", "a+X", "u+s-w")
+ * в программу prog. Файловую систему не трогает; разбор выполняется
+ * один раз на весь запуск.
+ */
+int compile_symbolic_mode(const char *mode_input, struct mode_program *prog) {
+    const char *parser = mode_input;
+
+    prog->absolute = 0;
+    prog->op_count = 0;
+
+    for (;;) {
+        int user_mask = determine_user_mask(&parser);
+
+        /* Проверка оператора с использованием констант */
+        if (!is_operator(*parser)) {
+            fprintf(stderr, "mychmod: invalid operator in '%s'\n", mode_input);
+            return FAILURE;
+        }
+
+        /* В одном предложении может быть несколько действий: "u+r-w" */
+        while (is_operator(*parser)) {
+            char operation = *parser++;
+            struct permission_set perms;
+
+            if (extract_permission_bits(&parser, mode_input, &perms) != SUCCESS) {
+                return FAILURE;
+            }
+            if (prog->op_count == MAX_MODE_OPS) {
+                fprintf(stderr, "mychmod: too many clauses in '%s'\n", mode_input);
+                return FAILURE;
+            }
+            prog->ops[prog->op_count++] = make_mode_op(operation, user_mask, &perms);
+        }
+
+        if (*parser == '\0') {
+            return SUCCESS;
+        }
+        parser++; /* CLAUSE_SEPARATOR */
     }
 }
 
-int apply_symbolic_mode(const char *mode_input, const char *file_path) {
-    struct stat file_info;
-    if (stat(file_path, &file_info) == -1) {
-        display_error(file_path);
+/*
+ * Компилирует режим: восьмеричный — в абсолютное значение (текущий режим
+ * не нужен, stat не делается), символьный — в список операций над масками.
+ */
+int compile_mode(const char *mode_input, struct mode_program *prog) {
+    if (validate_octal_string(mode_input)) {
+        char *terminator;
+        long mode_value = strtol(mode_input, &terminator, 8);
+
+        if (*terminator != '\0' || mode_value < 0 || mode_value > 07777) {
+            fprintf(stderr, "mychmod: invalid mode '%s'\n", mode_input);
+            return FAILURE;
+        }
+        prog->absolute = 1;
+        prog->absolute_mode = (mode_t)mode_value;
+        prog->op_count = 0;
+        return SUCCESS;
     }
+    return compile_symbolic_mode(mode_input, prog);
+}
 
-    mode_t current_permissions = file_info.st_mode;
-    const char *parser = mode_input;
+int mode_program_needs_stat(const struct mode_program *prog) {
+    return !prog->absolute;
+}
 
-    int user_mask = determine_user_mask(&parser);
+/*
+ * Выполняет программу над текущим режимом файла за один проход.
+ * X проверяется по исходному режиму, как того требует POSIX.
+ */
+mode_t run_mode_program(const struct mode_program *prog, mode_t current) {
+    if (prog->absolute) {
+        return prog->absolute_mode;
+    }
 
-    /* Проверка оператора с использованием констант */
-    if (*parser != OPERATOR_ADD && *parser != OPERATOR_SUBTRACT && *parser != OPERATOR_SET) {
-        fprintf(stderr, "mychmod: invalid operator in '%s'\n", mode_input);
-        return FAILURE;
+    int executable = S_ISDIR(current) || (current & ALL_EXECUTE_BITS);
+    mode_t result = current & PERMISSION_BITS;
+    for (int i = 0; i < prog->op_count; i++) {
+        const struct mode_op *op = &prog->ops[i];
+        mode_t clear = op->clear_mask | (executable ? op->x_clear_mask : 0);
+        mode_t set = op->set_mask | (executable ? op->x_set_mask : 0);
+        result = (result & ~clear) | set;
     }
+    return result;
+}
+
+/* 1, если режим не изменился и вызов chmod можно пропустить */
+int mode_unchanged(mode_t current, mode_t updated) {
+    return ((current ^ updated) & PERMISSION_BITS) == 0;
+}
 
-    char operation = *parser++;
-    mode_t permission_bits = extract_permission_bits(&parser, mode_input);
+/*
+ * Меняет права одного файла по пути. Ошибка не прерывает работу:
+ * остальные файлы из списка всё равно обрабатываются. Если режим уже
+ * совпадает с нужным, chmod не вызывается и метаданные не пишутся.
+ */
+int apply_mode_program(const struct mode_program *prog, const char *file_path) {
+    mode_t current = 0;
+    if (mode_program_needs_stat(prog)) {
+        struct stat file_info;
+        if (stat(file_path, &file_info) == -1) {
+            perror(file_path);
+            return FAILURE;
+        }
+        current = file_info.st_mode;
+        if (mode_unchanged(current, run_mode_program(prog, current))) {
+            return SUCCESS;
+        }
+    }
 
-    if (permission_bits == 0 && *mode_input) {
+    if (chmod(file_path, run_mode_program(prog, current)) == -1) {
+        perror(file_path);
         return FAILURE;
     }
+    return SUCCESS;
+}
 
-    mode_t affected_bits = compute_affected_bits(user_mask, permission_bits);
-    mode_t mask_bits = compute_mask_bits(user_mask);
-    mode_t updated_permissions = calculate_new_mode(current_permissions, operation, affected_bits, mask_bits);
+/*
+ * chmod -R: корень открывается до смены его режима, дальше обход идёт
+ * только относительно дескрипторов каталогов. Если новый режим снимает x,
+ * он ставится корню после обхода (см. walk_descent_mode).
+ */
+int process_recursive(const struct mode_program *prog, const char *file_path, int workers) {
+    int dir_fd = open(file_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat dir_info;
+    if (dir_fd == -1 && errno == EACCES && stat(file_path, &dir_info) == 0 && S_ISDIR(dir_info.st_mode)) {
+        /* Каталог без r или x: если новый режим их даёт, ставим его до открытия */
+        mode_t descent = walk_descent_mode(dir_info.st_mode, 1, run_mode_program(prog, dir_info.st_mode));
+        if ((descent & (S_IRUSR | S_IXUSR)) == (S_IRUSR | S_IXUSR) && chmod(file_path, descent) == 0) {
+            dir_fd = open(file_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        } else {
+            errno = EACCES;
+        }
+    }
+    if (dir_fd == -1) {
+        if (errno == ENOTDIR) {
+            return apply_mode_program(prog, file_path);
+        }
+        perror(file_path);
+        return FAILURE;
+    }
 
-    if (chmod(file_path, updated_permissions) == -1) {
-        display_error(file_path);
+    if (fstat(dir_fd, &dir_info) == -1) {
+        perror(file_path);
+        close(dir_fd);
+        return FAILURE;
     }
+    mode_t updated = run_mode_program(prog, dir_info.st_mode);
+    mode_t root_final = (mode_t)-1;
+    if (!mode_unchanged(dir_info.st_mode, updated)) {
+        mode_t descent = walk_descent_mode(dir_info.st_mode, 1, updated);
+        if (fchmod(dir_fd, descent) == -1) {
+            perror(file_path);
+            close(dir_fd);
+            return FAILURE;
+        }
+        if (descent != updated) {
+            root_final = updated;
+        }
+    }
+
+    return walk_tree(prog, dir_fd, file_path, workers, root_final);
+}
 
+/* Список путей, собранный из аргументов и --files-from */
+struct path_list {
+    char **items;
+    size_t count;
+    size_t capacity;
+};
+
+int path_list_add(struct path_list *list, const char *path) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char **items = realloc(list->items, capacity * sizeof(char *));
+        if (items == NULL) {
+            perror("realloc");
+            return FAILURE;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count] = strdup(path);
+    if (list->items[list->count] == NULL) {
+        perror("strdup");
+        return FAILURE;
+    }
+    list->count++;
     return SUCCESS;
 }
 
-int process_mode_change(const char *mode_input, const char *file_path) {
-    if (validate_octal_string(mode_input)) {
-        return apply_numeric_mode(mode_input, file_path);
-    } else {
-        return apply_symbolic_mode(mode_input, file_path);
+void path_list_free(struct path_list *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+}
+
+/*
+ * Читает из list_path (или stdin для "-") пути, разделённые '\0'.
+ */
+int read_files_from(const char *list_path, struct path_list *list) {
+    FILE *stream = strcmp(list_path, "-") == 0 ? stdin : fopen(list_path, "r");
+    if (stream == NULL) {
+        perror(list_path);
+        return FAILURE;
+    }
+
+    int status = SUCCESS;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while (status == SUCCESS && (length = getdelim(&line, &capacity, '\0', stream)) != -1) {
+        if (length > 0 && line[length - 1] == '\0') length--;
+        if (length == 0) continue;
+        line[length] = '\0';
+        status = path_list_add(list, line);
+    }
+    if (ferror(stream)) {
+        perror(list_path);
+        status = FAILURE;
+    }
+
+    free(line);
+    if (stream != stdin) fclose(stream);
+    return status;
+}
+
+/* Обработка по одному файлу: stat и chmod по пути */
+int apply_paths_sync(const struct mode_program *prog, const struct path_list *list) {
+    int status = SUCCESS;
+    for (size_t i = 0; i < list->count; i++) {
+        if (apply_mode_program(prog, list->items[i]) != SUCCESS) status = FAILURE;
+    }
+    return status;
+}
+
+/*
+ * Обработка списка через io_uring. Для восьмеричного режима stat не нужен
+ * и выигрывать нечего, поэтому, как и при недоступном io_uring, работаем
+ * синхронно.
+ */
+int apply_paths_uring(const struct mode_program *prog, const struct path_list *list, unsigned depth) {
+    if (mode_program_needs_stat(prog)) {
+        int rc = apply_batch_uring(prog, list->items, list->count, depth);
+        if (rc != -1) {
+            return rc;
+        }
+        fprintf(stderr, "mychmod: io_uring unavailable (%s), using synchronous path\n", strerror(errno));
     }
+    return apply_paths_sync(prog, list);
+}
+
+double elapsed_seconds(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*
+ * Сравнивает скорость (файлов в секунду) синхронного пути и io_uring на
+ * одном и том же списке. Первый проход приводит права к нужным, поэтому
+ * замеры показывают установившийся режим повторных запусков.
+ */
+int run_bench(const struct mode_program *prog, const struct path_list *list, unsigned depth) {
+    struct timespec start, middle, end;
+    int status = apply_paths_sync(prog, list);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (apply_paths_sync(prog, list) != SUCCESS) status = FAILURE;
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    if (apply_paths_uring(prog, list, depth) != SUCCESS) status = FAILURE;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double sync_time = elapsed_seconds(&start, &middle);
+    double uring_time = elapsed_seconds(&middle, &end);
+    printf("mychmod bench: %zu files\n", list->count);
+    char uring_label[32];
+    snprintf(uring_label, sizeof(uring_label), "io_uring q=%u:", depth);
+    printf("  %-16s %12.0f files/s (%.3f s)\n", "sync:",
+           sync_time > 0 ? list->count / sync_time : 0.0, sync_time);
+    printf("  %-16s %12.0f files/s (%.3f s)\n", uring_label,
+           uring_time > 0 ? list->count / uring_time : 0.0, uring_time);
+    return status;
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Usages: %s [-R] [-j <threads>] <mode> <file>...\n"
+                    "        %s [-R] [-j <threads>] <mode> --files-from <list|->\n"
+                    "Options for file lists (without -R):\n"
+                    "  --io-uring          pipeline stat calls through io_uring\n"
+                    "  --queue-depth <n>   io_uring requests in flight (default %d)\n"
+                    "  --bench             compare files/s of synchronous and io_uring paths\n",
+            program, program, DEFAULT_QUEUE_DEPTH);
 }
 
 int main(int arg_count, char *arg_values[]) {
-    if (arg_count != 3) {
-        fprintf(stderr, "Usages: %s <mode> <file>\n", arg_values[0]);
+    int recursive = 0;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *files_from = NULL;
+    int use_uring = 0;
+    int bench = 0;
+    long queue_depth = DEFAULT_QUEUE_DEPTH;
+    const char *mode_specification = NULL;
+    int options_done = 0;
+    struct path_list targets = {NULL, 0, 0};
+    int status = SUCCESS;
+
+    /*
+     * Разбираем ключи вручную: getopt принял бы режим вида "-w" за ключ.
+     * Ключи допустимы и после режима; всё после "--" — имена файлов.
+     */
+    for (int arg_index = 1; arg_index < arg_count && status == SUCCESS; arg_index++) {
+        const char *arg = arg_values[arg_index];
+        int has_value = arg_index + 1 < arg_count;
+
+        if (!options_done && arg[0] == '-') {
+            if (strcmp(arg, "-R") == 0) {
+                recursive = 1;
+                continue;
+            } else if (strcmp(arg, "-j") == 0 && has_value) {
+                workers = strtol(arg_values[++arg_index], NULL, 10);
+                if (workers < 1) {
+                    print_usage(arg_values[0]);
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            } else if (strcmp(arg, "--files-from") == 0 && has_value) {
+                files_from = arg_values[++arg_index];
+                continue;
+            } else if (strcmp(arg, "--io-uring") == 0) {
+                use_uring = 1;
+                continue;
+            } else if (strcmp(arg, "--bench") == 0) {
+                bench = 1;
+                continue;
+            } else if (strcmp(arg, "--queue-depth") == 0 && has_value) {
+                queue_depth = strtol(arg_values[++arg_index], NULL, 10);
+                if (queue_depth < 1 || queue_depth > 32768) {
+                    print_usage(arg_values[0]);
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            } else if (strcmp(arg, "--") == 0) {
+                options_done = 1;
+                continue;
+            }
+            /* Иначе это режим вида "-w" или имя файла */
+        }
+
+        if (mode_specification == NULL) {
+            mode_specification = arg;
+        } else {
+            status = path_list_add(&targets, arg);
+        }
+    }
+
+    if (mode_specification == NULL || (targets.count == 0 && files_from == NULL)) {
+        print_usage(arg_values[0]);
+        path_list_free(&targets);
         exit(EXIT_FAILURE);
     }
 
-    const char *mode_specification = arg_values[1];
-    const char *target_file = arg_values[2];
+    struct mode_program program;
+    if (status != SUCCESS || compile_mode(mode_specification, &program) != SUCCESS) {
+        path_list_free(&targets);
+        return FAILURE;
+    }
+    if (workers < 1) workers = 1;
+
+    if (status == SUCCESS && files_from != NULL) {
+        status = read_files_from(files_from, &targets);
+    }
+    if (status != SUCCESS) {
+        path_list_free(&targets);
+        return FAILURE;
+    }
+
+    if (recursive) {
+        for (size_t i = 0; i < targets.count; i++) {
+            if (process_recursive(&program, targets.items[i], (int)workers) != SUCCESS) status = FAILURE;
+        }
+    } else if (bench) {
+        status = run_bench(&program, &targets, (unsigned)queue_depth);
+    } else if (use_uring) {
+        status = apply_paths_uring(&program, &targets, (unsigned)queue_depth);
+    } else {
+        status = apply_paths_sync(&program, &targets);
+    }
 
-    return process_mode_change(mode_specification, target_file);
-}
\ No newline at end of file
+    path_list_free(&targets);
+    return status;
+}
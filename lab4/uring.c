@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define FAILURE 1
+#define SUCCESS 0
+
+/* Объявления функций из main.c */
+struct mode_program;
+extern mode_t run_mode_program(const struct mode_program *prog, mode_t current);
+extern int mode_unchanged(mode_t current, mode_t updated);
+
+/*
+ * Минимальная обёртка над io_uring без liburing: одно кольцо отправки,
+ * одно кольцо завершений, массив SQE.
+ */
+struct uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned entries;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_close(struct uring *ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+}
+
+/* Возвращает 0 при успехе, -1 если io_uring недоступен (errno выставлен) */
+static int uring_open(struct uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd == -1) return -1;
+
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto fail;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+
+fail:;
+    int saved = errno;
+    uring_close(ring);
+    errno = saved;
+    return -1;
+}
+
+/*
+ * Проверяет через IORING_REGISTER_PROBE, что ядро знает операцию op.
+ * Пробы появились в 5.6 вместе с IORING_OP_STATX, поэтому ошибка
+ * регистрации тоже означает, что операции нет.
+ */
+static int uring_supports(struct uring *ring, unsigned op) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (probe == NULL) return 0;
+    int supported = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported;
+}
+
+/* Ставит в очередь statx для path; результат попадёт в buf */
+static void uring_queue_statx(struct uring *ring, const char *path, struct statx *buf, unsigned long long tag) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long long)(uintptr_t)path;
+    sqe->len = STATX_TYPE | STATX_MODE;
+    sqe->off = (unsigned long long)(uintptr_t)buf;
+    sqe->statx_flags = 0;
+    sqe->user_data = tag;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Меняет права файлов из списка, прокачивая statx через io_uring: в полёте
+ * держится до depth запросов. В io_uring нет операции смены режима, поэтому
+ * fchmodat вызывается синхронно по мере завершения statx и только для тех
+ * файлов, чей режим действительно меняется.
+ * Возвращает SUCCESS/FAILURE или -1, если io_uring недоступен или не умеет
+ * statx (ничего не сделано, errno выставлен).
+ */
+int apply_batch_uring(const struct mode_program *prog, char **paths, size_t count, unsigned depth) {
+    struct uring ring;
+    if (depth < 1) depth = 1;
+    if (uring_open(&ring, depth) == -1) {
+        return -1;
+    }
+    if (!uring_supports(&ring, IORING_OP_STATX)) {
+        uring_close(&ring);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    depth = ring.entries;
+
+    /* Буфер statx на каждый слот в полёте; номер слота едет в user_data */
+    struct statx *slots = malloc(sizeof(struct statx) * depth);
+    size_t *slot_path = malloc(sizeof(size_t) * depth);
+    unsigned *free_slots = malloc(sizeof(unsigned) * depth);
+    if (slots == NULL || slot_path == NULL || free_slots == NULL) {
+        perror("malloc");
+        free(slots);
+        free(slot_path);
+        free(free_slots);
+        uring_close(&ring);
+        return FAILURE;
+    }
+    unsigned free_count = depth;
+    for (unsigned i = 0; i < depth; i++) free_slots[i] = i;
+
+    int status = SUCCESS;
+    size_t next = 0;
+    unsigned in_flight = 0;
+    unsigned queued = 0;
+
+    while (next < count || in_flight > 0) {
+        while (next < count && free_count > 0) {
+            unsigned slot = free_slots[--free_count];
+            slot_path[slot] = next;
+            uring_queue_statx(&ring, paths[next], &slots[slot], slot);
+            next++;
+            queued++;
+            in_flight++;
+        }
+
+        int submitted = uring_enter(ring.fd, queued, 1, IORING_ENTER_GETEVENTS);
+        if (submitted == -1) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter");
+            status = FAILURE;
+            break;
+        }
+        queued -= (unsigned)submitted;
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            unsigned slot = (unsigned)cqe->user_data;
+            const char *path = paths[slot_path[slot]];
+
+            if (cqe->res < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(-cqe->res));
+                status = FAILURE;
+            } else {
+                mode_t current = slots[slot].stx_mode;
+                mode_t updated = run_mode_program(prog, current);
+                if (!mode_unchanged(current, updated) && fchmodat(AT_FDCWD, path, updated, 0) == -1) {
+                    perror(path);
+                    status = FAILURE;
+                }
+            }
+            free_slots[free_count++] = slot;
+            in_flight--;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    /* Если выходим с запросами в полёте, ядро ещё может писать в slots */
+    if (in_flight == 0) {
+        free(slots);
+    }
+    free(slot_path);
+    free(free_slots);
+    uring_close(&ring);
+    return status;
+}
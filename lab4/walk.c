@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FAILURE 1
+#define SUCCESS 0
+
+/*
+ * Ёмкость очереди каталогов; при переполнении каталог обходится тем же потоком.
+ * Каждый каталог в очереди держит открытый дескриптор, поэтому фактический
+ * предел — ещё и четверть RLIMIT_NOFILE (см. walk_tree): остальное нужно
+ * потокам, которые держат по дескриптору на уровень вложенности.
+ */
+#define WALK_QUEUE_CAPACITY 1024
+
+/* Режим каталога после обхода не меняется */
+#define WALK_KEEP_MODE ((mode_t)-1)
+
+/* Объявления функций из main.c */
+struct mode_program;
+extern int mode_program_needs_stat(const struct mode_program *prog);
+extern mode_t run_mode_program(const struct mode_program *prog, mode_t current);
+extern int mode_unchanged(mode_t current, mode_t updated);
+
+/*
+ * Каталог, ожидающий обхода: открытый дескриптор, путь для сообщений об
+ * ошибках и режим, который ставится после обхода (WALK_KEEP_MODE — никакой)
+ */
+struct walk_job {
+    int dir_fd;
+    char *path;
+    mode_t final_mode;
+};
+
+static struct walk_job queue[WALK_QUEUE_CAPACITY];
+static int queue_head = 0;
+static int queue_count = 0;
+static int queue_budget = WALK_QUEUE_CAPACITY;
+static int busy_workers = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static const struct mode_program *walk_program = NULL;
+static int walk_failed = 0;
+
+static void report_error(const char *dir_path, const char *name) {
+    int saved = errno;
+    fprintf(stderr, "mychmod: %s/%s: %s\n", dir_path, name, strerror(saved));
+    pthread_mutex_lock(&queue_lock);
+    walk_failed = 1;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static char *join_path(const char *dir_path, const char *name) {
+    size_t len = strlen(dir_path) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/%s", dir_path, name);
+    return path;
+}
+
+/*
+ * Режим, с которым каталог обходится. Поиск в каталоге (fstatat, openat,
+ * fchmodat его элементов) требует у не-root права x, поэтому, если новый
+ * режим его снимает, на время обхода x у владельца остаётся, а новый режим
+ * ставится после. Если старый режим неизвестен, x добавляется на это время.
+ */
+mode_t walk_descent_mode(mode_t current, int known, mode_t updated) {
+    if (known && !(current & S_IXUSR)) {
+        return updated;
+    }
+    return updated | S_IXUSR;
+}
+
+/* Кладёт каталог в очередь; 0 — если в очереди нет места */
+static int try_enqueue(int dir_fd, char *path, mode_t final_mode) {
+    int queued = 0;
+    pthread_mutex_lock(&queue_lock);
+    if (queue_count < queue_budget) {
+        queue[(queue_head + queue_count) % WALK_QUEUE_CAPACITY] = (struct walk_job){ dir_fd, path, final_mode };
+        queue_count++;
+        queued = 1;
+        pthread_cond_signal(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return queued;
+}
+
+/*
+ * Меняет права всех элементов каталога dir_fd. Все вызовы идут относительно
+ * дескриптора родителя, поэтому путь ни разу не разбирается ядром заново:
+ * один fstatat и один fchmodat на файл. Для восьмеричного режима тип
+ * берётся из d_type и fstatat не нужен вовсе. Если stat был и режим не
+ * меняется, chmod пропускается. Если режим обхода подкаталога даёт
+ * владельцу r и x, он ставится до openat — иначе в каталог без этих прав
+ * не войти; если снимает r или x, подкаталог сначала открывается, затем
+ * режим меняется через fchmod. Если новый режим снимает x, окончательный
+ * ставится в конце обхода самого подкаталога (см. walk_descent_mode).
+ * В конце ставит final_mode каталогу dir_fd, закрывает его и освобождает path.
+ */
+static void process_directory(int dir_fd, char *path, mode_t final_mode) {
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL) {
+        report_error(path, ".");
+        close(dir_fd);
+        free(path);
+        return;
+    }
+
+    struct dirent *entry;
+    /* readdir не сбрасывает errno в конце каталога — сбрасываем перед каждым вызовом */
+    while ((errno = 0, entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        struct stat info;
+        int have_stat = 0;
+        if (entry->d_type != DT_UNKNOWN && !mode_program_needs_stat(walk_program)) {
+            info.st_mode = DTTOIF(entry->d_type);
+        } else if (fstatat(dir_fd, name, &info, AT_SYMLINK_NOFOLLOW) == -1) {
+            report_error(path, name);
+            continue;
+        } else {
+            have_stat = 1;
+        }
+        /* Символические ссылки, как и chmod -R, не трогаем и не проходим */
+        if (S_ISLNK(info.st_mode)) {
+            continue;
+        }
+
+        mode_t updated = run_mode_program(walk_program, info.st_mode);
+        int skip_chmod = have_stat && mode_unchanged(info.st_mode, updated);
+
+        if (!S_ISDIR(info.st_mode)) {
+            if (!skip_chmod && fchmodat(dir_fd, name, updated, 0) == -1) {
+                report_error(path, name);
+            }
+            continue;
+        }
+
+        mode_t descent = walk_descent_mode(info.st_mode, have_stat, updated);
+        mode_t sub_final = (!skip_chmod && descent != updated) ? updated : WALK_KEEP_MODE;
+        int chmod_first = !skip_chmod && (descent & (S_IRUSR | S_IXUSR)) == (S_IRUSR | S_IXUSR);
+        if (chmod_first && fchmodat(dir_fd, name, descent, 0) == -1) {
+            report_error(path, name);
+            sub_final = WALK_KEEP_MODE;
+        }
+
+        int sub_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (sub_fd == -1) {
+            /* Не смогли открыть — хотя бы поменяем права самого каталога */
+            int saved = errno;
+            if (!skip_chmod && (!chmod_first || sub_final != WALK_KEEP_MODE) &&
+                fchmodat(dir_fd, name, updated, 0) == -1) {
+                report_error(path, name);
+            }
+            errno = saved;
+            report_error(path, name);
+            continue;
+        }
+        if (!skip_chmod && !chmod_first && fchmod(sub_fd, descent) == -1) {
+            report_error(path, name);
+            sub_final = WALK_KEEP_MODE;
+        }
+
+        char *sub_path = join_path(path, name);
+        if (sub_path == NULL) {
+            report_error(path, name);
+            close(sub_fd);
+            continue;
+        }
+        if (!try_enqueue(sub_fd, sub_path, sub_final)) {
+            process_directory(sub_fd, sub_path, sub_final);
+        }
+    }
+    if (errno != 0) {
+        report_error(path, ".");
+    }
+    if (final_mode != WALK_KEEP_MODE && fchmod(dir_fd, final_mode) == -1) {
+        report_error(path, ".");
+    }
+
+    closedir(dir);
+    free(path);
+}
+
+static void *walk_worker(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&queue_lock);
+    for (;;) {
+        while (queue_count == 0 && busy_workers > 0) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        if (queue_count == 0) {
+            /* Очередь пуста и никто не может её пополнить — обход окончен */
+            pthread_cond_broadcast(&queue_cond);
+            break;
+        }
+
+        struct walk_job job = queue[queue_head];
+        queue_head = (queue_head + 1) % WALK_QUEUE_CAPACITY;
+        queue_count--;
+        busy_workers++;
+        pthread_mutex_unlock(&queue_lock);
+
+        process_directory(job.dir_fd, job.path, job.final_mode);
+
+        pthread_mutex_lock(&queue_lock);
+        busy_workers--;
+        if (queue_count == 0 && busy_workers == 0) {
+            pthread_cond_broadcast(&queue_cond);
+        }
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+/*
+ * Рекурсивно применяет программу prog к дереву с корнем dir_fd (режим самого
+ * корня уже изменён вызывающей стороной, root_final — режим, который корень
+ * получит после обхода, или (mode_t)-1). Подкаталоги распределяются между
+ * workers потоками. Возвращает SUCCESS или FAILURE, если хоть что-то не удалось.
+ */
+int walk_tree(const struct mode_program *prog, int dir_fd, const char *root_path, int workers,
+              mode_t root_final) {
+    char *path = strdup(root_path);
+    if (path == NULL) {
+        perror("strdup");
+        close(dir_fd);
+        return FAILURE;
+    }
+
+    walk_program = prog;
+    walk_failed = 0;
+    queue_head = 0;
+    queue_count = 0;
+    busy_workers = 0;
+
+    /* Дескрипторы в очереди — не больше четверти лимита процесса */
+    struct rlimit limit;
+    queue_budget = WALK_QUEUE_CAPACITY;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        limit.rlim_cur / 4 < WALK_QUEUE_CAPACITY) {
+        queue_budget = limit.rlim_cur / 4 > 1 ? (int)(limit.rlim_cur / 4) : 1;
+    }
+    try_enqueue(dir_fd, path, root_final);
+
+    if (workers < 1) workers = 1;
+    pthread_t *threads = malloc(sizeof(pthread_t) * (size_t)workers);
+    int started = 0;
+    for (int i = 0; threads != NULL && i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, walk_worker, NULL) != 0) {
+            fprintf(stderr, "mychmod: cannot start worker %d\n", i);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        walk_worker(NULL);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    return walk_failed ? FAILURE : SUCCESS;
+}
@@ -0,0 +1,313 @@
+#ifndef ARCHIVER_H
+#define ARCHIVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* ===== Порядок байт на диске: всё little-endian ===== */
+
+static inline void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static inline void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static inline void put_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static inline uint16_t get_le16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_le32(const unsigned char *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline uint64_t get_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+/* ===== crc32c.c: контрольные суммы ===== */
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t length_b);
+const char *crc32c_implementation(void);
+
+/* ===== format.c: формат архива и заголовков записей ===== */
+
+#define ARCHIVE_VERSION_LEGACY 1
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_SUPERBLOCK_SIZE 16
+
+/* Флаги суперблока */
+#define ARCHIVE_FLAG_COMMITS 0x1u  /* записи действительны только до последней фиксации */
+
+/* Максимальная длина имени в v2 (с завершающим нулём в памяти) */
+#define MEMBER_NAME_MAX 4096
+/* Буфер, в который гарантированно помещается закодированный заголовок */
+#define MEMBER_HEADER_MAX 8192
+
+/* Флаги записи */
+#define MEMBER_DELETED 0x1u
+#define MEMBER_COMPRESSED 0x2u  /* данные сжаты поблочно, в заголовке есть описание сжатия */
+#define MEMBER_CHUNKED 0x4u     /* данные — список чанков (dedup.c) */
+#define MEMBER_CHUNK_PACK 0x8u  /* служебная запись с данными чанков, не член архива */
+#define MEMBER_CHECKSUM 0x10u   /* у заголовка и данных есть CRC32C */
+#define MEMBER_COMMIT 0x20u     /* служебная запись фиксации пачки записей */
+#define MEMBER_SPARSE 0x40u     /* данные — карта экстентов и экстенты без дыр (sparse.c) */
+/* Служебные записи: не члены архива, в индекс и списки не попадают */
+#define MEMBER_INTERNAL (MEMBER_CHUNK_PACK | MEMBER_COMMIT)
+/* Данные записи фиксации: u64 начало пачки, u64 смещение самой фиксации */
+#define COMMIT_DATA_SIZE 16
+/* Наименьшая запись-заглушка: заголовок без имени с контрольной суммой */
+#define FILLER_MIN_SIZE 64
+
+/* Кодеки сжатия */
+#define CODEC_NONE 0
+#define CODEC_LZ4 1
+#define CODEC_ZLIB 2
+
+/* Заголовок члена архива в памяти, независимо от версии формата на диске */
+struct member_header {
+    char name[MEMBER_NAME_MAX];
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;
+    int64_t atime_sec;
+    uint32_t atime_nsec;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t flags;
+    /* Только для MEMBER_COMPRESSED */
+    uint32_t codec;
+    uint32_t block_size;   /* несжатый размер блока */
+    uint32_t block_count;
+    uint64_t stored_size;  /* сколько байт данные занимают в архиве */
+    uint32_t data_crc;     /* только для MEMBER_CHECKSUM: CRC32C данных в архиве */
+    off_t header_offset;   /* где заголовок лежит в архиве */
+    uint32_t header_size;  /* сколько байт он занимает на диске */
+    int version;
+};
+
+/* Смещение данных и конца записи в архиве */
+static inline off_t member_data_offset(const struct member_header *member) {
+    return member->header_offset + (off_t)member->header_size;
+}
+
+static inline off_t member_end(const struct member_header *member) {
+    return member_data_offset(member) + (off_t)member->stored_size;
+}
+
+int archive_version(int fd);
+off_t archive_records_start(int version);
+void archive_encode_superblock(unsigned char *raw);
+int archive_write_superblock(int fd);
+int archive_read_stream_superblock(int fd);
+int archive_flags(int fd, uint32_t *flags);
+int archive_set_flags(int fd, uint32_t flags);
+size_t commit_encode(off_t offset, off_t batch_start, unsigned char *buf);
+int commit_write(int fd, off_t offset, off_t batch_start, off_t *end);
+int filler_write(int fd, off_t offset, uint64_t length);
+int member_from_stat(struct member_header *member, int version, const char *name, const struct stat *st);
+int member_read(int fd, int version, off_t offset, struct member_header *member);
+int member_read_stream(int fd, off_t offset, struct member_header *member);
+size_t member_encode(const struct member_header *member, unsigned char *buf);
+int member_write(int fd, struct member_header *member);
+int member_mark_deleted(int fd, struct member_header *member);
+
+/* ===== io.c: надёжные чтение/запись ===== */
+
+int write_all(int fd, const void *buffer, size_t length);
+ssize_t read_full(int fd, void *buffer, size_t length);
+int pread_all(int fd, void *buffer, size_t length, off_t offset);
+int pwrite_all(int fd, const void *buffer, size_t length, off_t offset);
+int skip_bytes(int fd, off_t length);
+
+/* Движок копирования: способы от самого дешёвого к самому общему */
+enum copy_method {
+    COPY_METHOD_RANGE,     /* copy_file_range */
+    COPY_METHOD_SENDFILE,  /* sendfile */
+    COPY_METHOD_SPLICE,    /* splice через канал */
+    COPY_METHOD_BUFFER,    /* read/write через буфер в 1 МБ */
+    COPY_METHOD_COUNT
+};
+
+/* Сколько данных и за какое время перенёс каждый способ */
+struct copy_stats {
+    uint64_t bytes;
+    uint64_t nanoseconds;
+    uint64_t calls;
+};
+
+int copy_bytes(int in_fd, int out_fd, off_t length);
+int copy_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t length);
+int copy_checksummed(int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t length, uint32_t *crc);
+const char *copy_method_name(int method);
+int copy_method_from_name(const char *name);
+void copy_set_method(int method);
+void copy_get_stats(struct copy_stats stats[COPY_METHOD_COUNT]);
+
+/* ===== dedup.c: дедупликация данных по чанкам ===== */
+
+/* Ключ чанка — SHA-256 содержимого */
+#define CHUNK_HASH_SIZE 32
+
+/* Где в архиве лежат данные чанка */
+struct chunk_entry {
+    unsigned char hash[CHUNK_HASH_SIZE];
+    uint64_t offset;
+    uint32_t length;
+};
+
+/* Хранилище чанков в памяти: массив и хеш-таблица индексов в нём */
+struct chunk_store {
+    struct chunk_entry *entries;
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;   /* номер записи + 1, 0 — пустой слот */
+    size_t slot_count;
+};
+
+void sha256(const void *data, size_t length, unsigned char digest[CHUNK_HASH_SIZE]);
+const struct chunk_entry *chunk_store_find(const struct chunk_store *store, const unsigned char *hash);
+int chunk_store_add(struct chunk_store *store, const unsigned char *hash, uint64_t offset, uint32_t length);
+void chunk_store_truncate(struct chunk_store *store, size_t count);
+void chunk_store_free(struct chunk_store *store);
+int dedup_add_file(int in_fd, int arch_fd, off_t data_end, struct member_header *member,
+                   struct chunk_store *store, uint64_t *new_bytes);
+int chunked_read_range(int fd, const struct chunk_store *store, const struct member_header *member,
+                       uint64_t offset, uint64_t length, int out_fd);
+int chunked_check(int fd, const struct chunk_store *store, const struct member_header *member);
+int pack_scan(int fd, const struct member_header *pack, struct chunk_store *store);
+int chunked_mark_live(int fd, const struct member_header *member, struct chunk_store *live);
+int pack_compact(int in_fd, const struct member_header *pack, const struct chunk_store *live,
+                 int out_fd, off_t *out_offset, struct chunk_store *out_chunks);
+
+/* ===== index.c: индекс в конце архива ===== */
+
+/* Флаги записи индекса */
+#define INDEX_ENTRY_DELETED 0x1u
+
+/* Запись индекса: где лежит заголовок члена архива и сколько у него данных */
+struct index_entry {
+    uint64_t name_hash;
+    uint64_t header_offset;
+    uint64_t data_size;
+    uint32_t flags;
+};
+
+/* Индекс в памяти: записи в порядке следования в архиве */
+struct archive_index {
+    struct index_entry *entries;
+    size_t count;
+    size_t capacity;
+    uint64_t dead_bytes;   /* сколько байт занимают удалённые записи */
+    struct chunk_store chunks;
+    /* Таблица чанков на диске, ещё не прочитанная в chunks (читается лениво) */
+    uint64_t chunk_table_offset;
+    uint64_t chunk_table_count;
+};
+
+uint64_t name_hash(const char *name);
+off_t archive_data_end(int fd);
+int index_load(int fd, struct archive_index *index, off_t *data_end);
+int index_append(struct archive_index *index, const struct member_header *member);
+int index_load_chunks(int fd, struct archive_index *index);
+int chunk_store_load(int fd, struct chunk_store *store);
+int index_write(int fd, off_t data_end, const struct archive_index *index);
+int index_lookup(int fd, int version, const char *name, struct member_header *member);
+int index_mark_deleted(int fd, const char *name, off_t header_offset, uint64_t record_size,
+                       uint64_t *dead_bytes);
+int index_update_member(int fd, const char *name, off_t header_offset, uint64_t data_size,
+                        uint64_t dead_size);
+void index_free(struct archive_index *index);
+
+/* ===== compress.c: поблочное сжатие пулом потоков ===== */
+
+struct block_pool;
+
+const char *codec_name(int codec);
+int codec_from_name(const char *name);
+struct block_pool *block_pool_create(unsigned workers);
+void block_pool_destroy(struct block_pool *pool);
+int block_compress_member(struct block_pool *pool, int in_fd, int arch_fd, off_t data_offset,
+                          struct member_header *member);
+int block_extract_member(struct block_pool *pool, int arch_fd, const struct member_header *member, int out_fd);
+int block_extract_range(int arch_fd, const struct member_header *member, uint32_t first, uint32_t count,
+                        int out_fd);
+int block_read_range(const unsigned char *data, const struct member_header *member,
+                     uint64_t offset, uint64_t length, int out_fd);
+
+/* ===== extract.c: параллельное извлечение многих членов ===== */
+
+void member_restore_metadata(int fd, const struct member_header *member);
+int member_name_safe(const char *name);
+int member_create_output(const char *name, uint32_t mode, uint64_t size);
+long extract_members(int arch_fd, const char *pattern, unsigned workers, int *errors);
+
+/* ===== verify.c: проверка целостности ===== */
+
+struct verify_result {
+    uint64_t records;    /* сколько записей прочитано */
+    uint64_t unchecked;  /* из них без контрольной суммы */
+    uint64_t bytes;      /* сколько байт данных проверено */
+    uint64_t errors;
+};
+
+int verify_archive(int arch_fd, unsigned workers, struct verify_result *result);
+
+/* ===== sparse.c: разреженные файлы ===== */
+
+/* Участок файла с данными; всё между участками — дыры */
+struct sparse_extent {
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct sparse_map {
+    struct sparse_extent *extents;
+    size_t count;
+    uint64_t data_bytes;  /* сумма длин экстентов */
+};
+
+int sparse_scan(int fd, const struct stat *st, struct sparse_map *map);
+uint64_t sparse_stored_size(const struct sparse_map *map);
+int sparse_write_map(const struct sparse_map *map, int out_fd, off_t out_offset, uint32_t *crc);
+int sparse_write(int in_fd, const struct sparse_map *map, int out_fd, off_t out_offset, uint32_t *crc);
+int sparse_extract(int fd, const struct member_header *member, int out_fd);
+int sparse_extract_stream(int in_fd, const struct member_header *member, int out_fd, uint32_t *crc);
+int sparse_read_range(int fd, const struct member_header *member, uint64_t offset, uint64_t length, int out_fd);
+void sparse_map_free(struct sparse_map *map);
+
+/* ===== stream.c: архив в канале (stdout/stdin) ===== */
+
+long stream_create(int out_fd, char **paths, size_t count, int *errors);
+long stream_extract(int in_fd, const char *pattern, int *errors);
+
+/* ===== walk.c: обход входных путей в отдельном потоке ===== */
+
+/* Открытый входной файл, готовый к записи в архив */
+struct input_file {
+    char *name;
+    int fd;
+    struct stat st;
+};
+
+struct input_walk;
+
+struct input_walk *input_walk_start(char **paths, size_t count);
+int input_walk_next(struct input_walk *walk, struct input_file *file);
+int input_walk_finish(struct input_walk *walk);
+
+#endif
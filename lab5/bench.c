@@ -0,0 +1,910 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Стенд для замеров и стресс-проверки архиватора. Собранный myArchiver
+ * запускается отдельными процессами, как его запускает пользователь.
+ *
+ * make bench — генерирует синтетические наборы (много крошечных файлов,
+ * несколько огромных, разреженные файлы) и для каждого меряет добавление,
+ * просмотр, проверку, извлечение и сжатие архива: время, пропускную
+ * способность и число системных вызовов. Вызовы считаются отдельным
+ * прогоном под ptrace (вместе со всеми потоками процесса), чтобы
+ * трассировка не искажала время. Кэш страниц при замерах тёплый.
+ *
+ * make stress — случайно перемежает добавление, обновление, извлечение с
+ * удалением, чтение диапазонов, сжатие и оборванное добавление и после
+ * каждого шага сверяет архив с эталонной моделью: набором файлов, которые
+ * в нём должны быть, и их содержимым. При расхождении печатает зерно и
+ * номер шага; прогон с тем же зерном повторяет ту же последовательность.
+ */
+
+#define SYSCALL_SLOTS 1024
+#define TOP_SYSCALLS 5
+#define IO_BUFFER_SIZE (64 * 1024)
+#define WORK_PATH_MAX 512   /* рабочий каталог и пути прямо в нём */
+
+static const char *archiver;   /* абсолютный путь к myArchiver */
+static char work_dir[WORK_PATH_MAX - 64];
+static char stderr_log[WORK_PATH_MAX];
+static int verbose;            /* печатать каждую запущенную команду */
+
+/* ===== Общие вспомогательные функции ===== */
+
+static void die(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "archbench: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* xorshift64*: воспроизводимая последовательность по зерну */
+static uint64_t rng_state;
+
+static uint64_t rnd64(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Случайное число в [0, n) */
+static uint64_t rnd(uint64_t n) {
+    return n ? rnd64() % n : 0;
+}
+
+static void make_dirs(const char *path) {
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof(copy), "%s", path);
+    for (char *p = strchr(copy + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(copy, 0777) == -1 && errno != EEXIST) die("mkdir %s: %s", copy, strerror(errno));
+        *p = '/';
+    }
+    if (mkdir(copy, 0777) == -1 && errno != EEXIST) die("mkdir %s: %s", copy, strerror(errno));
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+static void remove_tree(const char *path) {
+    if (access(path, F_OK) == 0 && nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS) == -1) {
+        die("не удалось удалить %s: %s", path, strerror(errno));
+    }
+}
+
+static void write_exact(int fd, const void *buf, size_t length, const char *path) {
+    const char *p = buf;
+    while (length > 0) {
+        ssize_t written = write(fd, p, length);
+        if (written <= 0) die("запись в %s: %s", path, strerror(errno));
+        p += written;
+        length -= (size_t)written;
+    }
+}
+
+/*
+ * Заполняет buf: случайными байтами (не сжимаются) или строками из
+ * маленького словаря (хорошо сжимаются и дедуплицируются).
+ */
+static void fill_buffer(unsigned char *buf, size_t length, int text) {
+    static const char *words[] = { "archive ", "member ", "index ", "chunk ", "commit ",
+                                   "header ", "sparse ", "extent ", "\n", "block " };
+    if (!text) {
+        for (size_t i = 0; i < length; i += 8) {
+            uint64_t value = rnd64();
+            memcpy(buf + i, &value, length - i < 8 ? length - i : 8);
+        }
+        return;
+    }
+    size_t i = 0;
+    while (i < length) {
+        const char *word = words[rnd(sizeof(words) / sizeof(words[0]))];
+        size_t n = strlen(word);
+        if (n > length - i) n = length - i;
+        memcpy(buf + i, word, n);
+        i += n;
+    }
+}
+
+static void make_parent_dirs(const char *path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL && slash != dir) {
+        *slash = '\0';
+        make_dirs(dir);
+    }
+}
+
+/* Создаёт (перезаписывает) файл size байт; каталоги по пути создаются */
+static void write_file(const char *path, uint64_t size, int text) {
+    make_parent_dirs(path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) die("открытие %s: %s", path, strerror(errno));
+    static unsigned char buf[IO_BUFFER_SIZE];
+    while (size > 0) {
+        size_t chunk = size > sizeof(buf) ? sizeof(buf) : (size_t)size;
+        fill_buffer(buf, chunk, text);
+        write_exact(fd, buf, chunk, path);
+        size -= chunk;
+    }
+    close(fd);
+}
+
+/*
+ * Создаёт разреженный файл логического размера size с islands участками
+ * данных по island байт, разбросанными по файлу.
+ */
+static void write_sparse_file(const char *path, uint64_t size, unsigned islands, uint64_t island) {
+    make_parent_dirs(path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) die("открытие %s: %s", path, strerror(errno));
+    if (ftruncate(fd, (off_t)size) == -1) die("ftruncate %s: %s", path, strerror(errno));
+    static unsigned char buf[IO_BUFFER_SIZE];
+    for (unsigned i = 0; i < islands && island <= size; i++) {
+        uint64_t offset = rnd(size - island + 1) & ~(uint64_t)4095;
+        if (lseek(fd, (off_t)offset, SEEK_SET) == -1) die("lseek %s: %s", path, strerror(errno));
+        for (uint64_t done = 0; done < island;) {
+            size_t chunk = island - done > sizeof(buf) ? sizeof(buf) : (size_t)(island - done);
+            fill_buffer(buf, chunk, 0);
+            write_exact(fd, buf, chunk, path);
+            done += chunk;
+        }
+    }
+    close(fd);
+}
+
+/* Сравнивает length байт файла a с offset с файлом b целиком; 1 — совпали */
+static int same_content(const char *a, uint64_t offset, uint64_t length, const char *b) {
+    int fa = open(a, O_RDONLY);
+    int fb = open(b, O_RDONLY);
+    struct stat st;
+    int same = fa != -1 && fb != -1 && fstat(fb, &st) == 0 && (uint64_t)st.st_size == length;
+    static unsigned char buf_a[IO_BUFFER_SIZE], buf_b[IO_BUFFER_SIZE];
+    while (same && length > 0) {
+        size_t chunk = length > IO_BUFFER_SIZE ? IO_BUFFER_SIZE : (size_t)length;
+        same = pread(fa, buf_a, chunk, (off_t)offset) == (ssize_t)chunk &&
+               read(fb, buf_b, chunk) == (ssize_t)chunk && memcmp(buf_a, buf_b, chunk) == 0;
+        offset += chunk;
+        length -= chunk;
+    }
+    if (fa != -1) close(fa);
+    if (fb != -1) close(fb);
+    return same;
+}
+
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1) die("stat %s: %s", path, strerror(errno));
+    return (uint64_t)st.st_size;
+}
+
+/* ===== Запуск архиватора ===== */
+
+struct syscall_stats {
+    uint64_t total;
+    uint64_t counts[SYSCALL_SLOTS];
+};
+
+static const struct {
+    long nr;
+    const char *name;
+} syscall_names[] = {
+    { SYS_read, "read" }, { SYS_write, "write" }, { SYS_pread64, "pread64" },
+    { SYS_pwrite64, "pwrite64" }, { SYS_openat, "openat" }, { SYS_close, "close" },
+    { SYS_lseek, "lseek" }, { SYS_mmap, "mmap" }, { SYS_munmap, "munmap" },
+    { SYS_madvise, "madvise" }, { SYS_getdents64, "getdents64" }, { SYS_fstat, "fstat" },
+    { SYS_newfstatat, "newfstatat" }, { SYS_copy_file_range, "copy_file_range" },
+    { SYS_sendfile, "sendfile" }, { SYS_splice, "splice" }, { SYS_fsync, "fsync" },
+    { SYS_fdatasync, "fdatasync" }, { SYS_fallocate, "fallocate" }, { SYS_ftruncate, "ftruncate" },
+    { SYS_futex, "futex" }, { SYS_fchmod, "fchmod" }, { SYS_fchown, "fchown" },
+    { SYS_utimensat, "utimensat" }, { SYS_mkdir, "mkdir" }, { SYS_mkdirat, "mkdirat" },
+    { SYS_brk, "brk" }, { SYS_mprotect, "mprotect" }, { SYS_clone, "clone" },
+#ifdef SYS_clone3
+    { SYS_clone3, "clone3" },
+#endif
+#ifdef SYS_statx
+    { SYS_statx, "statx" },
+#endif
+};
+
+static const char *syscall_name(long nr) {
+    static char buf[16];
+    for (size_t i = 0; i < sizeof(syscall_names) / sizeof(syscall_names[0]); i++) {
+        if (syscall_names[i].nr == nr) return syscall_names[i].name;
+    }
+    snprintf(buf, sizeof(buf), "#%ld", nr);
+    return buf;
+}
+
+/*
+ * Ведёт трассируемый процесс pid до выхода, считая входы в системные
+ * вызовы всех его потоков. Возвращает статус wait процесса.
+ */
+static int trace_child(pid_t pid, struct syscall_stats *stats) {
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) die("трассировка не запустилась");
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, 0, options) == -1) die("PTRACE_SETOPTIONS: %s", strerror(errno));
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+    int result = -1;
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == pid) result = status;
+            continue;
+        }
+        if (!WIFSTOPPED(status)) continue;
+        int signal = WSTOPSIG(status);
+        if (signal == (SIGTRAP | 0x80)) {
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 &&
+                info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                stats->total++;
+                if (info.entry.nr < SYSCALL_SLOTS) stats->counts[info.entry.nr]++;
+            }
+            signal = 0;
+        } else if (signal == SIGTRAP || signal == SIGSTOP) {
+            /* События clone и остановка нового потока сигналами не являются */
+            signal = 0;
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, signal);
+    }
+    return result;
+}
+
+/*
+ * Запускает архиватор с аргументами args (без имени программы) в каталоге
+ * cwd; stdout уходит в out (NULL — /dev/null), stderr — в журнал.
+ * При stats != NULL считает системные вызовы. Возвращает код выхода.
+ */
+static int run_archiver(const char *cwd, const char *out, struct syscall_stats *stats, char *const args[]) {
+    char *argv[32];
+    size_t argc = 0;
+    argv[argc++] = (char *)archiver;
+    for (size_t i = 0; args[i] != NULL && argc + 1 < sizeof(argv) / sizeof(argv[0]); i++) argv[argc++] = args[i];
+    argv[argc] = NULL;
+    if (verbose) {
+        fprintf(stderr, "+");
+        for (size_t i = 1; i < argc; i++) fprintf(stderr, " %s", argv[i]);
+        fprintf(stderr, "\n");
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) die("fork: %s", strerror(errno));
+    if (pid == 0) {
+        int out_fd = open(out ? out : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err_fd = open(stderr_log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd == -1 || err_fd == -1 || dup2(out_fd, STDOUT_FILENO) == -1 ||
+            dup2(err_fd, STDERR_FILENO) == -1 || chdir(cwd) == -1) {
+            _exit(127);
+        }
+        if (stats != NULL) {
+            if (ptrace(PTRACE_TRACEME, 0, 0, 0) == -1) _exit(126);
+            raise(SIGSTOP);
+        }
+        execv(archiver, argv);
+        _exit(127);
+    }
+
+    int status;
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+        status = trace_child(pid, stats);
+    } else if (waitpid(pid, &status, 0) == -1) {
+        die("waitpid: %s", strerror(errno));
+    }
+    if (!WIFEXITED(status)) die("архиватор завершился по сигналу (%s)", args[1] ? args[1] : "");
+    return WEXITSTATUS(status);
+}
+
+static void print_stderr_log(void) {
+    FILE *log = fopen(stderr_log, "r");
+    if (log == NULL) return;
+    char line[1024];
+    while (fgets(line, sizeof(line), log) != NULL) fprintf(stderr, "    | %s", line);
+    fclose(log);
+}
+
+/* ===== Замеры ===== */
+
+struct corpus {
+    const char *name;
+    char path[WORK_PATH_MAX];
+    uint64_t files;
+    uint64_t bytes;   /* логический размер */
+};
+
+/* Много крошечных файлов в двух уровнях каталогов */
+static void make_tiny(struct corpus *corpus, unsigned scale) {
+    uint64_t count = 4000ULL * scale;
+    for (uint64_t i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/d%02llu/e%llu/f%llu", corpus->path, (unsigned long long)(i % 40),
+                 (unsigned long long)(i % 7), (unsigned long long)i);
+        uint64_t size = rnd(2048);
+        write_file(path, size, (int)(i & 1));
+        corpus->files++;
+        corpus->bytes += size;
+    }
+}
+
+/* Несколько огромных файлов: сжимаемый и несжимаемый */
+static void make_huge(struct corpus *corpus, unsigned scale) {
+    for (int i = 0; i < 2; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/huge%d", corpus->path, i);
+        uint64_t size = 64ULL * 1024 * 1024 * scale;
+        write_file(path, size, i);
+        corpus->files++;
+        corpus->bytes += size;
+    }
+}
+
+/* Разреженные образы: гигабайт логического размера, данных — единицы процентов */
+static void make_sparse(struct corpus *corpus, unsigned scale) {
+    for (int i = 0; i < 2; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/image%d", corpus->path, i);
+        uint64_t size = 1024ULL * 1024 * 1024 * scale;
+        write_sparse_file(path, size, 16, 1024 * 1024);
+        corpus->files++;
+        corpus->bytes += size;
+    }
+}
+
+static void print_top(const struct syscall_stats *stats) {
+    int used[TOP_SYSCALLS];
+    for (int k = 0; k < TOP_SYSCALLS; k++) {
+        int best = -1;
+        for (int nr = 0; nr < SYSCALL_SLOTS; nr++) {
+            int taken = 0;
+            for (int j = 0; j < k; j++) taken |= used[j] == nr;
+            if (!taken && stats->counts[nr] > 0 && (best == -1 || stats->counts[nr] > stats->counts[best])) best = nr;
+        }
+        used[k] = best;
+        if (best == -1) break;
+        printf("%s%s %llu", k ? ", " : "  ", syscall_name(best), (unsigned long long)stats->counts[best]);
+    }
+    printf("\n");
+}
+
+/* Одна операция замера: подготовка перед каждым прогоном и аргументы */
+enum bench_op { OP_ADD, OP_LIST, OP_VERIFY, OP_EXTRACT, OP_COMPACT };
+
+static const char *bench_op_names[] = { "add", "list", "verify", "extract", "compact" };
+
+static void bench_corpus(const struct corpus *corpus, char **add_flags, size_t add_flag_count) {
+    char archive[PATH_MAX], out_dir[PATH_MAX];
+    snprintf(archive, sizeof(archive), "%s/%s.arc", work_dir, corpus->name);
+    snprintf(out_dir, sizeof(out_dir), "%s/out", work_dir);
+
+    for (int op = OP_ADD; op <= OP_COMPACT; op++) {
+        char *args[24];
+        size_t n = 0;
+        const char *cwd = work_dir;
+        args[n++] = archive;
+        switch (op) {
+            case OP_ADD:
+                args[n++] = "-i";
+                args[n++] = (char *)corpus->name;
+                for (size_t i = 0; i < add_flag_count && n + 1 < 24; i++) args[n++] = add_flags[i];
+                break;
+            case OP_LIST:
+                args[n++] = "-s";
+                break;
+            case OP_VERIFY:
+                args[n++] = "--verify";
+                break;
+            case OP_EXTRACT:
+                args[n++] = "--extract-all";
+                cwd = out_dir;
+                break;
+            case OP_COMPACT:
+                args[n++] = "-c";
+                break;
+        }
+        args[n] = NULL;
+
+        /* Прогон на время, затем такой же под ptrace для подсчёта вызовов */
+        double seconds = 0;
+        struct syscall_stats stats;
+        for (int traced = 0; traced < 2; traced++) {
+            if (op == OP_ADD) unlink(archive);
+            if (op == OP_EXTRACT) {
+                remove_tree(out_dir);
+                make_dirs(out_dir);
+            }
+            double started = now_seconds();
+            int code = run_archiver(cwd, NULL, traced ? &stats : NULL, args);
+            if (!traced) seconds = now_seconds() - started;
+            if (code != 0) {
+                print_stderr_log();
+                die("%s %s: код выхода %d", corpus->name, bench_op_names[op], code);
+            }
+        }
+        double mb = (double)corpus->bytes / (1024.0 * 1024.0);
+        printf("%-8s %-8s %9.3f с %10.1f МБ/с %11.0f файлов/с %10llu вызовов\n", corpus->name,
+               bench_op_names[op], seconds, seconds > 0 ? mb / seconds : 0.0,
+               seconds > 0 ? (double)corpus->files / seconds : 0.0, (unsigned long long)stats.total);
+        print_top(&stats);
+    }
+    printf("%-8s архив: %llu байт, файлов %llu, данных %.1f МБ\n\n", corpus->name,
+           (unsigned long long)file_size(archive), (unsigned long long)corpus->files,
+           (double)corpus->bytes / (1024.0 * 1024.0));
+    unlink(archive);
+    remove_tree(out_dir);
+}
+
+static void run_bench(unsigned scale, char **add_flags, size_t add_flag_count) {
+    struct corpus corpora[] = { { "tiny", "", 0, 0 }, { "huge", "", 0, 0 }, { "sparse", "", 0, 0 } };
+    void (*makers[])(struct corpus *, unsigned) = { make_tiny, make_huge, make_sparse };
+    printf("Наборы в %s (масштаб %u)\n\n", work_dir, scale);
+    for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        snprintf(corpora[i].path, sizeof(corpora[i].path), "%s/%s", work_dir, corpora[i].name);
+        double started = now_seconds();
+        makers[i](&corpora[i], scale);
+        printf("%-8s создан за %.2f с: файлов %llu, %.1f МБ\n", corpora[i].name, now_seconds() - started,
+               (unsigned long long)corpora[i].files, (double)corpora[i].bytes / (1024.0 * 1024.0));
+        bench_corpus(&corpora[i], add_flags, add_flag_count);
+        remove_tree(corpora[i].path);
+    }
+}
+
+/* ===== Стресс-проверка против модели ===== */
+
+#define STRESS_DIRS 6
+
+/* Файл модели: исходник лежит в in/<name>, пока файл есть в архиве */
+struct model_file {
+    char name[64];
+    int live;
+};
+
+static struct model_file *model;
+static size_t model_count, model_capacity;
+static unsigned long long stress_seed;
+static unsigned stress_step;
+static char in_dir[WORK_PATH_MAX], out_dir[WORK_PATH_MAX], stress_archive[WORK_PATH_MAX];
+
+static void stress_fail(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "archbench: расхождение на шаге %u (зерно %llu): ", stress_step, stress_seed);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    print_stderr_log();
+    fprintf(stderr, "archbench: архив и файлы оставлены в %s\n", work_dir);
+    exit(1);
+}
+
+static void source_path(const struct model_file *file, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", in_dir, file->name);
+}
+
+/* Новое содержимое файла модели: пустой, мелкий, средний, крупный или разреженный */
+static void generate_content(const struct model_file *file) {
+    char path[PATH_MAX];
+    source_path(file, path, sizeof(path));
+    uint64_t kind = rnd(100);
+    int text = (int)rnd(2);
+    if (kind < 8) {
+        write_file(path, 0, text);
+    } else if (kind < 50) {
+        write_file(path, rnd(4096), text);
+    } else if (kind < 80) {
+        write_file(path, rnd(256 * 1024), text);
+    } else if (kind < 95) {
+        write_file(path, rnd(4 * 1024 * 1024), text);
+    } else {
+        write_sparse_file(path, 8 * 1024 * 1024 + rnd(1024 * 1024), 1 + (unsigned)rnd(3), 64 * 1024);
+    }
+}
+
+static struct model_file *random_live(void) {
+    size_t live = 0;
+    for (size_t i = 0; i < model_count; i++) live += model[i].live;
+    if (live == 0) return NULL;
+    size_t pick = rnd(live);
+    for (size_t i = 0; i < model_count; i++) {
+        if (model[i].live && pick-- == 0) return &model[i];
+    }
+    return NULL;
+}
+
+static struct model_file *new_model_file(void) {
+    if (model_count == model_capacity) {
+        model_capacity = model_capacity ? model_capacity * 2 : 64;
+        model = realloc(model, model_capacity * sizeof(*model));
+        if (model == NULL) die("нет памяти");
+    }
+    struct model_file *file = &model[model_count];
+    snprintf(file->name, sizeof(file->name), "src/d%llu/f%zu", (unsigned long long)rnd(STRESS_DIRS), model_count);
+    file->live = 0;
+    model_count++;
+    generate_content(file);
+    return file;
+}
+
+/* Случайный способ хранения новых данных: как есть, lz4, zlib или дедупликация */
+static size_t random_store_flags(char **args, size_t n) {
+    switch (rnd(5)) {
+        case 0: args[n++] = "-z"; args[n++] = "lz4"; break;
+        case 1: args[n++] = "-z"; args[n++] = "zlib"; break;
+        case 2: args[n++] = "-d"; break;
+        default: break;
+    }
+    return n;
+}
+
+static void expect_success(char *const args[], const char *cwd, const char *out, const char *what) {
+    int code = run_archiver(cwd, out, NULL, args);
+    if (code != 0) stress_fail("%s: код выхода %d", what, code);
+}
+
+static void stress_add(void) {
+    char *args[16];
+    size_t n = 0;
+    args[n++] = stress_archive;
+    args[n++] = "-i";
+    /* new_model_file может перенести массив модели — имена берём после */
+    size_t first = model_count, count = 1 + rnd(3);
+    for (size_t i = 0; i < count; i++) new_model_file();
+    for (size_t i = 0; i < count; i++) args[n++] = model[first + i].name;
+    n = random_store_flags(args, n);
+    args[n] = NULL;
+    expect_success(args, in_dir, NULL, "добавление");
+    for (size_t i = 0; i < count; i++) model[first + i].live = 1;
+}
+
+/* Читает член целиком через --cat и сравнивает с исходником модели */
+static void stress_check_member(const struct model_file *file, const char *what) {
+    char source[PATH_MAX], out[PATH_MAX];
+    source_path(file, source, sizeof(source));
+    snprintf(out, sizeof(out), "%s/cat.out", work_dir);
+    char *args[] = { stress_archive, "--cat", (char *)file->name, NULL };
+    expect_success(args, work_dir, out, what);
+    if (!same_content(source, 0, file_size(source), out)) stress_fail("%s: '%s' отличается", what, file->name);
+}
+
+static void stress_update(void) {
+    struct model_file *file = random_live();
+    if (file == NULL) return;
+    /*
+     * Чаще — тот же размер или короче, чтобы попадать в замену на месте;
+     * разреженная замена такого размера на месте писаться не должна.
+     */
+    char path[PATH_MAX];
+    source_path(file, path, sizeof(path));
+    uint64_t old_size = file_size(path);
+    uint64_t choice = rnd(4);
+    if (choice == 0 && old_size > 0) {
+        write_file(path, old_size - rnd(old_size / 2 + 1), (int)rnd(2));
+    } else if (choice == 1) {
+        write_file(path, old_size, (int)rnd(2));
+    } else if (choice == 2) {
+        uint64_t size = old_size - rnd(old_size / 2 + 1);
+        write_sparse_file(path, size, 1 + (unsigned)rnd(3), size >= 64 * 1024 ? 16 * 1024 : 4096);
+    } else {
+        generate_content(file);
+    }
+    char *args[8];
+    size_t n = 0;
+    args[n++] = stress_archive;
+    args[n++] = "--update";
+    args[n++] = file->name;
+    if (rnd(3) == 0) n = random_store_flags(args, n);
+    args[n] = NULL;
+    expect_success(args, in_dir, NULL, "обновление");
+    stress_check_member(file, "обновление");
+}
+
+/*
+ * Известные сценарии, которые случайным шагам попадаются редко. Замена
+ * обычного члена разреженным файлом того же или меньшего размера проходила
+ * проверку на замену на месте, но ничего не записывала.
+ */
+static void stress_regressions(void) {
+    static const uint64_t sizes[] = { 2 * 1024 * 1024, 1024 * 1024 + 4096 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t index = model_count;
+        new_model_file();
+        char path[PATH_MAX];
+        source_path(&model[index], path, sizeof(path));
+        write_file(path, 2 * 1024 * 1024, 0);
+        char *add[] = { stress_archive, "-i", model[index].name, NULL };
+        expect_success(add, in_dir, NULL, "добавление (регрессия)");
+        model[index].live = 1;
+
+        write_sparse_file(path, sizes[i], 2, 64 * 1024);
+        char *update[] = { stress_archive, "--update", model[index].name, NULL };
+        expect_success(update, in_dir, NULL, "обновление разреженным (регрессия)");
+        stress_check_member(&model[index], "обновление разреженным (регрессия)");
+    }
+}
+
+static void stress_extract_delete(void) {
+    struct model_file *file = random_live();
+    if (file == NULL) return;
+    char *args[] = { stress_archive, "-e", file->name, "-t", "0.3", NULL };
+    expect_success(args, out_dir, NULL, "извлечение с удалением");
+    char source[PATH_MAX], extracted[PATH_MAX];
+    source_path(file, source, sizeof(source));
+    snprintf(extracted, sizeof(extracted), "%s/%s", out_dir, file->name);
+    if (!same_content(source, 0, file_size(source), extracted)) stress_fail("'%s' извлечён с другим содержимым", file->name);
+    unlink(source);
+    unlink(extracted);
+    file->live = 0;
+}
+
+static void stress_cat(void) {
+    struct model_file *file = random_live();
+    if (file == NULL) return;
+    char source[PATH_MAX], out[PATH_MAX], offset_arg[32], length_arg[32];
+    source_path(file, source, sizeof(source));
+    snprintf(out, sizeof(out), "%s/cat.out", work_dir);
+    uint64_t size = file_size(source);
+    uint64_t offset = rnd(size + 1);
+    uint64_t length = rnd(2) ? size - offset : rnd(size - offset + 1);
+    snprintf(offset_arg, sizeof(offset_arg), "%llu", (unsigned long long)offset);
+    snprintf(length_arg, sizeof(length_arg), "%llu", (unsigned long long)length);
+    char *args[] = { stress_archive, "--cat", file->name, "--offset", offset_arg, "--length", length_arg, NULL };
+    expect_success(args, work_dir, out, "--cat");
+    if (!same_content(source, offset, length, out)) {
+        stress_fail("--cat '%s' [%llu, +%llu) выдал другие байты", file->name, (unsigned long long)offset,
+                    (unsigned long long)length);
+    }
+}
+
+static void stress_compact(void) {
+    char *args[] = { stress_archive, "-c", NULL };
+    expect_success(args, work_dir, NULL, "сжатие");
+}
+
+/*
+ * Сверяет список архива (-s) с моделью. Если optional не NULL, этот файл
+ * может как быть, так и не быть в архиве; возвращает 1, если он есть.
+ */
+static int stress_check_list(const struct model_file *optional) {
+    char out[PATH_MAX];
+    snprintf(out, sizeof(out), "%s/list.out", work_dir);
+    char *args[] = { stress_archive, "-s", NULL };
+    expect_success(args, work_dir, out, "просмотр");
+
+    FILE *list = fopen(out, "r");
+    if (list == NULL) die("%s: %s", out, strerror(errno));
+    char line[1024];
+    size_t listed = 0;
+    int optional_found = 0;
+    for (int skip = 0; skip < 4 && fgets(line, sizeof(line), list) != NULL; skip++) {
+    }
+    while (fgets(line, sizeof(line), list) != NULL) {
+        char name[512];
+        unsigned long long size;
+        if (sscanf(line, "%511s %llu", name, &size) != 2) stress_fail("непонятная строка списка: %s", line);
+        struct model_file *file = NULL;
+        for (size_t i = 0; i < model_count && file == NULL; i++) {
+            if (strcmp(model[i].name, name) == 0) file = &model[i];
+        }
+        if (file == NULL || (!file->live && file != optional)) stress_fail("в списке лишний файл '%s'", name);
+        char source[PATH_MAX];
+        source_path(file, source, sizeof(source));
+        if (file_size(source) != size) stress_fail("у '%s' в списке размер %llu", name, size);
+        if (file == optional) {
+            if (optional_found++) stress_fail("'%s' в списке дважды", name);
+        } else {
+            listed++;
+        }
+    }
+    fclose(list);
+    size_t live = 0;
+    for (size_t i = 0; i < model_count; i++) live += model[i].live && &model[i] != optional;
+    if (listed != live) stress_fail("в списке %zu файлов, а должно быть %zu", listed, live);
+    return optional_found;
+}
+
+/*
+ * Оборванное добавление: добавляет файл и отрезает архив в случайном месте
+ * внутри дописанного. Прежние файлы обязаны остаться, новый — либо целым,
+ * либо никаким.
+ */
+static void stress_crash(void) {
+    uint64_t before = access(stress_archive, F_OK) == 0 ? file_size(stress_archive) : 0;
+    if (before == 0) return;
+    struct model_file *file = new_model_file();
+    char *args[] = { stress_archive, "-i", file->name, NULL };
+    expect_success(args, in_dir, NULL, "добавление перед обрывом");
+    /*
+     * Хвост от прошлого обрыва добавление отрезает, и архив может не
+     * вырасти — тогда обрывать нечего, файл просто добавлен.
+     */
+    uint64_t after = file_size(stress_archive);
+    if (after > before) {
+        uint64_t cut = before + rnd(after - before);
+        if (truncate(stress_archive, (off_t)cut) == -1) die("truncate: %s", strerror(errno));
+    }
+
+    if (stress_check_list(file)) {
+        char source[PATH_MAX], out[PATH_MAX];
+        source_path(file, source, sizeof(source));
+        snprintf(out, sizeof(out), "%s/cat.out", work_dir);
+        char *cat[] = { stress_archive, "--cat", file->name, NULL };
+        expect_success(cat, work_dir, out, "--cat после обрыва");
+        if (!same_content(source, 0, file_size(source), out)) stress_fail("'%s' пережил обрыв повреждённым", file->name);
+        file->live = 1;
+    } else {
+        char source[PATH_MAX];
+        source_path(file, source, sizeof(source));
+        unlink(source);
+    }
+}
+
+static size_t counted_files;
+
+static int count_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)path;
+    (void)st;
+    (void)ftw;
+    if (type == FTW_F) counted_files++;
+    return 0;
+}
+
+/* Извлекает всё в чистый каталог и сравнивает с моделью побайтно */
+static void stress_extract_all(void) {
+    char dir[WORK_PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/all", work_dir);
+    remove_tree(dir);
+    make_dirs(dir);
+    char *args[] = { stress_archive, "--extract-all", NULL };
+    size_t live = 0;
+    for (size_t i = 0; i < model_count; i++) live += model[i].live;
+    int code = run_archiver(dir, NULL, NULL, args);
+    if (code != 0 && live > 0) stress_fail("--extract-all: код выхода %d", code);
+    for (size_t i = 0; i < model_count; i++) {
+        if (!model[i].live) continue;
+        char source[PATH_MAX], extracted[PATH_MAX];
+        source_path(&model[i], source, sizeof(source));
+        snprintf(extracted, sizeof(extracted), "%s/%s", dir, model[i].name);
+        if (!same_content(source, 0, file_size(source), extracted)) {
+            stress_fail("--extract-all: '%s' отличается", model[i].name);
+        }
+    }
+    counted_files = 0;
+    nftw(dir, count_file, 16, FTW_PHYS);
+    if (counted_files != live) stress_fail("--extract-all создал %zu файлов вместо %zu", counted_files, live);
+    remove_tree(dir);
+}
+
+static void run_stress(unsigned steps) {
+    snprintf(in_dir, sizeof(in_dir), "%s/in", work_dir);
+    snprintf(out_dir, sizeof(out_dir), "%s/out", work_dir);
+    snprintf(stress_archive, sizeof(stress_archive), "%s/stress.arc", work_dir);
+    make_dirs(in_dir);
+    for (int d = 0; d < STRESS_DIRS; d++) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/src/d%d", out_dir, d);
+        make_dirs(dir);
+    }
+
+    printf("Стресс: %u шагов, зерно %llu, каталог %s\n", steps, stress_seed, work_dir);
+    stress_step = 0;
+    stress_regressions();
+    static const char *names[] = { "add", "update", "extract", "cat", "compact", "crash", "list", "all" };
+    unsigned done[8] = { 0 };
+    for (stress_step = 1; stress_step <= steps; stress_step++) {
+        uint64_t roll = rnd(100);
+        int op = roll < 30 ? 0 : roll < 50 ? 1 : roll < 60 ? 2 : roll < 75 ? 3 : roll < 80 ? 4
+               : roll < 85 ? 5 : roll < 95 ? 6 : 7;
+        if (access(stress_archive, F_OK) != 0) op = 0;
+        switch (op) {
+            case 0: stress_add(); break;
+            case 1: stress_update(); break;
+            case 2: stress_extract_delete(); break;
+            case 3: stress_cat(); break;
+            case 4: stress_compact(); break;
+            case 5: stress_crash(); break;
+            case 6: stress_check_list(NULL); break;
+            case 7: stress_extract_all(); break;
+        }
+        done[op]++;
+        /* После каждого шага архив обязан проходить проверку сумм */
+        if (access(stress_archive, F_OK) == 0) {
+            char *verify[] = { stress_archive, "--verify", NULL };
+            expect_success(verify, work_dir, NULL, "--verify");
+        }
+    }
+    stress_step = steps;
+    stress_check_list(NULL);
+    stress_extract_all();
+
+    printf("Расхождений нет. Выполнено:");
+    for (int i = 0; i < 8; i++) printf(" %s %u", names[i], done[i]);
+    printf("\n");
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Использование: archbench [опции] <путь к myArchiver> [флаги добавления...]\n"
+            "  --stress        стресс-проверка против модели вместо замеров\n"
+            "  --seed <n>      зерно генератора (по умолчанию от времени)\n"
+            "  --steps <n>     шагов стресс-проверки (по умолчанию 300)\n"
+            "  --scale <n>     множитель размеров наборов для замеров (по умолчанию 1)\n"
+            "  --dir <путь>    где создавать рабочий каталог (по умолчанию /tmp)\n"
+            "  --keep          не удалять рабочий каталог\n"
+            "  --verbose       печатать каждую команду архиватора\n"
+            "Флаги добавления (например, -z lz4 или -d) передаются в -i при замерах.\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int stress = 0, keep = 0;
+    unsigned steps = 300, scale = 1;
+    const char *base = "/tmp";
+    stress_seed = (unsigned long long)time(NULL) ^ ((unsigned long long)getpid() << 16);
+
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--stress") == 0) stress = 1;
+        else if (strcmp(argv[i], "--keep") == 0) keep = 1;
+        else if (strcmp(argv[i], "--verbose") == 0) verbose = 1;
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) stress_seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) steps = (unsigned)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) scale = (unsigned)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) base = argv[++i];
+        else usage();
+    }
+    if (i >= argc || scale == 0) usage();
+    static char resolved[PATH_MAX];
+    if (realpath(argv[i], resolved) == NULL) die("%s: %s", argv[i], strerror(errno));
+    archiver = resolved;
+    rng_state = stress_seed ? stress_seed : 1;
+
+    if (strlen(base) + sizeof("/archbench.XXXXXX") > sizeof(work_dir)) die("слишком длинный путь %s", base);
+    snprintf(work_dir, sizeof(work_dir), "%s/archbench.XXXXXX", base);
+    if (mkdtemp(work_dir) == NULL) die("mkdtemp: %s", strerror(errno));
+    snprintf(stderr_log, sizeof(stderr_log), "%s/stderr.log", work_dir);
+
+    if (stress) {
+        run_stress(steps);
+    } else {
+        run_bench(scale, argv + i + 1, (size_t)(argc - i - 1));
+    }
+    if (!keep) remove_tree(work_dir);
+    return 0;
+}
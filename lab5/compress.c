@@ -0,0 +1,661 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "archiver.h"
+
+/*
+ * Поблочное сжатие членов архива.
+ *
+ * Данные сжатого члена: таблица блоков, затем сами блоки. Каждый блок
+ * сжимается независимо, поэтому блоки сжимаются и распаковываются пулом
+ * потоков, а читать член можно с любого блока. Запись таблицы (16 байт):
+ *
+ *   0 u64 смещение блока от начала данных члена
+ *   8 u32 длина блока на диске
+ *  12 u32 флаги (BLOCK_STORED — блок не сжался и лежит как есть)
+ *
+ * Несжатая длина блока — block_size, кроме последнего.
+ */
+
+#define BLOCK_ENTRY_SIZE 16
+#define BLOCK_STORED 0x1u
+
+/* ===== LZ4: формат блока, своя реализация ===== */
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_BITS 12
+#define LZ4_MAX_DISTANCE 65535
+/* Последние 5 байт всегда литералы, последнее совпадение начинается не позже 12 байт до конца */
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+
+static size_t lz4_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static unsigned char *lz4_put_length(unsigned char *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static unsigned char *lz4_put_sequence(unsigned char *op, const unsigned char *literals, size_t literal_len,
+                                       size_t match_len, uint16_t distance) {
+    unsigned char *token = op++;
+    *token = (unsigned char)((literal_len >= 15 ? 15 : literal_len) << 4);
+    if (literal_len >= 15) op = lz4_put_length(op, literal_len - 15);
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len == 0) return op;
+
+    op[0] = (unsigned char)distance;
+    op[1] = (unsigned char)(distance >> 8);
+    op += 2;
+    match_len -= LZ4_MIN_MATCH;
+    *token |= (unsigned char)(match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15) op = lz4_put_length(op, match_len - 15);
+    return op;
+}
+
+/* Жадное сжатие с хеш-таблицей последних позиций; out не меньше lz4_bound(length) */
+static size_t lz4_compress(const unsigned char *in, size_t length, unsigned char *out) {
+    uint32_t table[1 << LZ4_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const unsigned char *ip = in;
+    const unsigned char *anchor = in;
+    const unsigned char *end = in + length;
+    unsigned char *op = out;
+
+    if (length >= LZ4_MF_LIMIT + 1) {
+        const unsigned char *match_limit = end - LZ4_MF_LIMIT;
+        const unsigned char *copy_limit = end - LZ4_LAST_LITERALS;
+        ip++;
+        while (ip < match_limit) {
+            uint32_t h = lz4_hash(read32(ip));
+            const unsigned char *ref = in + table[h];
+            table[h] = (uint32_t)(ip - in);
+            if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE || read32(ref) != read32(ip)) {
+                ip++;
+                continue;
+            }
+            /* Расширяем совпадение назад и вперёд */
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const unsigned char *mp = ip + LZ4_MIN_MATCH;
+            const unsigned char *rp = ref + LZ4_MIN_MATCH;
+            while (mp < copy_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            op = lz4_put_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(mp - ip), (uint16_t)(ip - ref));
+            ip = mp;
+            anchor = ip;
+            if (ip < match_limit) {
+                table[lz4_hash(read32(ip - 2))] = (uint32_t)(ip - 2 - in);
+            }
+        }
+    }
+    op = lz4_put_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+    return (size_t)(op - out);
+}
+
+/* Распаковывает ровно out_len байт; возвращает -1 на повреждённых данных */
+static int lz4_decompress(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_len) {
+    const unsigned char *ip = in;
+    const unsigned char *in_end = in + in_len;
+    unsigned char *op = out;
+    unsigned char *out_end = out + out_len;
+
+    while (ip < in_end) {
+        unsigned token = *ip++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15) {
+            unsigned char byte;
+            do {
+                if (ip >= in_end) return -1;
+                byte = *ip++;
+                literal_len += byte;
+            } while (byte == 255);
+        }
+        if ((size_t)(in_end - ip) < literal_len || (size_t)(out_end - op) < literal_len) return -1;
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == in_end) break;
+
+        if (in_end - ip < 2) return -1;
+        size_t distance = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (distance == 0 || distance > (size_t)(op - out)) return -1;
+
+        size_t match_len = (token & 15);
+        if (match_len == 15) {
+            unsigned char byte;
+            do {
+                if (ip >= in_end) return -1;
+                byte = *ip++;
+                match_len += byte;
+            } while (byte == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if ((size_t)(out_end - op) < match_len) return -1;
+        /* Побайтно: совпадение может перекрываться с выходом */
+        const unsigned char *ref = op - distance;
+        for (size_t i = 0; i < match_len; i++) op[i] = ref[i];
+        op += match_len;
+    }
+    return op == out_end ? 0 : -1;
+}
+
+/* ===== Выбор кодека ===== */
+
+static const char *codec_names[] = { "none", "lz4", "zlib" };
+
+const char *codec_name(int codec) {
+    return (codec >= 0 && codec < (int)(sizeof(codec_names) / sizeof(*codec_names))) ? codec_names[codec] : "?";
+}
+
+/* Возвращает кодек по имени или -1 */
+int codec_from_name(const char *name) {
+    for (int i = 0; i < (int)(sizeof(codec_names) / sizeof(*codec_names)); i++) {
+        if (strcmp(name, codec_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static size_t codec_bound(int codec, size_t length) {
+    return codec == CODEC_ZLIB ? (size_t)compressBound((uLong)length) : lz4_bound(length);
+}
+
+/* Возвращает длину сжатого блока или 0, если сжать не удалось */
+static size_t codec_compress(int codec, const unsigned char *in, size_t length, unsigned char *out, size_t capacity) {
+    if (codec == CODEC_ZLIB) {
+        uLongf out_len = (uLongf)capacity;
+        return compress2(out, &out_len, in, (uLong)length, Z_DEFAULT_COMPRESSION) == Z_OK ? (size_t)out_len : 0;
+    }
+    return lz4_compress(in, length, out);
+}
+
+static int codec_decompress(int codec, const unsigned char *in, size_t in_len, unsigned char *out, size_t out_len) {
+    if (codec == CODEC_ZLIB) {
+        uLongf got = (uLongf)out_len;
+        return (uncompress(out, &got, in, (uLong)in_len) == Z_OK && got == out_len) ? 0 : -1;
+    }
+    if (codec == CODEC_LZ4) {
+        return lz4_decompress(in, in_len, out, out_len);
+    }
+    return -1;
+}
+
+/* ===== Пул потоков ===== */
+
+enum slot_state { SLOT_FREE, SLOT_READY, SLOT_BUSY, SLOT_DONE };
+
+/*
+ * Слот — один блок в работе: сырые данные, результат и флаги. Главный поток
+ * заполняет слоты по порядку, рабочие обрабатывают их в любом порядке,
+ * а главный поток забирает результаты снова по порядку.
+ */
+struct block_slot {
+    enum slot_state state;
+    unsigned char *raw;
+    size_t raw_len;
+    unsigned char *packed;
+    size_t packed_len;
+    uint32_t flags;
+    int failed;
+};
+
+struct block_pool {
+    pthread_t *threads;
+    unsigned workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work;     /* появился слот SLOT_READY или пора выходить */
+    pthread_cond_t done;     /* какой-то слот стал SLOT_DONE */
+    int stopping;
+
+    struct block_slot *slots;
+    unsigned slot_count;
+    size_t raw_capacity;
+    size_t packed_capacity;
+
+    /* Текущая операция: сжатие (codec) или распаковка */
+    int codec;
+    int decompress;
+};
+
+static void process_slot(struct block_pool *pool, struct block_slot *slot) {
+    slot->failed = 0;
+    if (pool->decompress) {
+        if (slot->flags & BLOCK_STORED) {
+            if (slot->packed_len != slot->raw_len) slot->failed = 1;
+            else memcpy(slot->raw, slot->packed, slot->raw_len);
+        } else if (codec_decompress(pool->codec, slot->packed, slot->packed_len, slot->raw, slot->raw_len) == -1) {
+            slot->failed = 1;
+        }
+        return;
+    }
+
+    size_t packed = codec_compress(pool->codec, slot->raw, slot->raw_len, slot->packed, pool->packed_capacity);
+    if (packed == 0 || packed >= slot->raw_len) {
+        /* Несжимаемый блок храним как есть */
+        memcpy(slot->packed, slot->raw, slot->raw_len);
+        slot->packed_len = slot->raw_len;
+        slot->flags = BLOCK_STORED;
+    } else {
+        slot->packed_len = packed;
+        slot->flags = 0;
+    }
+}
+
+static void *pool_worker(void *arg) {
+    struct block_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        struct block_slot *slot = NULL;
+        while (!pool->stopping) {
+            for (unsigned i = 0; i < pool->slot_count; i++) {
+                if (pool->slots[i].state == SLOT_READY) {
+                    slot = &pool->slots[i];
+                    break;
+                }
+            }
+            if (slot) break;
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (slot == NULL) break;
+
+        slot->state = SLOT_BUSY;
+        pthread_mutex_unlock(&pool->lock);
+        process_slot(pool, slot);
+        pthread_mutex_lock(&pool->lock);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+ * Создаёт пул из workers потоков (0 — по числу процессоров).
+ * Возвращает NULL при ошибке.
+ */
+struct block_pool *block_pool_create(unsigned workers) {
+    if (workers == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = online > 0 ? (unsigned)online : 1;
+    }
+    struct block_pool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) return NULL;
+    pool->threads = calloc(workers, sizeof(*pool->threads));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (unsigned i = 0; i < workers; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) break;
+        pool->workers++;
+    }
+    if (pool->workers == 0) {
+        block_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void block_pool_destroy(struct block_pool *pool) {
+    if (pool == NULL) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned i = 0; i < pool->workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (unsigned i = 0; i < pool->slot_count; i++) {
+        free(pool->slots[i].raw);
+        free(pool->slots[i].packed);
+    }
+    free(pool->slots);
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+}
+
+/* Готовит слоты под блоки размера block_size для кодека codec */
+static int pool_prepare(struct block_pool *pool, int codec, uint32_t block_size, int decompress) {
+    size_t packed_capacity = codec_bound(codec, block_size);
+    if (pool->slots == NULL) {
+        /* Вдвое больше слотов, чем потоков: пока одни сжимаются, другие читаются и пишутся */
+        pool->slot_count = pool->workers * 2;
+        pool->slots = calloc(pool->slot_count, sizeof(*pool->slots));
+        if (pool->slots == NULL) return -1;
+    }
+    if (pool->raw_capacity < block_size || pool->packed_capacity < packed_capacity) {
+        for (unsigned i = 0; i < pool->slot_count; i++) {
+            free(pool->slots[i].raw);
+            free(pool->slots[i].packed);
+            pool->slots[i].raw = malloc(block_size);
+            pool->slots[i].packed = malloc(packed_capacity);
+            if (pool->slots[i].raw == NULL || pool->slots[i].packed == NULL) {
+                pool->raw_capacity = pool->packed_capacity = 0;
+                return -1;
+            }
+        }
+        pool->raw_capacity = block_size;
+        pool->packed_capacity = packed_capacity;
+    }
+    for (unsigned i = 0; i < pool->slot_count; i++) pool->slots[i].state = SLOT_FREE;
+    pool->codec = codec;
+    pool->decompress = decompress;
+    return 0;
+}
+
+static void pool_submit(struct block_pool *pool, struct block_slot *slot) {
+    pthread_mutex_lock(&pool->lock);
+    slot->state = SLOT_READY;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_wait(struct block_pool *pool, struct block_slot *slot) {
+    pthread_mutex_lock(&pool->lock);
+    while (slot->state != SLOT_DONE) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Дожидается всех отправленных слотов (перед выходом по ошибке) */
+static void pool_drain(struct block_pool *pool) {
+    for (unsigned i = 0; i < pool->slot_count; i++) {
+        if (pool->slots[i].state == SLOT_READY || pool->slots[i].state == SLOT_BUSY) {
+            pool_wait(pool, &pool->slots[i]);
+        }
+        pool->slots[i].state = SLOT_FREE;
+    }
+}
+
+static size_t block_raw_length(uint64_t size, uint32_t block_size, uint32_t index) {
+    uint64_t start = (uint64_t)index * block_size;
+    return (size - start < block_size) ? (size_t)(size - start) : block_size;
+}
+
+/*
+ * Сжимает size байт из in_fd (с начала файла) в архив с позиции data_offset.
+ * Блоки читаются по порядку, сжимаются пулом и пишутся по порядку; таблица
+ * блоков записывается в начало данных в конце. Заполняет member->stored_size,
+ * member->block_count и member->data_crc (сумма блоков считается по мере
+ * записи и склеивается с суммой таблицы). Возвращает 0 при успехе, -1 при ошибке.
+ */
+int block_compress_member(struct block_pool *pool, int in_fd, int arch_fd, off_t data_offset,
+                          struct member_header *member) {
+    uint64_t count64 = (member->size + member->block_size - 1) / member->block_size;
+    if (count64 > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    uint32_t count = (uint32_t)count64;
+    size_t table_size = (size_t)count * BLOCK_ENTRY_SIZE;
+    unsigned char *table = malloc(table_size ? table_size : 1);
+    if (table == NULL || pool_prepare(pool, member->codec, member->block_size, 0) == -1) {
+        free(table);
+        return -1;
+    }
+
+    uint64_t out = table_size;
+    uint32_t blocks_crc = 0;
+    uint32_t next_read = 0;
+    uint32_t next_write = 0;
+    int rc = 0;
+    while (rc == 0 && next_write < count) {
+        while (next_read < count && next_read - next_write < pool->slot_count) {
+            struct block_slot *slot = &pool->slots[next_read % pool->slot_count];
+            slot->raw_len = block_raw_length(member->size, member->block_size, next_read);
+            if (pread_all(in_fd, slot->raw, slot->raw_len, (off_t)next_read * member->block_size) == -1) {
+                rc = -1;
+                break;
+            }
+            pool_submit(pool, slot);
+            next_read++;
+        }
+        if (rc == -1) break;
+
+        struct block_slot *slot = &pool->slots[next_write % pool->slot_count];
+        pool_wait(pool, slot);
+        unsigned char *entry = table + (size_t)next_write * BLOCK_ENTRY_SIZE;
+        put_le64(entry, out);
+        put_le32(entry + 8, (uint32_t)slot->packed_len);
+        put_le32(entry + 12, slot->flags);
+        if (pwrite_all(arch_fd, slot->packed, slot->packed_len, data_offset + (off_t)out) == -1) {
+            rc = -1;
+        }
+        blocks_crc = crc32c(blocks_crc, slot->packed, slot->packed_len);
+        out += slot->packed_len;
+        slot->state = SLOT_FREE;
+        next_write++;
+    }
+    pool_drain(pool);
+
+    if (rc == 0 && table_size > 0) {
+        rc = pwrite_all(arch_fd, table, table_size, data_offset);
+    }
+    if (rc == 0) {
+        member->block_count = count;
+        member->stored_size = out;
+        member->data_crc = crc32c_combine(crc32c(0, table, table_size), blocks_crc, out - table_size);
+    }
+    free(table);
+    return rc;
+}
+
+/*
+ * Распаковывает сжатый член архива в out_fd (с начала файла): блоки
+ * читаются по таблице, распаковываются пулом и пишутся по порядку.
+ * Возвращает 0 при успехе, -1 при ошибке (EIO — повреждённые данные).
+ */
+int block_extract_member(struct block_pool *pool, int arch_fd, const struct member_header *member, int out_fd) {
+    uint32_t count = member->block_count;
+    uint64_t expected = (member->size + member->block_size - 1) / member->block_size;
+    if (expected != count || member->block_size == 0) {
+        errno = EIO;
+        return -1;
+    }
+    size_t table_size = (size_t)count * BLOCK_ENTRY_SIZE;
+    unsigned char *table = malloc(table_size ? table_size : 1);
+    if (table == NULL || pool_prepare(pool, member->codec, member->block_size, 1) == -1) {
+        free(table);
+        return -1;
+    }
+    off_t data_offset = member_data_offset(member);
+    if (table_size > 0 && pread_all(arch_fd, table, table_size, data_offset) == -1) {
+        free(table);
+        return -1;
+    }
+
+    uint32_t next_read = 0;
+    uint32_t next_write = 0;
+    int rc = 0;
+    while (rc == 0 && next_write < count) {
+        while (next_read < count && next_read - next_write < pool->slot_count) {
+            struct block_slot *slot = &pool->slots[next_read % pool->slot_count];
+            const unsigned char *entry = table + (size_t)next_read * BLOCK_ENTRY_SIZE;
+            uint64_t offset = get_le64(entry);
+            slot->packed_len = get_le32(entry + 8);
+            slot->flags = get_le32(entry + 12);
+            slot->raw_len = block_raw_length(member->size, member->block_size, next_read);
+            if (slot->packed_len > pool->packed_capacity || offset + slot->packed_len > member->stored_size) {
+                errno = EIO;
+                rc = -1;
+                break;
+            }
+            if (pread_all(arch_fd, slot->packed, slot->packed_len, data_offset + (off_t)offset) == -1) {
+                rc = -1;
+                break;
+            }
+            pool_submit(pool, slot);
+            next_read++;
+        }
+        if (rc == -1) break;
+
+        struct block_slot *slot = &pool->slots[next_write % pool->slot_count];
+        pool_wait(pool, slot);
+        if (slot->failed) {
+            errno = EIO;
+            rc = -1;
+        } else if (pwrite_all(out_fd, slot->raw, slot->raw_len, (off_t)next_write * member->block_size) == -1) {
+            rc = -1;
+        }
+        slot->state = SLOT_FREE;
+        next_write++;
+    }
+    pool_drain(pool);
+    free(table);
+    return rc;
+}
+
+/*
+ * Распаковывает блоки [first, first + count) сжатого члена в out_fd на их
+ * места в файле, в вызывающем потоке. Для параллельного извлечения многих
+ * членов (extract.c), где работу между потоками делят сами диапазоны блоков.
+ * Возвращает 0 при успехе, -1 при ошибке (EIO — повреждённые данные).
+ */
+int block_extract_range(int arch_fd, const struct member_header *member, uint32_t first, uint32_t count,
+                        int out_fd) {
+    if (member->block_size == 0 ||
+        (member->size + member->block_size - 1) / member->block_size != member->block_count ||
+        first > member->block_count || count > member->block_count - first) {
+        errno = EIO;
+        return -1;
+    }
+    if (count == 0) return 0;
+
+    size_t table_size = (size_t)count * BLOCK_ENTRY_SIZE;
+    size_t packed_capacity = codec_bound((int)member->codec, member->block_size);
+    unsigned char *table = malloc(table_size);
+    unsigned char *packed = malloc(packed_capacity);
+    unsigned char *raw = malloc(member->block_size);
+    off_t data_offset = member_data_offset(member);
+    int rc = (table && packed && raw) ? 0 : -1;
+    if (rc == 0) {
+        rc = pread_all(arch_fd, table, table_size, data_offset + (off_t)first * BLOCK_ENTRY_SIZE);
+    }
+
+    for (uint32_t i = 0; rc == 0 && i < count; i++) {
+        const unsigned char *entry = table + (size_t)i * BLOCK_ENTRY_SIZE;
+        uint64_t offset = get_le64(entry);
+        size_t packed_len = get_le32(entry + 8);
+        uint32_t flags = get_le32(entry + 12);
+        size_t raw_len = block_raw_length(member->size, member->block_size, first + i);
+        if (packed_len > packed_capacity || offset + packed_len > member->stored_size ||
+            ((flags & BLOCK_STORED) && packed_len != raw_len)) {
+            errno = EIO;
+            rc = -1;
+            break;
+        }
+        if (pread_all(arch_fd, packed, packed_len, data_offset + (off_t)offset) == -1) {
+            rc = -1;
+            break;
+        }
+        const unsigned char *block = packed;
+        if (!(flags & BLOCK_STORED)) {
+            if (codec_decompress((int)member->codec, packed, packed_len, raw, raw_len) == -1) {
+                errno = EIO;
+                rc = -1;
+                break;
+            }
+            block = raw;
+        }
+        rc = pwrite_all(out_fd, block, raw_len, (off_t)(first + i) * member->block_size);
+    }
+    free(table);
+    free(packed);
+    free(raw);
+    return rc;
+}
+
+/*
+ * Выдаёт в out_fd байты [offset, offset + length) сжатого члена, данные
+ * которого (таблица и блоки) уже отображены в память по адресу data.
+ * Распаковываются только блоки, пересекающие диапазон.
+ * Возвращает 0 при успехе, -1 при ошибке (EIO — повреждённые данные).
+ */
+int block_read_range(const unsigned char *data, const struct member_header *member,
+                     uint64_t offset, uint64_t length, int out_fd) {
+    uint64_t table_size = (uint64_t)member->block_count * BLOCK_ENTRY_SIZE;
+    if (member->block_size == 0 || table_size > member->stored_size ||
+        (member->size + member->block_size - 1) / member->block_size != member->block_count) {
+        errno = EIO;
+        return -1;
+    }
+    if (length == 0) return 0;
+
+    unsigned char *raw = malloc(member->block_size);
+    if (raw == NULL) return -1;
+
+    int rc = 0;
+    uint32_t first = (uint32_t)(offset / member->block_size);
+    uint32_t last = (uint32_t)((offset + length - 1) / member->block_size);
+    for (uint32_t i = first; rc == 0 && i <= last; i++) {
+        const unsigned char *entry = data + (size_t)i * BLOCK_ENTRY_SIZE;
+        uint64_t block_offset = get_le64(entry);
+        size_t packed_len = get_le32(entry + 8);
+        uint32_t flags = get_le32(entry + 12);
+        size_t raw_len = block_raw_length(member->size, member->block_size, i);
+        if (block_offset > member->stored_size || packed_len > member->stored_size - block_offset) {
+            errno = EIO;
+            rc = -1;
+            break;
+        }
+
+        const unsigned char *block = data + block_offset;
+        if (flags & BLOCK_STORED) {
+            if (packed_len != raw_len) {
+                errno = EIO;
+                rc = -1;
+                break;
+            }
+        } else if (codec_decompress((int)member->codec, block, packed_len, raw, raw_len) == -1) {
+            errno = EIO;
+            rc = -1;
+            break;
+        } else {
+            block = raw;
+        }
+
+        /* Часть блока, попадающая в запрошенный диапазон */
+        uint64_t block_start = (uint64_t)i * member->block_size;
+        uint64_t from = offset > block_start ? offset - block_start : 0;
+        uint64_t to = offset + length - block_start < raw_len ? offset + length - block_start : raw_len;
+        rc = write_all(out_fd, block + from, (size_t)(to - from));
+    }
+    free(raw);
+    return rc;
+}
@@ -0,0 +1,142 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "archiver.h"
+
+/*
+ * CRC32C (полином Кастаньоли, отражённый 0x82f63b78) — контрольная сумма
+ * заголовков и данных членов архива.
+ *
+ * На x86-64 с SSE4.2 считается инструкцией crc32 по 8 байт за такт, иначе —
+ * таблицами slicing-by-8. Выбор делается один раз при первом вызове.
+ * crc32c_combine склеивает суммы соседних кусков без повторного чтения
+ * данных: так --verify делит большие члены между потоками, а сжатие
+ * дописывает сумму таблицы блоков, записанной после самих блоков.
+ */
+
+#define CRC32C_POLY 0x82f63b78U
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static int crc_hardware;
+
+static uint32_t crc_software(uint32_t crc, const unsigned char *p, size_t length) {
+    while (length > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        length--;
+    }
+    while (length >= 8) {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+              crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t length) {
+    while (length > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        length--;
+    }
+    uint64_t wide = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+        p += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)wide;
+    while (length-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            crc_table[k][i] = crc_table[0][crc_table[k - 1][i] & 0xff] ^ (crc_table[k - 1][i] >> 8);
+        }
+    }
+#if defined(__x86_64__)
+    crc_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*
+ * Продолжает сумму crc (0 для начала) байтами data[0..length).
+ * crc32c(crc32c(0, a), b) == crc32c(0, a || b).
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&crc_once, crc_init);
+#if defined(__x86_64__)
+    if (crc_hardware) return ~crc_sse42(~crc, data, length);
+#endif
+    return ~crc_software(~crc, data, length);
+}
+
+/* Название реализации, которая считает суммы на этой машине */
+const char *crc32c_implementation(void) {
+    pthread_once(&crc_once, crc_init);
+    return crc_hardware ? "sse4.2" : "slicing-by-8";
+}
+
+/* ===== Склейка сумм: умножение на x^(8·length) в GF(2) ===== */
+
+static uint32_t gf2_times(const uint32_t *matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    for (; vector != 0; vector >>= 1, matrix++) {
+        if (vector & 1) sum ^= *matrix;
+    }
+    return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *matrix) {
+    for (int n = 0; n < 32; n++) square[n] = gf2_times(matrix, matrix[n]);
+}
+
+/*
+ * Сумма склейки a || b по crc_a = crc32c(0, a), crc_b = crc32c(0, b)
+ * и длине b — за O(log length_b) без доступа к данным.
+ */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t length_b) {
+    if (length_b == 0) return crc_a;
+
+    uint32_t even[32], odd[32];
+    /* Оператор сдвига на один нулевой бит */
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) odd[n] = 1U << (n - 1);
+    gf2_square(even, odd);  /* два бита */
+    gf2_square(odd, even);  /* четыре бита */
+
+    /* Сдвигаем crc_a на length_b нулевых байт */
+    do {
+        gf2_square(even, odd);
+        if (length_b & 1) crc_a = gf2_times(even, crc_a);
+        length_b >>= 1;
+        if (length_b == 0) break;
+        gf2_square(odd, even);
+        if (length_b & 1) crc_a = gf2_times(odd, crc_a);
+        length_b >>= 1;
+    } while (length_b != 0);
+    return crc_a ^ crc_b;
+}
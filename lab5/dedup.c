@@ -0,0 +1,493 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Дедупликация данных на уровне чанков.
+ *
+ * Файл режется на чанки переменной длины по содержимому (скользящий
+ * gear-хеш, как в FastCDC): границы зависят только от соседних байт,
+ * поэтому вставка в начало файла сдвигает лишь один-два чанка. Ключ
+ * чанка — SHA-256 его содержимого.
+ *
+ * Данные новых чанков пишутся в служебную запись-пакет (MEMBER_CHUNK_PACK,
+ * пустое имя) перед самим членом, а данные члена (MEMBER_CHUNKED) — это
+ * только список чанков. Оба формата самоописывающие, чтобы таблицу чанков
+ * можно было восстановить просмотром архива:
+ *
+ *   пакет: повторяется [u32 длина][32 байта SHA-256][данные чанка]
+ *   член:  повторяется [32 байта SHA-256][u32 длина]
+ *
+ * Где лежит каждый чанк, говорит таблица чанков в области индекса (index.c).
+ * Список чанков не содержит смещений, поэтому записи членов можно
+ * переносить при сжатии как есть.
+ */
+
+#define CHUNK_MIN_SIZE (2 * 1024)
+#define CHUNK_AVG_SIZE (8 * 1024)
+#define CHUNK_MAX_SIZE (64 * 1024)
+/* Маски нормализованного разбиения: до среднего размера граница реже, после — чаще */
+#define CHUNK_MASK_SMALL 0x0003590703530000ULL  /* 15 бит */
+#define CHUNK_MASK_LARGE 0x0000d90003530000ULL  /* 11 бит */
+
+#define PACK_ENTRY_SIZE (4 + CHUNK_HASH_SIZE)
+#define LIST_ENTRY_SIZE (CHUNK_HASH_SIZE + 4)
+
+/* Сколько входных данных держим в памяти при разбиении */
+#define DEDUP_READ_SIZE (1024 * 1024)
+
+static uint64_t gear_table[256];
+static int gear_ready;
+
+/* Таблица gear фиксирована: splitmix64 от постоянного зерна */
+static void gear_init(void) {
+    if (gear_ready) return;
+    uint64_t seed = 0x5eed5eed5eed5eedULL;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear_table[i] = z ^ (z >> 31);
+    }
+    gear_ready = 1;
+}
+
+/*
+ * Длина следующего чанка в data[0..length). Если данных меньше максимума
+ * и это не конец файла (at_eof == 0), граница может оказаться дальше —
+ * тогда возвращается 0 и нужно дочитать.
+ */
+static size_t next_chunk(const unsigned char *data, size_t length, int at_eof) {
+    if (length <= CHUNK_MIN_SIZE) return at_eof ? length : 0;
+    size_t limit = length < CHUNK_MAX_SIZE ? length : CHUNK_MAX_SIZE;
+    size_t normal = limit < CHUNK_AVG_SIZE ? limit : CHUNK_AVG_SIZE;
+
+    uint64_t hash = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear_table[data[i]];
+        if (!(hash & CHUNK_MASK_SMALL)) return i + 1;
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + gear_table[data[i]];
+        if (!(hash & CHUNK_MASK_LARGE)) return i + 1;
+    }
+    if (limit == CHUNK_MAX_SIZE || at_eof) return limit;
+    return 0;
+}
+
+/* ===== Хранилище чанков в памяти: массив и хеш-таблица индексов ===== */
+
+static uint64_t chunk_key(const unsigned char *hash) {
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));
+    return key;
+}
+
+static int store_rehash(struct chunk_store *store, size_t slot_count) {
+    uint32_t *slots = calloc(slot_count, sizeof(*slots));
+    if (slots == NULL) return -1;
+    for (size_t i = 0; i < store->count; i++) {
+        size_t slot = chunk_key(store->entries[i].hash) & (slot_count - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (uint32_t)(i + 1);
+    }
+    free(store->slots);
+    store->slots = slots;
+    store->slot_count = slot_count;
+    return 0;
+}
+
+const struct chunk_entry *chunk_store_find(const struct chunk_store *store, const unsigned char *hash) {
+    if (store->slot_count == 0) return NULL;
+    size_t slot = chunk_key(hash) & (store->slot_count - 1);
+    while (store->slots[slot] != 0) {
+        const struct chunk_entry *entry = &store->entries[store->slots[slot] - 1];
+        if (memcmp(entry->hash, hash, CHUNK_HASH_SIZE) == 0) return entry;
+        slot = (slot + 1) & (store->slot_count - 1);
+    }
+    return NULL;
+}
+
+/* Добавляет чанк (без проверки на повтор). Возвращает -1 при нехватке памяти */
+int chunk_store_add(struct chunk_store *store, const unsigned char *hash, uint64_t offset, uint32_t length) {
+    if (store->count == store->capacity) {
+        size_t capacity = store->capacity ? store->capacity * 2 : 1024;
+        struct chunk_entry *entries = realloc(store->entries, capacity * sizeof(*entries));
+        if (entries == NULL) return -1;
+        store->entries = entries;
+        store->capacity = capacity;
+    }
+    if (2 * (store->count + 1) > store->slot_count &&
+        store_rehash(store, store->slot_count ? store->slot_count * 2 : 2048) == -1) {
+        return -1;
+    }
+
+    struct chunk_entry *entry = &store->entries[store->count++];
+    memcpy(entry->hash, hash, CHUNK_HASH_SIZE);
+    entry->offset = offset;
+    entry->length = length;
+
+    size_t slot = chunk_key(hash) & (store->slot_count - 1);
+    while (store->slots[slot] != 0) slot = (slot + 1) & (store->slot_count - 1);
+    store->slots[slot] = (uint32_t)store->count;
+    return 0;
+}
+
+/* Откатывает хранилище к первым count чанкам */
+void chunk_store_truncate(struct chunk_store *store, size_t count) {
+    if (count >= store->count) return;
+    store->count = count;
+    if (store_rehash(store, store->slot_count) == -1) {
+        /* Без памяти на новую таблицу чистим старую на месте */
+        memset(store->slots, 0, store->slot_count * sizeof(*store->slots));
+        for (size_t i = 0; i < store->count; i++) {
+            size_t slot = chunk_key(store->entries[i].hash) & (store->slot_count - 1);
+            while (store->slots[slot] != 0) slot = (slot + 1) & (store->slot_count - 1);
+            store->slots[slot] = (uint32_t)(i + 1);
+        }
+    }
+}
+
+void chunk_store_free(struct chunk_store *store) {
+    free(store->entries);
+    free(store->slots);
+    memset(store, 0, sizeof(*store));
+}
+
+/* ===== Запись ===== */
+
+/*
+ * Добавляет файл in_fd в архив с позиции *data_end с дедупликацией.
+ * Новые чанки (в том числе повторы внутри самого файла — только первый)
+ * пишутся в пакет, за ним — член со списком чанков. Если новых чанков нет,
+ * пакет не пишется вовсе. member должен быть заполнен member_from_stat;
+ * по возвращении в нём смещение, размер заголовка и размер списка,
+ * а в *new_bytes — сколько байт новых чанков реально записано.
+ * Возвращает 0 при успехе, -1 при ошибке (хранилище откатывается).
+ */
+int dedup_add_file(int in_fd, int arch_fd, off_t data_end, struct member_header *member,
+                   struct chunk_store *store, uint64_t *new_bytes) {
+    gear_init();
+    size_t store_mark = store->count;
+    unsigned char *buf = malloc(DEDUP_READ_SIZE);
+    unsigned char *list = NULL;
+    size_t list_len = 0, list_cap = 0;
+    if (buf == NULL) return -1;
+
+    /* Данные пакета начинаются сразу за его заголовком с пустым именем */
+    struct member_header pack;
+    memset(&pack, 0, sizeof(pack));
+    pack.flags = MEMBER_CHUNK_PACK | (member->flags & MEMBER_CHECKSUM);
+    pack.version = ARCHIVE_VERSION;
+    pack.header_offset = data_end;
+    unsigned char header[MEMBER_HEADER_MAX];
+    pack.header_size = (uint32_t)member_encode(&pack, header);
+    off_t pack_out = member_data_offset(&pack);
+
+    size_t filled = 0;
+    uint64_t total = 0, written = 0;
+    int at_eof = 0;
+    int rc = 0;
+    while (rc == 0) {
+        if (!at_eof && filled < CHUNK_MAX_SIZE) {
+            ssize_t got = read(in_fd, buf + filled, DEDUP_READ_SIZE - filled);
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                rc = -1;
+                break;
+            }
+            if (got == 0) at_eof = 1;
+            filled += (size_t)got;
+            continue;
+        }
+        if (filled == 0) break;
+
+        size_t start = 0;
+        for (;;) {
+            size_t length = next_chunk(buf + start, filled - start, at_eof);
+            if (length == 0) break;
+
+            unsigned char hash[CHUNK_HASH_SIZE];
+            sha256(buf + start, length, hash);
+            if (chunk_store_find(store, hash) == NULL) {
+                unsigned char entry[PACK_ENTRY_SIZE];
+                put_le32(entry, (uint32_t)length);
+                memcpy(entry + 4, hash, CHUNK_HASH_SIZE);
+                if (pwrite_all(arch_fd, entry, sizeof(entry), pack_out) == -1 ||
+                    pwrite_all(arch_fd, buf + start, length, pack_out + PACK_ENTRY_SIZE) == -1 ||
+                    chunk_store_add(store, hash, (uint64_t)(pack_out + PACK_ENTRY_SIZE), (uint32_t)length) == -1) {
+                    rc = -1;
+                    break;
+                }
+                pack.data_crc = crc32c(crc32c(pack.data_crc, entry, sizeof(entry)), buf + start, length);
+                pack_out += PACK_ENTRY_SIZE + (off_t)length;
+                written += length;
+            }
+
+            if (list_len + LIST_ENTRY_SIZE > list_cap) {
+                list_cap = list_cap ? list_cap * 2 : 64 * LIST_ENTRY_SIZE;
+                unsigned char *grown = realloc(list, list_cap);
+                if (grown == NULL) {
+                    rc = -1;
+                    break;
+                }
+                list = grown;
+            }
+            memcpy(list + list_len, hash, CHUNK_HASH_SIZE);
+            put_le32(list + list_len + CHUNK_HASH_SIZE, (uint32_t)length);
+            list_len += LIST_ENTRY_SIZE;
+
+            start += length;
+            total += length;
+            if (start == filled) break;
+        }
+        memmove(buf, buf + start, filled - start);
+        filled -= start;
+        if (at_eof && filled == 0) break;
+    }
+    free(buf);
+
+    if (rc == 0 && total != member->size) {
+        /* Файл изменился во время чтения */
+        errno = EIO;
+        rc = -1;
+    }
+
+    /* Пакет пишется, только если в нём есть новые чанки */
+    off_t member_offset = data_end;
+    if (rc == 0 && pack_out > member_data_offset(&pack)) {
+        pack.size = pack.stored_size = (uint64_t)(pack_out - member_data_offset(&pack));
+        rc = pwrite_all(arch_fd, header, member_encode(&pack, header), data_end);
+        member_offset = pack_out;
+    }
+
+    if (rc == 0) {
+        member->flags |= MEMBER_CHUNKED;
+        member->stored_size = list_len;
+        member->data_crc = crc32c(0, list, list_len);
+        member->header_offset = member_offset;
+        member->header_size = (uint32_t)member_encode(member, header);
+        if (pwrite_all(arch_fd, header, member->header_size, member_offset) == -1 ||
+            pwrite_all(arch_fd, list, list_len, member_data_offset(member)) == -1) {
+            rc = -1;
+        }
+    }
+    free(list);
+
+    if (rc == -1) {
+        int saved = errno;
+        chunk_store_truncate(store, store_mark);
+        errno = saved;
+        return -1;
+    }
+    *new_bytes = written;
+    return 0;
+}
+
+/* ===== Чтение ===== */
+
+/*
+ * Читает список чанков члена целиком. Возвращает буфер (освобождает
+ * вызывающий) и число записей в *count, NULL при ошибке.
+ */
+static unsigned char *read_chunk_list(int fd, const struct member_header *member, size_t *count) {
+    if (member->stored_size % LIST_ENTRY_SIZE != 0) {
+        errno = EIO;
+        return NULL;
+    }
+    unsigned char *list = malloc(member->stored_size ? member->stored_size : 1);
+    if (list == NULL) return NULL;
+    if (pread_all(fd, list, member->stored_size, member_data_offset(member)) == -1) {
+        free(list);
+        return NULL;
+    }
+    *count = member->stored_size / LIST_ENTRY_SIZE;
+    return list;
+}
+
+/*
+ * Выдаёт в out_fd байты [offset, offset + length) члена со списком чанков.
+ * Чанки ищутся в store, читаются только пересекающие диапазон.
+ * Возвращает 0 при успехе, -1 при ошибке (EIO — чанк не найден или повреждён).
+ */
+int chunked_read_range(int fd, const struct chunk_store *store, const struct member_header *member,
+                       uint64_t offset, uint64_t length, int out_fd) {
+    size_t count;
+    unsigned char *list = read_chunk_list(fd, member, &count);
+    if (list == NULL) return -1;
+    unsigned char *buf = malloc(CHUNK_MAX_SIZE);
+    if (buf == NULL) {
+        free(list);
+        return -1;
+    }
+
+    int rc = 0;
+    uint64_t position = 0;
+    uint64_t end = offset + length;
+    for (size_t i = 0; rc == 0 && i < count && position < end; i++) {
+        const unsigned char *item = list + i * LIST_ENTRY_SIZE;
+        uint32_t chunk_len = get_le32(item + CHUNK_HASH_SIZE);
+        uint64_t chunk_start = position;
+        position += chunk_len;
+        if (position <= offset) continue;
+
+        const struct chunk_entry *chunk = chunk_store_find(store, item);
+        if (chunk == NULL || chunk->length != chunk_len || chunk_len > CHUNK_MAX_SIZE) {
+            errno = EIO;
+            rc = -1;
+            break;
+        }
+        if (pread_all(fd, buf, chunk_len, (off_t)chunk->offset) == -1) {
+            rc = -1;
+            break;
+        }
+        uint64_t from = offset > chunk_start ? offset - chunk_start : 0;
+        uint64_t to = end < position ? end - chunk_start : chunk_len;
+        rc = write_all(out_fd, buf + from, (size_t)(to - from));
+    }
+    if (rc == 0 && position < end && position != member->size) {
+        errno = EIO;
+        rc = -1;
+    }
+    free(buf);
+    free(list);
+    return rc;
+}
+
+/* ===== Обслуживание ===== */
+
+/*
+ * Проверяет, что все чанки из списка члена есть в store с той же длиной
+ * и что их длины в сумме дают размер файла.
+ * Возвращает 0, если всё на месте, -1 при ошибке (EIO — чанка нет).
+ */
+int chunked_check(int fd, const struct chunk_store *store, const struct member_header *member) {
+    size_t count;
+    unsigned char *list = read_chunk_list(fd, member, &count);
+    if (list == NULL) return -1;
+    uint64_t total = 0;
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < count; i++) {
+        const unsigned char *item = list + i * LIST_ENTRY_SIZE;
+        const struct chunk_entry *chunk = chunk_store_find(store, item);
+        uint32_t length = get_le32(item + CHUNK_HASH_SIZE);
+        if (chunk == NULL || chunk->length != length) rc = -1;
+        total += length;
+    }
+    free(list);
+    if (rc == -1 || total != member->size) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Добавляет в store все чанки пакета (для восстановления таблицы чанков
+ * просмотром архива). Возвращает 0 при успехе, -1 при ошибке.
+ */
+int pack_scan(int fd, const struct member_header *pack, struct chunk_store *store) {
+    off_t position = member_data_offset(pack);
+    off_t end = member_end(pack);
+    while (position < end) {
+        unsigned char entry[PACK_ENTRY_SIZE];
+        if (end - position < PACK_ENTRY_SIZE || pread_all(fd, entry, sizeof(entry), position) == -1) {
+            errno = EIO;
+            return -1;
+        }
+        uint32_t length = get_le32(entry);
+        off_t data = position + PACK_ENTRY_SIZE;
+        if (length > end - data) {
+            errno = EIO;
+            return -1;
+        }
+        if (chunk_store_find(store, entry + 4) == NULL &&
+            chunk_store_add(store, entry + 4, (uint64_t)data, length) == -1) {
+            return -1;
+        }
+        position = data + length;
+    }
+    return 0;
+}
+
+/*
+ * Добавляет в live хеши всех чанков, на которые ссылается член.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int chunked_mark_live(int fd, const struct member_header *member, struct chunk_store *live) {
+    size_t count;
+    unsigned char *list = read_chunk_list(fd, member, &count);
+    if (list == NULL) return -1;
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < count; i++) {
+        const unsigned char *item = list + i * LIST_ENTRY_SIZE;
+        if (chunk_store_find(live, item) == NULL) {
+            rc = chunk_store_add(live, item, 0, get_le32(item + CHUNK_HASH_SIZE));
+        }
+    }
+    free(list);
+    return rc;
+}
+
+/*
+ * Переписывает пакет при сжатии архива: в out_fd с позиции *out_offset
+ * попадают только чанки из live, ещё не перенесённые в out_chunks.
+ * Данные чанков копируются через буфер с подсчётом контрольной суммы
+ * нового пакета, заголовок пакета пишется последним; если переносить
+ * нечего, пакет пропадает целиком.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int pack_compact(int in_fd, const struct member_header *pack, const struct chunk_store *live,
+                 int out_fd, off_t *out_offset, struct chunk_store *out_chunks) {
+    struct member_header out;
+    memset(&out, 0, sizeof(out));
+    out.flags = MEMBER_CHUNK_PACK | (pack->flags & MEMBER_CHECKSUM);
+    out.version = ARCHIVE_VERSION;
+    out.header_offset = *out_offset;
+    unsigned char header[MEMBER_HEADER_MAX];
+    out.header_size = (uint32_t)member_encode(&out, header);
+    off_t write_at = member_data_offset(&out);
+
+    off_t position = member_data_offset(pack);
+    off_t end = member_end(pack);
+    while (position < end) {
+        unsigned char entry[PACK_ENTRY_SIZE];
+        if (end - position < PACK_ENTRY_SIZE || pread_all(in_fd, entry, sizeof(entry), position) == -1) {
+            errno = EIO;
+            return -1;
+        }
+        uint32_t length = get_le32(entry);
+        off_t data = position + PACK_ENTRY_SIZE;
+        if (length > end - data) {
+            errno = EIO;
+            return -1;
+        }
+        position = data + length;
+        if (chunk_store_find(live, entry + 4) == NULL || chunk_store_find(out_chunks, entry + 4) != NULL) {
+            continue;
+        }
+
+        out.data_crc = crc32c(out.data_crc, entry, sizeof(entry));
+        if (pwrite_all(out_fd, entry, sizeof(entry), write_at) == -1 ||
+            copy_checksummed(in_fd, data, out_fd, write_at + PACK_ENTRY_SIZE, length, &out.data_crc) == -1 ||
+            chunk_store_add(out_chunks, entry + 4, (uint64_t)(write_at + PACK_ENTRY_SIZE), length) == -1) {
+            return -1;
+        }
+        write_at += PACK_ENTRY_SIZE + (off_t)length;
+    }
+
+    if (write_at == member_data_offset(&out)) {
+        return 0;
+    }
+    out.size = out.stored_size = (uint64_t)(write_at - member_data_offset(&out));
+    if (pwrite_all(out_fd, header, member_encode(&out, header), out.header_offset) == -1) {
+        return -1;
+    }
+    *out_offset = write_at;
+    return 0;
+}
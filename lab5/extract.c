@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Параллельное извлечение многих членов архива.
+ *
+ * Главный поток один раз проходит по записям, отбирает члены (все или по
+ * шаблону) и режет работу на задачи: мелкий член — одна задача, большой —
+ * несколько диапазонов (байтов для несжатого, блоков для сжатого). Потоки
+ * пула разбирают задачи по атомарному счётчику в порядке записей архива,
+ * так что чтение идёт почти последовательно. Каждый поток сам создаёт
+ * файл, заранее выделяет под него место (fallocate) и пишет данные на их
+ * места (copy_file_range или pread/pwrite), поэтому порядок завершения
+ * задач не важен. Метаданные восстанавливаются по открытому дескриптору
+ * тем потоком, который закончил последний диапазон файла.
+ */
+
+/* Сколько данных одного члена обрабатывает одна задача */
+#define EXTRACT_RANGE_SIZE (8 * 1024 * 1024)
+
+/* Отобранный член архива и его выходной файл */
+struct extract_item {
+    char *name;
+    off_t header_offset;
+    uint64_t size;
+    uint32_t flags;
+    uint32_t block_size;
+    int fd;                    /* для разрезанных членов файл открыт заранее */
+    atomic_uint remaining;     /* сколько задач файла ещё не закончено */
+    atomic_int failed;
+};
+
+/* Задача: диапазон байтов (несжатый член) или блоков (сжатый) одного члена */
+struct extract_task {
+    struct extract_item *item;
+    uint64_t first;
+    uint64_t count;
+};
+
+struct extract_job {
+    int arch_fd;
+    int version;
+    const struct chunk_store *chunks;
+    struct extract_task *tasks;
+    size_t task_count;
+    atomic_size_t next_task;
+    atomic_int errors;
+};
+
+/*
+ * Восстанавливает права доступа, владельца и времена (с точностью до
+ * наносекунд) по открытому дескриптору fd извлечённого файла.
+ */
+void member_restore_metadata(int fd, const struct member_header *member) {
+    /* fchown может не сработать без root, это не критично */
+    (void)fchown(fd, (uid_t)member->uid, (gid_t)member->gid);
+    if (fchmod(fd, (mode_t)member->mode) == -1) {
+        perror("Предупреждение: не удалось восстановить права доступа");
+    }
+    struct timespec times[2] = {
+        { (time_t)member->atime_sec, (long)member->atime_nsec },
+        { (time_t)member->mtime_sec, (long)member->mtime_nsec },
+    };
+    if (futimens(fd, times) == -1) {
+        perror("Предупреждение: не удалось восстановить время модификации");
+    }
+}
+
+/*
+ * Можно ли извлекать член с таким именем: абсолютный путь или компонент
+ * ".." вывели бы файл за пределы текущего каталога. Возвращает 1 или 0.
+ */
+int member_name_safe(const char *name) {
+    if (name[0] == '/') return 0;
+    for (const char *p = name; *p != '\0'; p = strchrnul(p, '/')) {
+        if (*p == '/') p++;
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0')) return 0;
+    }
+    return 1;
+}
+
+/* Создаёт недостающие каталоги на пути к файлу path */
+static void make_parents(const char *path) {
+    char *copy = strdup(path);
+    if (copy == NULL) return;
+    for (char *p = strchr(copy + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(copy, 0777) == -1 && errno != EEXIST) break;
+        *p = '/';
+    }
+    free(copy);
+}
+
+/*
+ * Создаёт выходной файл члена (и недостающие каталоги) и выделяет под него
+ * место целиком, чтобы запись диапазонов не в порядке следования не
+ * дробила файл. Возвращает дескриптор или -1.
+ */
+int member_create_output(const char *name, uint32_t mode, uint64_t size) {
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, (mode_t)mode & 07777);
+    if (fd == -1 && errno == ENOENT) {
+        make_parents(name);
+        fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, (mode_t)mode & 07777);
+    }
+    if (fd == -1 || size == 0) return fd;
+    if (fallocate(fd, 0, 0, (off_t)size) == -1 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/* Помечает член неудавшимся; об ошибке сообщается один раз на файл */
+static void item_failed(struct extract_job *job, struct extract_item *item) {
+    if (atomic_exchange(&item->failed, 1) == 0) {
+        fprintf(stderr, "Ошибка: '%s': %s\n", item->name, strerror(errno));
+        atomic_fetch_add(&job->errors, 1);
+    }
+}
+
+/*
+ * Пишет в fd данные задачи: диапазон байтов, диапазон блоков или весь член
+ * из чанков или экстентов разреженного файла.
+ */
+static int write_task(struct extract_job *job, const struct extract_task *task,
+                      const struct member_header *member, int fd) {
+    if (member->flags & MEMBER_CHUNKED) {
+        return chunked_read_range(job->arch_fd, job->chunks, member, 0, member->size, fd);
+    }
+    if (member->flags & MEMBER_SPARSE) {
+        return sparse_extract(job->arch_fd, member, fd);
+    }
+    if (member->flags & MEMBER_COMPRESSED) {
+        return block_extract_range(job->arch_fd, member, (uint32_t)task->first, (uint32_t)task->count, fd);
+    }
+    return copy_range(job->arch_fd, member_data_offset(member) + (off_t)task->first, fd,
+                      (off_t)task->first, (off_t)task->count);
+}
+
+static void run_task(struct extract_job *job, struct extract_task *task) {
+    struct extract_item *item = task->item;
+    struct member_header member;
+    if (!atomic_load(&item->failed)) {
+        int rc = member_read(job->arch_fd, job->version, item->header_offset, &member);
+        if (rc == 0) {
+            /* Неразрезанный член: файл создаёт и закрывает сам поток */
+            /* Место под разреженный файл не выделяется, иначе пропадут дыры */
+            uint64_t reserve = (member.flags & MEMBER_SPARSE) ? 0 : member.size;
+            int fd = item->fd != -1 ? item->fd : member_create_output(member.name, member.mode, reserve);
+            rc = fd == -1 ? -1 : write_task(job, task, &member, fd);
+            if (item->fd == -1 && fd != -1) {
+                if (rc == 0) member_restore_metadata(fd, &member);
+                close(fd);
+            }
+        }
+        if (rc == -1) item_failed(job, item);
+    }
+
+    /*
+     * Последний закончивший диапазон разрезанного файла закрывает его.
+     * Если член не помечен неудавшимся, эта задача прочитала заголовок.
+     */
+    if (item->fd != -1 && atomic_fetch_sub(&item->remaining, 1) == 1) {
+        if (!atomic_load(&item->failed)) member_restore_metadata(item->fd, &member);
+        close(item->fd);
+    }
+}
+
+static void *extract_worker(void *arg) {
+    struct extract_job *job = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next_task, 1);
+        if (i >= job->task_count) break;
+        run_task(job, &job->tasks[i]);
+    }
+    return NULL;
+}
+
+static int compare_by_name(const void *a, const void *b) {
+    const struct extract_item *x = a;
+    const struct extract_item *y = b;
+    int rc = strcmp(x->name, y->name);
+    if (rc != 0) return rc;
+    return (x->header_offset > y->header_offset) - (x->header_offset < y->header_offset);
+}
+
+static int compare_by_offset(const void *a, const void *b) {
+    const struct extract_item *x = a;
+    const struct extract_item *y = b;
+    return (x->header_offset > y->header_offset) - (x->header_offset < y->header_offset);
+}
+
+/*
+ * Отбирает живые члены архива, подходящие под pattern (NULL — все).
+ * Из одноимённых берётся первый по порядку записей, как при извлечении
+ * по имени. Члены с небезопасными именами (member_name_safe) пропускаются
+ * и считаются в *rejected. Кладёт в *result массив в порядке записей, в
+ * *count — его длину. Возвращает 0 при успехе, -1 при ошибке.
+ */
+static int select_members(int arch_fd, int version, const char *pattern,
+                          struct extract_item **result, size_t *count, int *has_chunked, int *rejected) {
+    off_t data_end = archive_data_end(arch_fd);
+    if (data_end == -1) return -1;
+
+    struct extract_item *items = NULL;
+    size_t length = 0, capacity = 0;
+    struct member_header member;
+    off_t offset = archive_records_start(version);
+    while (offset < data_end) {
+        if (member_read(arch_fd, version, offset, &member) == -1) goto fail;
+        offset = member_end(&member);
+        if (member.flags & (MEMBER_DELETED | MEMBER_INTERNAL)) continue;
+        if (pattern != NULL && fnmatch(pattern, member.name, 0) != 0) continue;
+        if (!member_name_safe(member.name)) {
+            fprintf(stderr, "Ошибка: '%s': абсолютное имя или '..' в пути, файл не извлекается\n", member.name);
+            (*rejected)++;
+            continue;
+        }
+
+        if (length == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            struct extract_item *grown = realloc(items, capacity * sizeof(*items));
+            if (grown == NULL) goto fail;
+            items = grown;
+        }
+        struct extract_item *item = &items[length];
+        memset(item, 0, sizeof(*item));
+        if ((item->name = strdup(member.name)) == NULL) goto fail;
+        item->header_offset = member.header_offset;
+        item->size = member.size;
+        item->flags = member.flags;
+        item->block_size = member.block_size;
+        item->fd = -1;
+        if (member.flags & MEMBER_CHUNKED) *has_chunked = 1;
+        length++;
+    }
+
+    /* Оставляем только первое вхождение каждого имени */
+    qsort(items, length, sizeof(*items), compare_by_name);
+    size_t kept = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (kept > 0 && strcmp(items[kept - 1].name, items[i].name) == 0) {
+            free(items[i].name);
+            continue;
+        }
+        items[kept++] = items[i];
+    }
+    qsort(items, kept, sizeof(*items), compare_by_offset);
+    *result = items;
+    *count = kept;
+    return 0;
+
+fail:
+    for (size_t i = 0; i < length; i++) free(items[i].name);
+    free(items);
+    return -1;
+}
+
+/* Сколько задач нужно члену: по EXTRACT_RANGE_SIZE несжатых байт */
+static uint64_t task_step(const struct extract_item *item) {
+    if (item->flags & MEMBER_COMPRESSED) {
+        uint64_t blocks = item->block_size ? EXTRACT_RANGE_SIZE / item->block_size : 1;
+        return blocks ? blocks : 1;
+    }
+    return EXTRACT_RANGE_SIZE;
+}
+
+static uint64_t task_units(const struct extract_item *item) {
+    if (item->flags & MEMBER_COMPRESSED) {
+        return item->block_size ? (item->size + item->block_size - 1) / item->block_size : 0;
+    }
+    return item->size;
+}
+
+/*
+ * Извлекает из архива все живые члены (pattern == NULL) или подходящие под
+ * шаблон fnmatch пулом из workers потоков (0 — по числу процессоров).
+ * Архив не меняется. Возвращает число извлечённых файлов или -1 при ошибке
+ * чтения архива; о файлах, которые не удалось извлечь, сообщает в stderr
+ * и учитывает их в *errors.
+ */
+long extract_members(int arch_fd, const char *pattern, unsigned workers, int *errors) {
+    *errors = 0;
+    int version = archive_version(arch_fd);
+    if (version <= 0) return version;
+
+    struct extract_item *items = NULL;
+    size_t item_count = 0;
+    int has_chunked = 0;
+    int rejected = 0;
+    if (select_members(arch_fd, version, pattern, &items, &item_count, &has_chunked, &rejected) == -1) {
+        return -1;
+    }
+
+    struct extract_job job;
+    memset(&job, 0, sizeof(job));
+    job.arch_fd = arch_fd;
+    job.version = version;
+    struct chunk_store chunks;
+    memset(&chunks, 0, sizeof(chunks));
+    job.chunks = &chunks;
+    long result = -1;
+    if (has_chunked && chunk_store_load(arch_fd, &chunks) == -1) goto out;
+
+    /* Нарезка задач; разрезанные файлы создаются здесь, до запуска потоков */
+    size_t capacity = item_count;
+    job.tasks = malloc((capacity ? capacity : 1) * sizeof(*job.tasks));
+    if (job.tasks == NULL) goto out;
+    for (size_t i = 0; i < item_count; i++) {
+        struct extract_item *item = &items[i];
+        uint64_t units = task_units(item);
+        uint64_t step = task_step(item);
+        uint64_t parts = (item->flags & (MEMBER_CHUNKED | MEMBER_SPARSE)) || units <= step ? 1
+                         : (units + step - 1) / step;
+        atomic_init(&item->remaining, (unsigned)parts);
+        atomic_init(&item->failed, 0);
+        if (parts > 1 && (item->fd = member_create_output(item->name, 0600, item->size)) == -1) {
+            item_failed(&job, item);
+            continue;
+        }
+        if (job.task_count + parts > capacity) {
+            capacity = (job.task_count + parts) * 2;
+            struct extract_task *grown = realloc(job.tasks, capacity * sizeof(*job.tasks));
+            if (grown == NULL) goto out;
+            job.tasks = grown;
+        }
+        for (uint64_t p = 0; p < parts; p++) {
+            struct extract_task *task = &job.tasks[job.task_count++];
+            task->item = item;
+            task->first = p * step;
+            task->count = parts == 1 ? units : (units - task->first < step ? units - task->first : step);
+        }
+    }
+
+    if (workers == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = online > 0 ? (unsigned)online : 1;
+    }
+    if (workers > job.task_count) workers = job.task_count ? (unsigned)job.task_count : 1;
+    pthread_t *threads = calloc(workers, sizeof(*threads));
+    unsigned started = 0;
+    if (threads != NULL) {
+        for (; started < workers; started++) {
+            if (pthread_create(&threads[started], NULL, extract_worker, &job) != 0) break;
+        }
+    }
+    /* Если потоки не запустились, вызывающий поток делает всё сам */
+    extract_worker(&job);
+    for (unsigned i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    result = 0;
+    for (size_t i = 0; i < item_count; i++) {
+        if (!atomic_load(&items[i].failed)) result++;
+    }
+    *errors = atomic_load(&job.errors) + rejected;
+
+out:
+    if (result == -1) {
+        /* Потоки не запускались: файлы, которые успели открыть, закрываем здесь */
+        for (size_t i = 0; i < item_count; i++) {
+            if (items[i].fd != -1) close(items[i].fd);
+        }
+    }
+    for (size_t i = 0; i < item_count; i++) free(items[i].name);
+    free(items);
+    free(job.tasks);
+    chunk_store_free(&chunks);
+    return result;
+}
@@ -0,0 +1,497 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Два формата записей.
+ *
+ * v1 (исходный): архив начинается сразу с записей, каждая — сырая
+ * struct file_header (имя в 1024 байта и struct stat как есть в памяти,
+ * около 1.2 КБ и зависит от ABI), затем данные.
+ *
+ * v2: архив начинается с суперблока "MYARCHIV" + версия, каждая запись —
+ * компактный заголовок с полями фиксированной ширины (little-endian)
+ * и именем с префиксом длины:
+ *
+ *   0  u32 магия записи "MBR2"      24 u64 размер
+ *   4  u16 длина заголовка          32 i64 atime, сек
+ *   6  u16 длина имени              40 u32 atime, нс
+ *   8  u32 флаги                    44 u32 mtime, нс
+ *  12  u32 режим                    48 i64 mtime, сек
+ *  16  u32 uid                      56 имя (без завершающего нуля)
+ *  20  u32 gid
+ *
+ * Имя всегда занимает последние байты заголовка, поэтому будущие поля
+ * можно добавлять между фиксированной частью и именем. Сейчас так
+ * добавлено описание сжатия (только при флаге MEMBER_COMPRESSED):
+ *
+ *  56 u32 кодек                     68 u32 резерв
+ *  60 u32 размер блока              72 u64 размер данных в архиве
+ *  64 u32 число блоков
+ *
+ * За ним (только при флаге MEMBER_CHUNKED, см. dedup.c) — u64 размер
+ * списка чанков в архиве. Служебные записи-пакеты чанков
+ * (MEMBER_CHUNK_PACK) других расширений не имеют, имя у них пустое.
+ * Следом (только при флаге MEMBER_SPARSE, см. sparse.c) — u64 размер
+ * карты экстентов вместе с данными экстентов.
+ *
+ * Последнее расширение (при флаге MEMBER_CHECKSUM) — u32 CRC32C данных
+ * записи в том виде, в каком они лежат в архиве, и u32 CRC32C всего
+ * заголовка, посчитанная с нулём на месте этого поля. Заголовок с
+ * неверной суммой member_read не принимает.
+ *
+ * Если в суперблоке стоит ARCHIVE_FLAG_COMMITS, записи дописываются
+ * пачками, и каждая пачка завершается записью фиксации (MEMBER_COMMIT,
+ * см. commit_write) после fdatasync. Действительны только записи до конца
+ * последней фиксации: всё, что за ней, — след оборванного добавления.
+ *
+ * Когда данные члена заменяются на месте более короткими (--update),
+ * освободившийся хвост занимает запись-заглушка: удалённая запись без
+ * имени, данные которой — старые байты хвоста (см. filler_write). Цепочка
+ * записей при этом не рвётся, а сжатие архива заглушку выбрасывает.
+ */
+
+#define ARCHIVE_MAGIC "MYARCHIV"
+#define ARCHIVE_MAGIC_LEN 8
+#define MEMBER_MAGIC 0x3252424dU /* "MBR2" */
+#define MEMBER_FIXED_SIZE 56
+#define MEMBER_COMPRESSION_SIZE 24
+#define MEMBER_CHUNKED_SIZE 8
+#define MEMBER_SPARSE_SIZE 8
+#define MEMBER_CHECKSUM_SIZE 8
+/* Сколько байт заголовка читать за один pread: хватает на типичное имя */
+#define MEMBER_READ_AHEAD 512
+
+/* Заголовок формата v1 — только для чтения и дописывания старых архивов */
+struct file_header {
+    char name[1024];
+    struct stat metadata;
+    char is_deleted;
+};
+
+/*
+ * Определяет формат архива по первым байтам.
+ * Возвращает 0 для пустого файла, 1 или 2 — версию, -1 при ошибке.
+ */
+int archive_version(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) return -1;
+    if (st.st_size == 0) return 0;
+    if (st.st_size >= ARCHIVE_SUPERBLOCK_SIZE) {
+        unsigned char raw[ARCHIVE_SUPERBLOCK_SIZE];
+        if (pread_all(fd, raw, sizeof(raw), 0) == -1) return -1;
+        if (memcmp(raw, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) == 0) {
+            uint32_t version = get_le32(raw + 8);
+            if (version != ARCHIVE_VERSION) {
+                errno = ENOTSUP;
+                return -1;
+            }
+            return ARCHIVE_VERSION;
+        }
+    }
+    return ARCHIVE_VERSION_LEGACY;
+}
+
+off_t archive_records_start(int version) {
+    return version == ARCHIVE_VERSION ? ARCHIVE_SUPERBLOCK_SIZE : 0;
+}
+
+/* Кодирует суперблок v2 в raw; новые архивы сразу с фиксациями */
+void archive_encode_superblock(unsigned char *raw) {
+    memcpy(raw, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN);
+    put_le32(raw + 8, ARCHIVE_VERSION);
+    put_le32(raw + 12, ARCHIVE_FLAG_COMMITS);
+}
+
+/* Записывает суперблок v2 в начало файла */
+int archive_write_superblock(int fd) {
+    unsigned char raw[ARCHIVE_SUPERBLOCK_SIZE];
+    archive_encode_superblock(raw);
+    return pwrite_all(fd, raw, sizeof(raw), 0);
+}
+
+/*
+ * Читает суперблок из потока. Возвращает 0, если это архив v2, и -1 при
+ * ошибке (EINVAL — не архив v2: старый формат из потока не читается).
+ */
+int archive_read_stream_superblock(int fd) {
+    unsigned char raw[ARCHIVE_SUPERBLOCK_SIZE];
+    ssize_t got = read_full(fd, raw, sizeof(raw));
+    if (got == -1) return -1;
+    if (got < (ssize_t)sizeof(raw) || memcmp(raw, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) != 0 ||
+        get_le32(raw + 8) != ARCHIVE_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Флаги суперблока архива v2 (у v1 и пустого файла — 0) */
+int archive_flags(int fd, uint32_t *flags) {
+    int version = archive_version(fd);
+    if (version == -1) return -1;
+    *flags = 0;
+    if (version != ARCHIVE_VERSION) return 0;
+    unsigned char raw[4];
+    if (pread_all(fd, raw, sizeof(raw), 12) == -1) return -1;
+    *flags = get_le32(raw);
+    return 0;
+}
+
+int archive_set_flags(int fd, uint32_t flags) {
+    unsigned char raw[4];
+    put_le32(raw, flags);
+    return pwrite_all(fd, raw, sizeof(raw), 12);
+}
+
+/*
+ * Кодирует в buf (размером не меньше MEMBER_HEADER_MAX + COMMIT_DATA_SIZE)
+ * запись фиксации для смещения offset: служебную запись с пустым именем и
+ * 16 байтами данных — u64 начало зафиксированной пачки и u64 смещение
+ * самой фиксации. Обе части защищены контрольными суммами, так что
+ * оборванная фиксация не принимается. Возвращает длину записи.
+ */
+size_t commit_encode(off_t offset, off_t batch_start, unsigned char *buf) {
+    struct member_header commit;
+    memset(&commit, 0, sizeof(commit));
+    commit.flags = MEMBER_COMMIT | MEMBER_CHECKSUM;
+    commit.size = commit.stored_size = COMMIT_DATA_SIZE;
+    commit.version = ARCHIVE_VERSION;
+    commit.header_offset = offset;
+
+    unsigned char data[COMMIT_DATA_SIZE];
+    put_le64(data, (uint64_t)batch_start);
+    put_le64(data + 8, (uint64_t)offset);
+    commit.data_crc = crc32c(0, data, sizeof(data));
+
+    commit.header_size = (uint32_t)member_encode(&commit, buf);
+    memcpy(buf + commit.header_size, data, sizeof(data));
+    return commit.header_size + sizeof(data);
+}
+
+/* Записывает фиксацию по смещению offset одним pwrite; в *end — её конец */
+int commit_write(int fd, off_t offset, off_t batch_start, off_t *end) {
+    unsigned char buf[MEMBER_HEADER_MAX + COMMIT_DATA_SIZE];
+    size_t length = commit_encode(offset, batch_start, buf);
+    if (pwrite_all(fd, buf, length, offset) == -1) return -1;
+    *end = offset + (off_t)length;
+    return 0;
+}
+
+/*
+ * Превращает length байт архива с offset (не меньше FILLER_MIN_SIZE) в
+ * удалённую запись-заглушку: старые байты после её заголовка становятся
+ * данными записи, их сумма считается чтением, но не переписывается.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int filler_write(int fd, off_t offset, uint64_t length) {
+    struct member_header filler;
+    unsigned char buf[MEMBER_HEADER_MAX];
+    memset(&filler, 0, sizeof(filler));
+    filler.flags = MEMBER_DELETED | MEMBER_CHECKSUM;
+    filler.version = ARCHIVE_VERSION;
+    filler.header_offset = offset;
+    filler.header_size = (uint32_t)member_encode(&filler, buf);
+    if (length < filler.header_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    filler.size = filler.stored_size = length - filler.header_size;
+    if (copy_checksummed(fd, member_data_offset(&filler), -1, -1, (off_t)filler.size, &filler.data_crc) == -1) {
+        return -1;
+    }
+    return pwrite_all(fd, buf, member_encode(&filler, buf), offset);
+}
+
+/*
+ * Заполняет заголовок по имени и метаданным исходного файла.
+ * Возвращает -1, если имя слишком длинное для формата version.
+ */
+int member_from_stat(struct member_header *member, int version, const char *name, const struct stat *st) {
+    size_t name_len = strlen(name);
+    size_t limit = (version == ARCHIVE_VERSION_LEGACY) ? sizeof(((struct file_header *)0)->name)
+                                                       : MEMBER_NAME_MAX;
+    if (name_len >= limit) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(member, 0, sizeof(*member));
+    memcpy(member->name, name, name_len + 1);
+    member->mode = (uint32_t)st->st_mode;
+    member->uid = (uint32_t)st->st_uid;
+    member->gid = (uint32_t)st->st_gid;
+    member->size = (uint64_t)st->st_size;
+    member->atime_sec = (int64_t)st->st_atim.tv_sec;
+    member->atime_nsec = (uint32_t)st->st_atim.tv_nsec;
+    member->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    member->mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    member->stored_size = member->size;
+    member->version = version;
+    /* Новые записи v2 всегда с контрольными суммами */
+    if (version == ARCHIVE_VERSION) member->flags = MEMBER_CHECKSUM;
+    return 0;
+}
+
+/* Суммарный размер расширений заголовка v2 при данных флагах */
+static size_t member_extensions_size(uint32_t flags) {
+    size_t size = 0;
+    if (flags & MEMBER_COMPRESSED) size += MEMBER_COMPRESSION_SIZE;
+    if (flags & MEMBER_CHUNKED) size += MEMBER_CHUNKED_SIZE;
+    if (flags & MEMBER_SPARSE) size += MEMBER_SPARSE_SIZE;
+    if (flags & MEMBER_CHECKSUM) size += MEMBER_CHECKSUM_SIZE;
+    return size;
+}
+
+static int decode_legacy(const struct file_header *raw, struct member_header *member) {
+    memset(member, 0, sizeof(*member));
+    memcpy(member->name, raw->name, sizeof(raw->name));
+    member->name[sizeof(raw->name) - 1] = '\0';
+    member->mode = (uint32_t)raw->metadata.st_mode;
+    member->uid = (uint32_t)raw->metadata.st_uid;
+    member->gid = (uint32_t)raw->metadata.st_gid;
+    member->size = (uint64_t)raw->metadata.st_size;
+    member->atime_sec = (int64_t)raw->metadata.st_atim.tv_sec;
+    member->atime_nsec = (uint32_t)raw->metadata.st_atim.tv_nsec;
+    member->mtime_sec = (int64_t)raw->metadata.st_mtim.tv_sec;
+    member->mtime_nsec = (uint32_t)raw->metadata.st_mtim.tv_nsec;
+    member->flags = raw->is_deleted ? MEMBER_DELETED : 0;
+    member->stored_size = member->size;
+    member->header_size = sizeof(*raw);
+    member->version = ARCHIVE_VERSION_LEGACY;
+    return raw->metadata.st_size < 0 ? -1 : 0;
+}
+
+/* Буфер под заголовок v2 с самым длинным именем и запасом на упреждающее чтение */
+#define MEMBER_RAW_SIZE (MEMBER_FIXED_SIZE + MEMBER_NAME_MAX + MEMBER_READ_AHEAD)
+
+/*
+ * Полная длина заголовка v2 по его фиксированной части.
+ * Возвращает -1, если это не заголовок или длины в нём не сходятся.
+ */
+static int header_length(const unsigned char *raw) {
+    if (get_le32(raw) != MEMBER_MAGIC) return -1;
+    uint16_t header_len = get_le16(raw + 4);
+    uint16_t name_len = get_le16(raw + 6);
+    size_t extensions = member_extensions_size(get_le32(raw + 8));
+    if (name_len >= MEMBER_NAME_MAX || header_len < MEMBER_FIXED_SIZE + extensions + name_len ||
+        header_len > MEMBER_RAW_SIZE) {
+        return -1;
+    }
+    return header_len;
+}
+
+/*
+ * Разбирает прочитанный целиком заголовок v2 длиной header_len (поле
+ * суммы в raw при проверке обнуляется). Возвращает -1 при неверной сумме.
+ */
+static int decode_v2(unsigned char *raw, size_t header_len, struct member_header *member) {
+    uint16_t name_len = get_le16(raw + 6);
+    uint32_t flags = get_le32(raw + 8);
+    memset(member, 0, sizeof(*member));
+    member->flags = flags;
+    member->mode = get_le32(raw + 12);
+    member->uid = get_le32(raw + 16);
+    member->gid = get_le32(raw + 20);
+    member->size = get_le64(raw + 24);
+    member->atime_sec = (int64_t)get_le64(raw + 32);
+    member->atime_nsec = get_le32(raw + 40);
+    member->mtime_nsec = get_le32(raw + 44);
+    member->mtime_sec = (int64_t)get_le64(raw + 48);
+    member->stored_size = member->size;
+    unsigned char *ext = raw + MEMBER_FIXED_SIZE;
+    if (flags & MEMBER_COMPRESSED) {
+        member->codec = get_le32(ext);
+        member->block_size = get_le32(ext + 4);
+        member->block_count = get_le32(ext + 8);
+        member->stored_size = get_le64(ext + 16);
+        ext += MEMBER_COMPRESSION_SIZE;
+    }
+    if (flags & MEMBER_CHUNKED) {
+        member->stored_size = get_le64(ext);
+        ext += MEMBER_CHUNKED_SIZE;
+    }
+    if (flags & MEMBER_SPARSE) {
+        member->stored_size = get_le64(ext);
+        ext += MEMBER_SPARSE_SIZE;
+    }
+    if (flags & MEMBER_CHECKSUM) {
+        uint32_t header_crc = get_le32(ext + 4);
+        put_le32(ext + 4, 0);
+        if (crc32c(0, raw, header_len) != header_crc) return -1;
+        member->data_crc = get_le32(ext);
+    }
+    memcpy(member->name, raw + header_len - name_len, name_len);
+    member->name[name_len] = '\0';
+    member->header_size = (uint32_t)header_len;
+    member->version = ARCHIVE_VERSION;
+    return 0;
+}
+
+/*
+ * Читает заголовок записи по смещению offset в архиве формата version.
+ * Обычно это один pread. Возвращает 0 при успехе, -1 при ошибке
+ * (EIO — обрыв файла или повреждённый заголовок).
+ */
+int member_read(int fd, int version, off_t offset, struct member_header *member) {
+    if (version == ARCHIVE_VERSION_LEGACY) {
+        struct file_header raw;
+        if (pread_all(fd, &raw, sizeof(raw), offset) == -1) return -1;
+        if (decode_legacy(&raw, member) == -1) {
+            errno = EIO;
+            return -1;
+        }
+        member->header_offset = offset;
+        return 0;
+    }
+
+    unsigned char raw[MEMBER_RAW_SIZE];
+    ssize_t got;
+    do {
+        got = pread(fd, raw, MEMBER_FIXED_SIZE + MEMBER_READ_AHEAD, offset);
+    } while (got == -1 && errno == EINTR);
+    if (got == -1) return -1;
+    int header_len = got < MEMBER_FIXED_SIZE ? -1 : header_length(raw);
+    if (header_len == -1) {
+        errno = EIO;
+        return -1;
+    }
+    if (got < header_len &&
+        pread_all(fd, raw + got, (size_t)(header_len - got), offset + got) == -1) {
+        return -1;
+    }
+    if (decode_v2(raw, (size_t)header_len, member) == -1) {
+        errno = EIO;
+        return -1;
+    }
+    member->header_offset = offset;
+    return 0;
+}
+
+/*
+ * Читает очередной заголовок v2 из потока fd (канала, сокета) с текущей
+ * позиции; offset — смещение записи в архиве, только для header_offset.
+ * Возвращает 1, если заголовок прочитан; 0, если на этом месте записи
+ * кончились (конец потока или начался индекс); -1 при ошибке (EIO —
+ * оборванный или повреждённый заголовок).
+ */
+int member_read_stream(int fd, off_t offset, struct member_header *member) {
+    unsigned char raw[MEMBER_RAW_SIZE];
+    ssize_t got = read_full(fd, raw, MEMBER_FIXED_SIZE);
+    if (got == -1) return -1;
+    if (got == 0) return 0;
+    /* Индекс за записями начинается не с магии заголовка */
+    if (got >= 4 && get_le32(raw) != MEMBER_MAGIC) return 0;
+    int header_len = got < MEMBER_FIXED_SIZE ? -1 : header_length(raw);
+    if (header_len == -1) {
+        errno = EIO;
+        return -1;
+    }
+    got = read_full(fd, raw + MEMBER_FIXED_SIZE, (size_t)header_len - MEMBER_FIXED_SIZE);
+    if (got == -1) return -1;
+    if ((size_t)got < (size_t)header_len - MEMBER_FIXED_SIZE || decode_v2(raw, (size_t)header_len, member) == -1) {
+        errno = EIO;
+        return -1;
+    }
+    member->header_offset = offset;
+    return 1;
+}
+
+/*
+ * Кодирует заголовок в buf (размером не меньше MEMBER_HEADER_MAX).
+ * Возвращает длину закодированного заголовка.
+ */
+size_t member_encode(const struct member_header *member, unsigned char *buf) {
+    if (member->version == ARCHIVE_VERSION_LEGACY) {
+        struct file_header raw;
+        memset(&raw, 0, sizeof(raw));
+        memcpy(raw.name, member->name, strnlen(member->name, sizeof(raw.name) - 1));
+        raw.metadata.st_mode = (mode_t)member->mode;
+        raw.metadata.st_uid = (uid_t)member->uid;
+        raw.metadata.st_gid = (gid_t)member->gid;
+        raw.metadata.st_size = (off_t)member->size;
+        raw.metadata.st_atim.tv_sec = (time_t)member->atime_sec;
+        raw.metadata.st_atim.tv_nsec = (long)member->atime_nsec;
+        raw.metadata.st_mtim.tv_sec = (time_t)member->mtime_sec;
+        raw.metadata.st_mtim.tv_nsec = (long)member->mtime_nsec;
+        raw.is_deleted = (member->flags & MEMBER_DELETED) ? 1 : 0;
+        memcpy(buf, &raw, sizeof(raw));
+        return sizeof(raw);
+    }
+
+    size_t name_len = strlen(member->name);
+    size_t extensions = member_extensions_size(member->flags);
+    size_t header_len = MEMBER_FIXED_SIZE + extensions + name_len;
+    put_le32(buf, MEMBER_MAGIC);
+    put_le16(buf + 4, (uint16_t)header_len);
+    put_le16(buf + 6, (uint16_t)name_len);
+    put_le32(buf + 8, member->flags);
+    put_le32(buf + 12, member->mode);
+    put_le32(buf + 16, member->uid);
+    put_le32(buf + 20, member->gid);
+    put_le64(buf + 24, member->size);
+    put_le64(buf + 32, (uint64_t)member->atime_sec);
+    put_le32(buf + 40, member->atime_nsec);
+    put_le32(buf + 44, member->mtime_nsec);
+    put_le64(buf + 48, (uint64_t)member->mtime_sec);
+    unsigned char *ext = buf + MEMBER_FIXED_SIZE;
+    if (member->flags & MEMBER_COMPRESSED) {
+        put_le32(ext, member->codec);
+        put_le32(ext + 4, member->block_size);
+        put_le32(ext + 8, member->block_count);
+        put_le32(ext + 12, 0);
+        put_le64(ext + 16, member->stored_size);
+        ext += MEMBER_COMPRESSION_SIZE;
+    }
+    if (member->flags & MEMBER_CHUNKED) {
+        put_le64(ext, member->stored_size);
+        ext += MEMBER_CHUNKED_SIZE;
+    }
+    if (member->flags & MEMBER_SPARSE) {
+        put_le64(ext, member->stored_size);
+        ext += MEMBER_SPARSE_SIZE;
+    }
+    memcpy(buf + MEMBER_FIXED_SIZE + extensions, member->name, name_len);
+    if (member->flags & MEMBER_CHECKSUM) {
+        /* Сумма заголовка считается последней, с нулём на своём месте */
+        put_le32(ext, member->data_crc);
+        put_le32(ext + 4, 0);
+        put_le32(ext + 4, crc32c(0, buf, header_len));
+    }
+    return header_len;
+}
+
+/*
+ * Записывает заголовок в текущую позицию fd и запоминает его размер.
+ */
+int member_write(int fd, struct member_header *member) {
+    unsigned char buf[MEMBER_HEADER_MAX];
+    size_t length = member_encode(member, buf);
+    member->header_size = (uint32_t)length;
+    return write_all(fd, buf, length);
+}
+
+/*
+ * Помечает запись удалённой на месте: перезаписывается только поле флагов
+ * (v2) или байт is_deleted (v1). Заголовок с контрольной суммой
+ * перезаписывается целиком, чтобы сумма осталась верной.
+ */
+int member_mark_deleted(int fd, struct member_header *member) {
+    member->flags |= MEMBER_DELETED;
+    if (member->version == ARCHIVE_VERSION_LEGACY) {
+        char is_deleted = 1;
+        return pwrite_all(fd, &is_deleted, 1,
+                          member->header_offset + (off_t)offsetof(struct file_header, is_deleted));
+    }
+    if (member->flags & MEMBER_CHECKSUM) {
+        unsigned char buf[MEMBER_HEADER_MAX];
+        return pwrite_all(fd, buf, member_encode(member, buf), member->header_offset);
+    }
+    unsigned char flags[4];
+    put_le32(flags, member->flags);
+    return pwrite_all(fd, flags, sizeof(flags), member->header_offset + 8);
+}
@@ -0,0 +1,604 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Индекс хранится в конце архива, сразу за последней записью:
+ *
+ *   [записи...][слоты хеш-таблицы][футер]
+ *
+ * Слоты — открытая адресация с линейным пробированием по хешу имени,
+ * заполненность не больше половины. Футер фиксированного размера лежит
+ * в самых последних байтах файла и указывает на начало таблицы, поэтому
+ * поиск члена архива — одно чтение футера, одно чтение окна слотов и одно
+ * чтение заголовка вместо просмотра всего архива. Все числа little-endian.
+ * Архивы без футера (старые) читаются линейным просмотром, а при первом
+ * добавлении файла индекс для них строится автоматически.
+ *
+ * Футер MARIDX02 (48 байт): магия, смещение таблицы, число слотов, число
+ * записей, объём удалённых записей в байтах и контрольная сумма первых
+ * 40 байт. Счётчик удалённых байт обновляется на месте при каждом удалении,
+ * чтобы решать, пора ли сжимать архив, не просматривая его.
+ * Старый футер MARIDX01 (40 байт, без счётчика) по-прежнему читается.
+ *
+ * В архиве с дедупликацией (dedup.c) между слотами и футером лежит таблица
+ * чанков: записи по 48 байт (SHA-256, u64 смещение данных чанка, u32 длина,
+ * u32 резерв), отсортированные по хешу. Такой архив получает футер
+ * MARIDX03 (64 байта): после счётчика удалённых байт — число чанков и
+ * резерв, контрольная сумма первых 56 байт. Таблица чанков читается
+ * только тогда, когда она нужна: при добавлении файлов и при чтении
+ * членов со списком чанков.
+ */
+
+#define INDEX_MAGIC_V3 "MARIDX03"
+#define INDEX_MAGIC "MARIDX02"
+#define INDEX_MAGIC_V1 "MARIDX01"
+#define INDEX_MAGIC_LEN 8
+#define INDEX_SLOT_SIZE 32
+#define INDEX_CHUNK_SIZE 48
+#define INDEX_FOOTER_V3_SIZE 64
+#define INDEX_FOOTER_SIZE 48
+#define INDEX_FOOTER_V1_SIZE 40
+#define INDEX_MIN_SLOTS 8
+/* Сколько слотов читается за один pread при пробировании */
+#define INDEX_PROBE_WINDOW 8
+
+struct index_footer {
+    uint64_t index_offset;
+    uint64_t slot_count;
+    uint64_t entry_count;
+    uint64_t dead_bytes;
+    uint64_t chunk_count;
+    uint64_t footer_size;  /* INDEX_FOOTER_V3_SIZE, INDEX_FOOTER_SIZE или INDEX_FOOTER_V1_SIZE */
+};
+
+/* Известные футеры, от нового к старому; контрольная сумма — в последних 8 байтах */
+static const struct {
+    const char *magic;
+    size_t size;
+} footer_formats[] = {
+    { INDEX_MAGIC_V3, INDEX_FOOTER_V3_SIZE },
+    { INDEX_MAGIC, INDEX_FOOTER_SIZE },
+    { INDEX_MAGIC_V1, INDEX_FOOTER_V1_SIZE },
+};
+
+/* FNV-1a по байтам; 0 зарезервирован под пустой слот */
+static uint64_t fnv1a(const void *data, size_t length) {
+    const unsigned char *p = data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t name_hash(const char *name) {
+    uint64_t hash = fnv1a(name, strlen(name));
+    return hash ? hash : 1;
+}
+
+/*
+ * Читает и проверяет футер. Возвращает 1, если индекс есть, 0 — если его нет
+ * (или футер повреждён), -1 при ошибке ввода-вывода.
+ */
+static int read_footer(int fd, struct index_footer *footer) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) return -1;
+    if (st.st_size < INDEX_FOOTER_V1_SIZE) return 0;
+
+    /* Читаем хвост под самый большой футер; меньшие занимают его конец */
+    unsigned char tail[INDEX_FOOTER_V3_SIZE];
+    size_t tail_size = st.st_size < INDEX_FOOTER_V3_SIZE ? (size_t)st.st_size : INDEX_FOOTER_V3_SIZE;
+    if (pread_all(fd, tail, tail_size, st.st_size - (off_t)tail_size) == -1) return -1;
+
+    const unsigned char *raw = NULL;
+    size_t size = 0;
+    for (size_t i = 0; i < sizeof(footer_formats) / sizeof(footer_formats[0]); i++) {
+        size = footer_formats[i].size;
+        if (size > tail_size) continue;
+        const unsigned char *candidate = tail + tail_size - size;
+        if (memcmp(candidate, footer_formats[i].magic, INDEX_MAGIC_LEN) == 0 &&
+            get_le64(candidate + size - 8) == fnv1a(candidate, size - 8)) {
+            raw = candidate;
+            break;
+        }
+    }
+    if (raw == NULL) return 0;
+
+    footer->index_offset = get_le64(raw + 8);
+    footer->slot_count = get_le64(raw + 16);
+    footer->entry_count = get_le64(raw + 24);
+    footer->dead_bytes = size >= INDEX_FOOTER_SIZE ? get_le64(raw + 32) : 0;
+    footer->chunk_count = size >= INDEX_FOOTER_V3_SIZE ? get_le64(raw + 40) : 0;
+    footer->footer_size = size;
+
+    /* Таблицы обязаны занимать ровно место между данными и футером */
+    uint64_t table_size = footer->slot_count * INDEX_SLOT_SIZE + footer->chunk_count * INDEX_CHUNK_SIZE;
+    if (footer->slot_count == 0 || (footer->slot_count & (footer->slot_count - 1)) != 0 ||
+        footer->index_offset + table_size + footer->footer_size != (uint64_t)st.st_size) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Кодирует футер в формате footer->footer_size */
+static void encode_footer(unsigned char *raw, const struct index_footer *footer) {
+    size_t size = (size_t)footer->footer_size;
+    memset(raw, 0, size);
+    memcpy(raw, size == INDEX_FOOTER_V3_SIZE ? INDEX_MAGIC_V3
+                : size == INDEX_FOOTER_SIZE  ? INDEX_MAGIC
+                                             : INDEX_MAGIC_V1, INDEX_MAGIC_LEN);
+    put_le64(raw + 8, footer->index_offset);
+    put_le64(raw + 16, footer->slot_count);
+    put_le64(raw + 24, footer->entry_count);
+    if (size >= INDEX_FOOTER_SIZE) put_le64(raw + 32, footer->dead_bytes);
+    if (size >= INDEX_FOOTER_V3_SIZE) put_le64(raw + 40, footer->chunk_count);
+    put_le64(raw + size - 8, fnv1a(raw, size - 8));
+}
+
+/* Смещение самого футера в архиве */
+static off_t footer_offset(const struct index_footer *footer) {
+    return (off_t)(footer->index_offset + footer->slot_count * INDEX_SLOT_SIZE +
+                   footer->chunk_count * INDEX_CHUNK_SIZE);
+}
+
+/*
+ * Конец последней целой записи фиксации в архиве без индекса. Всё, что
+ * за ней (в том числе оборванные заголовки), считается недописанным.
+ * Возвращает -1 при ошибке ввода-вывода.
+ */
+static off_t committed_end(int fd, int version, off_t file_size) {
+    struct member_header member;
+    off_t offset = archive_records_start(version);
+    off_t committed = offset;
+    while (offset < file_size) {
+        if (member_read(fd, version, offset, &member) == -1) {
+            if (errno != EIO) return -1;
+            break;
+        }
+        if (member_end(&member) > file_size) break;
+        offset = member_end(&member);
+        if (!(member.flags & MEMBER_COMMIT)) continue;
+
+        unsigned char data[COMMIT_DATA_SIZE];
+        if (member.stored_size != sizeof(data) ||
+            pread_all(fd, data, sizeof(data), member_data_offset(&member)) == -1 ||
+            crc32c(0, data, sizeof(data)) != member.data_crc ||
+            get_le64(data + 8) != (uint64_t)member.header_offset) {
+            break;
+        }
+        committed = offset;
+    }
+    return committed;
+}
+
+/*
+ * Конец области записей: начало индекса, а для архива без индекса — размер
+ * файла или, если архив пишется с фиксациями, конец последней фиксации.
+ * Возвращает -1 при ошибке.
+ */
+off_t archive_data_end(int fd) {
+    struct index_footer footer;
+    int rc = read_footer(fd, &footer);
+    if (rc == -1) return -1;
+    if (rc == 1) return (off_t)footer.index_offset;
+
+    struct stat st;
+    uint32_t flags;
+    if (fstat(fd, &st) == -1 || archive_flags(fd, &flags) == -1) return -1;
+    if (flags & ARCHIVE_FLAG_COMMITS) {
+        return committed_end(fd, ARCHIVE_VERSION, st.st_size);
+    }
+    return st.st_size;
+}
+
+static void decode_slot(const unsigned char *raw, struct index_entry *entry) {
+    entry->name_hash = get_le64(raw);
+    entry->header_offset = get_le64(raw + 8);
+    entry->data_size = get_le64(raw + 16);
+    entry->flags = get_le32(raw + 24);
+}
+
+static void encode_slot(unsigned char *raw, const struct index_entry *entry) {
+    put_le64(raw, entry->name_hash);
+    put_le64(raw + 8, entry->header_offset);
+    put_le64(raw + 16, entry->data_size);
+    put_le32(raw + 24, entry->flags);
+    put_le32(raw + 28, 0);
+}
+
+int index_append(struct archive_index *index, const struct member_header *member) {
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 64;
+        struct index_entry *entries = realloc(index->entries, capacity * sizeof(*entries));
+        if (entries == NULL) return -1;
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    struct index_entry *entry = &index->entries[index->count++];
+    entry->name_hash = name_hash(member->name);
+    entry->header_offset = (uint64_t)member->header_offset;
+    entry->data_size = member->stored_size;
+    entry->flags = (member->flags & MEMBER_DELETED) ? INDEX_ENTRY_DELETED : 0;
+    if (member->flags & MEMBER_DELETED) {
+        index->dead_bytes += (uint64_t)(member_end(member) - member->header_offset);
+    }
+    return 0;
+}
+
+void index_free(struct archive_index *index) {
+    free(index->entries);
+    chunk_store_free(&index->chunks);
+    memset(index, 0, sizeof(*index));
+}
+
+static int compare_by_offset(const void *a, const void *b) {
+    const struct index_entry *x = a;
+    const struct index_entry *y = b;
+    return (x->header_offset > y->header_offset) - (x->header_offset < y->header_offset);
+}
+
+/*
+ * Строит индекс просмотром всех записей архива без индекса. Таблица чанков
+ * при этом восстанавливается из пакетов; служебные записи (пакеты и
+ * фиксации) в индекс не попадают.
+ */
+static int index_scan(int fd, off_t data_end, struct archive_index *index) {
+    int version = archive_version(fd);
+    if (version == -1) return -1;
+
+    struct member_header member;
+    off_t offset = archive_records_start(version);
+    while (offset < data_end) {
+        if (member_read(fd, version, offset, &member) == -1) {
+            return -1;
+        }
+        if (member.flags & MEMBER_CHUNK_PACK) {
+            if (pack_scan(fd, &member, &index->chunks) == -1) return -1;
+        } else if (!(member.flags & MEMBER_COMMIT) && index_append(index, &member) == -1) {
+            return -1;
+        }
+        offset = member_end(&member);
+    }
+    if (offset != data_end) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Загружает индекс архива в память (в порядке записей) и сообщает, где
+ * кончаются записи. Для архива без индекса строит его просмотром.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int index_load(int fd, struct archive_index *index, off_t *data_end) {
+    memset(index, 0, sizeof(*index));
+
+    struct index_footer footer;
+    int rc = read_footer(fd, &footer);
+    if (rc == -1) return -1;
+    if (rc == 0) {
+        *data_end = archive_data_end(fd);
+        if (*data_end == -1) return -1;
+        return index_scan(fd, *data_end, index);
+    }
+
+    *data_end = (off_t)footer.index_offset;
+    index->dead_bytes = footer.dead_bytes;
+    index->chunk_table_offset = footer.index_offset + footer.slot_count * INDEX_SLOT_SIZE;
+    index->chunk_table_count = footer.chunk_count;
+    size_t table_size = (size_t)footer.slot_count * INDEX_SLOT_SIZE;
+    unsigned char *raw = malloc(table_size);
+    if (raw == NULL) return -1;
+    if (pread_all(fd, raw, table_size, (off_t)footer.index_offset) == -1) {
+        free(raw);
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < footer.slot_count; i++) {
+        struct index_entry entry;
+        decode_slot(raw + i * INDEX_SLOT_SIZE, &entry);
+        if (entry.name_hash == 0) continue;
+        if (index->count == index->capacity) {
+            size_t capacity = index->capacity ? index->capacity * 2 : 64;
+            struct index_entry *entries = realloc(index->entries, capacity * sizeof(*entries));
+            if (entries == NULL) {
+                free(raw);
+                return -1;
+            }
+            index->entries = entries;
+            index->capacity = capacity;
+        }
+        index->entries[index->count++] = entry;
+    }
+    free(raw);
+
+    qsort(index->entries, index->count, sizeof(*index->entries), compare_by_offset);
+
+    /* В старом футере счётчика нет: запись тянется до начала следующей */
+    if (footer.footer_size == INDEX_FOOTER_V1_SIZE) {
+        for (size_t i = 0; i < index->count; i++) {
+            if (!(index->entries[i].flags & INDEX_ENTRY_DELETED)) continue;
+            uint64_t end = (i + 1 < index->count) ? index->entries[i + 1].header_offset
+                                                  : footer.index_offset;
+            index->dead_bytes += end - index->entries[i].header_offset;
+        }
+    }
+    return 0;
+}
+
+/* Читает count записей таблицы чанков со смещения offset в store */
+static int read_chunk_table(int fd, uint64_t offset, uint64_t count, struct chunk_store *store) {
+    unsigned char *raw = malloc(count ? (size_t)count * INDEX_CHUNK_SIZE : 1);
+    if (raw == NULL) return -1;
+    int rc = pread_all(fd, raw, (size_t)count * INDEX_CHUNK_SIZE, (off_t)offset);
+    for (uint64_t i = 0; rc == 0 && i < count; i++) {
+        const unsigned char *item = raw + i * INDEX_CHUNK_SIZE;
+        rc = chunk_store_add(store, item, get_le64(item + CHUNK_HASH_SIZE),
+                             get_le32(item + CHUNK_HASH_SIZE + 8));
+    }
+    free(raw);
+    return rc;
+}
+
+/*
+ * Дочитывает в index->chunks таблицу чанков, если index_load её отложил.
+ * Нужно до первой записи в область индекса: таблица лежит там же.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int index_load_chunks(int fd, struct archive_index *index) {
+    if (index->chunk_table_count == 0) return 0;
+    if (read_chunk_table(fd, index->chunk_table_offset, index->chunk_table_count, &index->chunks) == -1) {
+        return -1;
+    }
+    index->chunk_table_count = 0;
+    return 0;
+}
+
+/*
+ * Загружает в store все чанки архива для чтения членов со списком чанков:
+ * из таблицы в индексе, а в архиве без индекса — просмотром пакетов.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int chunk_store_load(int fd, struct chunk_store *store) {
+    struct index_footer footer;
+    int rc = read_footer(fd, &footer);
+    if (rc == -1) return -1;
+    if (rc == 1) {
+        return read_chunk_table(fd, footer.index_offset + footer.slot_count * INDEX_SLOT_SIZE,
+                                footer.chunk_count, store);
+    }
+
+    int version = archive_version(fd);
+    off_t data_end = archive_data_end(fd);
+    if (version == -1 || data_end == -1) return -1;
+    struct member_header member;
+    off_t offset = archive_records_start(version);
+    while (offset < data_end) {
+        if (member_read(fd, version, offset, &member) == -1) return -1;
+        if ((member.flags & MEMBER_CHUNK_PACK) && pack_scan(fd, &member, store) == -1) return -1;
+        offset = member_end(&member);
+    }
+    return 0;
+}
+
+static int compare_chunks(const void *a, const void *b) {
+    return memcmp(((const struct chunk_entry *)a)->hash, ((const struct chunk_entry *)b)->hash, CHUNK_HASH_SIZE);
+}
+
+/*
+ * Записывает хеш-таблицу, таблицу чанков (если они есть) и футер начиная
+ * с data_end и обрезает файл по концу футера. Записи вставляются в порядке
+ * следования в архиве, так что среди одноимённых членов первым при поиске
+ * находится самый ранний. Недочитанная таблица чанков — ошибка EINVAL:
+ * иначе она пропала бы из архива.
+ */
+int index_write(int fd, off_t data_end, const struct archive_index *index) {
+    if (index->chunk_table_count != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t slot_count = INDEX_MIN_SLOTS;
+    while (slot_count < 2 * (uint64_t)index->count) slot_count *= 2;
+
+    size_t chunk_count = index->chunks.count;
+    size_t footer_size = chunk_count ? INDEX_FOOTER_V3_SIZE : INDEX_FOOTER_SIZE;
+    size_t slots_size = (size_t)slot_count * INDEX_SLOT_SIZE;
+    size_t table_size = slots_size + chunk_count * INDEX_CHUNK_SIZE;
+    unsigned char *raw = calloc(1, table_size + footer_size);
+    if (raw == NULL) return -1;
+
+    for (size_t i = 0; i < index->count; i++) {
+        uint64_t slot = index->entries[i].name_hash & (slot_count - 1);
+        while (get_le64(raw + slot * INDEX_SLOT_SIZE) != 0) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        encode_slot(raw + slot * INDEX_SLOT_SIZE, &index->entries[i]);
+    }
+
+    if (chunk_count > 0) {
+        struct chunk_entry *sorted = malloc(chunk_count * sizeof(*sorted));
+        if (sorted == NULL) {
+            free(raw);
+            return -1;
+        }
+        memcpy(sorted, index->chunks.entries, chunk_count * sizeof(*sorted));
+        qsort(sorted, chunk_count, sizeof(*sorted), compare_chunks);
+        for (size_t i = 0; i < chunk_count; i++) {
+            unsigned char *item = raw + slots_size + i * INDEX_CHUNK_SIZE;
+            memcpy(item, sorted[i].hash, CHUNK_HASH_SIZE);
+            put_le64(item + CHUNK_HASH_SIZE, sorted[i].offset);
+            put_le32(item + CHUNK_HASH_SIZE + 8, sorted[i].length);
+        }
+        free(sorted);
+    }
+
+    struct index_footer footer = {
+        (uint64_t)data_end, slot_count, (uint64_t)index->count, index->dead_bytes, chunk_count, footer_size
+    };
+    encode_footer(raw + table_size, &footer);
+
+    int rc = pwrite_all(fd, raw, table_size + footer_size, data_end);
+    if (rc == 0) {
+        rc = ftruncate(fd, data_end + (off_t)(table_size + footer_size));
+    }
+    free(raw);
+    return rc;
+}
+
+/*
+ * Проходит цепочку пробирования для hash. Для каждого слота с таким хешем
+ * вызывает visit(slot_offset, entry, ctx); ненулевой ответ останавливает
+ * обход и возвращается наружу. Возвращает 0, если цепочка кончилась,
+ * -1 при ошибке, -2 если индекса нет.
+ */
+static int index_probe(int fd, uint64_t hash,
+                       int (*visit)(int fd, off_t slot_offset, const struct index_entry *entry, void *ctx),
+                       void *ctx) {
+    struct index_footer footer;
+    int rc = read_footer(fd, &footer);
+    if (rc == -1) return -1;
+    if (rc == 0) return -2;
+
+    unsigned char window[INDEX_PROBE_WINDOW * INDEX_SLOT_SIZE];
+    uint64_t mask = footer.slot_count - 1;
+    uint64_t slot = hash & mask;
+    uint64_t probed = 0;
+
+    while (probed < footer.slot_count) {
+        uint64_t batch = INDEX_PROBE_WINDOW;
+        if (batch > footer.slot_count - slot) batch = footer.slot_count - slot;
+        off_t window_offset = (off_t)(footer.index_offset + slot * INDEX_SLOT_SIZE);
+        if (pread_all(fd, window, (size_t)batch * INDEX_SLOT_SIZE, window_offset) == -1) return -1;
+
+        for (uint64_t i = 0; i < batch && probed < footer.slot_count; i++, probed++) {
+            struct index_entry entry;
+            decode_slot(window + i * INDEX_SLOT_SIZE, &entry);
+            if (entry.name_hash == 0) return 0;
+            if (entry.name_hash != hash) continue;
+            rc = visit(fd, window_offset + (off_t)(i * INDEX_SLOT_SIZE), &entry, ctx);
+            if (rc != 0) return rc;
+        }
+        slot = (slot + batch) & mask;
+    }
+    return 0;
+}
+
+struct lookup_ctx {
+    const char *name;
+    int version;
+    struct member_header *member;
+};
+
+static int visit_lookup(int fd, off_t slot_offset, const struct index_entry *entry, void *ctx) {
+    (void)slot_offset;
+    struct lookup_ctx *lookup = ctx;
+    if (entry->flags & INDEX_ENTRY_DELETED) return 0;
+    if (member_read(fd, lookup->version, (off_t)entry->header_offset, lookup->member) == -1) {
+        return -1;
+    }
+    if ((lookup->member->flags & MEMBER_DELETED) || strcmp(lookup->member->name, lookup->name) != 0) {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Ищет через индекс первый неудалённый член архива с именем name.
+ * Возвращает 1 (найден, заполнен member), 0 (нет такого),
+ * -1 при ошибке, -2 если в архиве нет индекса.
+ */
+int index_lookup(int fd, int version, const char *name, struct member_header *member) {
+    struct lookup_ctx lookup = { name, version, member };
+    return index_probe(fd, name_hash(name), visit_lookup, &lookup);
+}
+
+struct mark_ctx {
+    off_t header_offset;
+    int marked;
+};
+
+static int visit_mark(int fd, off_t slot_offset, const struct index_entry *entry, void *ctx) {
+    struct mark_ctx *mark = ctx;
+    if ((off_t)entry->header_offset != mark->header_offset) return 0;
+
+    if (entry->flags & INDEX_ENTRY_DELETED) return 1;
+
+    unsigned char flags[4];
+    put_le32(flags, entry->flags | INDEX_ENTRY_DELETED);
+    if (pwrite_all(fd, flags, sizeof(flags), slot_offset + 24) == -1) return -1;
+    mark->marked = 1;
+    return 1;
+}
+
+/*
+ * Добавляет delta к счётчику удалённых байт в футере.
+ * Возвращает 1 и новый счётчик в *dead_bytes, 0 если индекса нет или он
+ * старого формата без счётчика, -1 при ошибке.
+ */
+static int add_dead_bytes(int fd, uint64_t delta, uint64_t *dead_bytes) {
+    struct index_footer footer;
+    int rc = read_footer(fd, &footer);
+    if (rc != 1) return rc;
+    if (footer.footer_size == INDEX_FOOTER_V1_SIZE) return 0;
+
+    if (delta > 0) {
+        footer.dead_bytes += delta;
+        unsigned char raw[INDEX_FOOTER_V3_SIZE];
+        encode_footer(raw, &footer);
+        if (pwrite_all(fd, raw, (size_t)footer.footer_size, footer_offset(&footer)) == -1) return -1;
+    }
+    *dead_bytes = footer.dead_bytes;
+    return 1;
+}
+
+/*
+ * Помечает в индексе удалённым член с заголовком по смещению header_offset
+ * и добавляет record_size к счётчику удалённых байт в футере.
+ * Возвращает 1 и новый счётчик в *dead_bytes, 0 если индекса нет или он
+ * старого формата без счётчика, -1 при ошибке.
+ */
+int index_mark_deleted(int fd, const char *name, off_t header_offset, uint64_t record_size,
+                       uint64_t *dead_bytes) {
+    struct mark_ctx mark = { header_offset, 0 };
+    int rc = index_probe(fd, name_hash(name), visit_mark, &mark);
+    if (rc == -1) return -1;
+    if (rc == -2) return 0;
+    return add_dead_bytes(fd, mark.marked ? record_size : 0, dead_bytes);
+}
+
+struct resize_ctx {
+    off_t header_offset;
+    uint64_t data_size;
+};
+
+static int visit_resize(int fd, off_t slot_offset, const struct index_entry *entry, void *ctx) {
+    struct resize_ctx *resize = ctx;
+    if ((off_t)entry->header_offset != resize->header_offset) return 0;
+    unsigned char size[8];
+    put_le64(size, resize->data_size);
+    return pwrite_all(fd, size, sizeof(size), slot_offset + 16) == -1 ? -1 : 1;
+}
+
+/*
+ * Обновляет в индексе размер данных члена с заголовком по смещению
+ * header_offset после замены данных на месте и добавляет dead_size байт
+ * освободившегося хвоста к счётчику удалённых байт.
+ * Возвращает 1, 0 если индекса нет или он без счётчика, -1 при ошибке.
+ */
+int index_update_member(int fd, const char *name, off_t header_offset, uint64_t data_size,
+                        uint64_t dead_size) {
+    struct resize_ctx resize = { header_offset, data_size };
+    int rc = index_probe(fd, name_hash(name), visit_resize, &resize);
+    if (rc == -1) return -1;
+    if (rc == -2) return 0;
+    uint64_t dead_bytes;
+    return add_dead_bytes(fd, dead_size, &dead_bytes);
+}
@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Полностью записывает переданный буфер в дескриптор файла.
+ * Возвращает 0 при успехе, -1 при ошибке (errno выставлен системой).
+ */
+int write_all(int fd, const void *buffer, size_t length) {
+    const char *ptr = (const char *)buffer;
+    size_t remaining = length;
+    while (remaining > 0) {
+        ssize_t written = write(fd, ptr, remaining);
+        if (written < 0) {
+            return -1;
+        }
+        if (written == 0) {
+            errno = EIO;
+            return -1;
+        }
+        ptr += written;
+        remaining -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Читает length байт с текущей позиции, пока поток не кончится: каналы
+ * отдают данные кусками. Возвращает число прочитанных байт (меньше length
+ * только в конце потока) или -1 при ошибке.
+ */
+ssize_t read_full(int fd, void *buffer, size_t length) {
+    char *ptr = (char *)buffer;
+    size_t done = 0;
+    while (done < length) {
+        ssize_t got = read(fd, ptr + done, length - done);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0) break;
+        done += (size_t)got;
+    }
+    return (ssize_t)done;
+}
+
+/*
+ * Читает ровно length байт с позиции offset, не сдвигая позицию файла.
+ * Возвращает 0 при успехе, -1 при ошибке (EIO, если файл кончился раньше).
+ */
+int pread_all(int fd, void *buffer, size_t length, off_t offset) {
+    char *ptr = (char *)buffer;
+    size_t remaining = length;
+    while (remaining > 0) {
+        ssize_t got = pread(fd, ptr, remaining, offset);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0) {
+            errno = EIO;
+            return -1;
+        }
+        ptr += got;
+        offset += got;
+        remaining -= (size_t)got;
+    }
+    return 0;
+}
+
+/*
+ * Записывает ровно length байт с позиции offset, не сдвигая позицию файла.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int pwrite_all(int fd, const void *buffer, size_t length, off_t offset) {
+    const char *ptr = (const char *)buffer;
+    size_t remaining = length;
+    while (remaining > 0) {
+        ssize_t written = pwrite(fd, ptr, remaining, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (written == 0) {
+            errno = EIO;
+            return -1;
+        }
+        ptr += written;
+        offset += written;
+        remaining -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Движок копирования данных. Способы пробуются от самого дешёвого к самому
+ * общему: copy_file_range (на ФС с reflink это почти бесплатно, иначе
+ * копирование внутри ядра), sendfile, splice через промежуточный канал и,
+ * наконец, read/write через выровненный буфер в 1 МБ. Если способ не
+ * поддерживается для этой пары дескрипторов, копирование продолжается
+ * следующим с той же позиции: все они двигают позиции файлов одинаково.
+ */
+
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define COPY_BUFFER_ALIGN 4096
+/* Ограничение на один вызов, чтобы не упираться в пределы ssize_t/int */
+#define COPY_MAX_CHUNK (1L << 30)
+
+static const char *copy_method_names[COPY_METHOD_COUNT] = {
+    "copy_file_range", "sendfile", "splice", "buffer"
+};
+
+/* Способ, заданный пользователем (-1 — выбирать автоматически) */
+static int forced_method = -1;
+static struct copy_stats stats[COPY_METHOD_COUNT];
+
+/* Буфер и канал свои у каждого потока */
+static __thread char *copy_buffer;
+static __thread int splice_pipe[2] = { -1, -1 };
+
+const char *copy_method_name(int method) {
+    return (method >= 0 && method < COPY_METHOD_COUNT) ? copy_method_names[method] : "auto";
+}
+
+/* Возвращает номер способа, -1 для "auto" и -2 для неизвестного имени */
+int copy_method_from_name(const char *name) {
+    if (strcmp(name, "auto") == 0) return -1;
+    for (int i = 0; i < COPY_METHOD_COUNT; i++) {
+        if (strcmp(name, copy_method_names[i]) == 0) return i;
+    }
+    return -2;
+}
+
+void copy_set_method(int method) {
+    forced_method = method;
+}
+
+void copy_get_stats(struct copy_stats out[COPY_METHOD_COUNT]) {
+    for (int i = 0; i < COPY_METHOD_COUNT; i++) {
+        out[i].bytes = __atomic_load_n(&stats[i].bytes, __ATOMIC_RELAXED);
+        out[i].nanoseconds = __atomic_load_n(&stats[i].nanoseconds, __ATOMIC_RELAXED);
+        out[i].calls = __atomic_load_n(&stats[i].calls, __ATOMIC_RELAXED);
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void account(int method, ssize_t bytes, uint64_t started) {
+    __atomic_fetch_add(&stats[method].bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats[method].nanoseconds, now_ns() - started, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats[method].calls, 1, __ATOMIC_RELAXED);
+}
+
+static char *get_copy_buffer(void) {
+    if (copy_buffer == NULL) {
+        void *buffer;
+        if (posix_memalign(&buffer, COPY_BUFFER_ALIGN, COPY_BUFFER_SIZE) != 0) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        copy_buffer = buffer;
+    }
+    return copy_buffer;
+}
+
+/* Ошибки, после которых имеет смысл попробовать следующий способ */
+static int method_unsupported(int error) {
+    return error == EXDEV || error == ENOSYS || error == EINVAL || error == EOPNOTSUPP ||
+           error == ENOTSUP || error == EBADF || error == ESPIPE;
+}
+
+static int is_pipe(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/* Дописывает в out_fd всё, что осталось в промежуточном канале */
+static int drain_pipe(int out_fd, size_t length) {
+    char *buf = get_copy_buffer();
+    if (buf == NULL) return -1;
+    while (length > 0) {
+        size_t chunk = length < COPY_BUFFER_SIZE ? length : COPY_BUFFER_SIZE;
+        ssize_t got = read(splice_pipe[0], buf, chunk);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+        if (write_all(out_fd, buf, (size_t)got) == -1) return -1;
+        length -= (size_t)got;
+    }
+    return 0;
+}
+
+/*
+ * splice: если один из концов — канал, напрямую, иначе через свой канал
+ * (файл -> канал -> файл), так что данные тоже не копируются в userspace.
+ */
+static ssize_t splice_step(int in_fd, int out_fd, size_t length) {
+    if (is_pipe(in_fd) || is_pipe(out_fd)) {
+        return splice(in_fd, NULL, out_fd, NULL, length, SPLICE_F_MOVE);
+    }
+    if (splice_pipe[0] == -1) {
+        if (pipe2(splice_pipe, O_CLOEXEC) == -1) return -1;
+        (void)fcntl(splice_pipe[1], F_SETPIPE_SZ, COPY_BUFFER_SIZE);
+    }
+    ssize_t got = splice(in_fd, NULL, splice_pipe[1], NULL, length, SPLICE_F_MOVE);
+    if (got <= 0) return got;
+
+    size_t left = (size_t)got;
+    while (left > 0) {
+        ssize_t put = splice(splice_pipe[0], NULL, out_fd, NULL, left, SPLICE_F_MOVE);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) {
+            /* Выходной дескриптор не принимает splice: досылаем вручную */
+            if (drain_pipe(out_fd, left) == -1) return -1;
+            break;
+        }
+        left -= (size_t)put;
+    }
+    return got;
+}
+
+static ssize_t buffer_step(int in_fd, int out_fd, size_t length) {
+    char *buf = get_copy_buffer();
+    if (buf == NULL) return -1;
+    if (length > COPY_BUFFER_SIZE) length = COPY_BUFFER_SIZE;
+    ssize_t got = read(in_fd, buf, length);
+    if (got <= 0) return got;
+    if (write_all(out_fd, buf, (size_t)got) == -1) return -1;
+    return got;
+}
+
+static ssize_t copy_step(int method, int in_fd, int out_fd, size_t length) {
+    switch (method) {
+        case COPY_METHOD_RANGE:
+            return copy_file_range(in_fd, NULL, out_fd, NULL, length, 0);
+        case COPY_METHOD_SENDFILE:
+            return sendfile(out_fd, in_fd, NULL, length);
+        case COPY_METHOD_SPLICE:
+            return splice_step(in_fd, out_fd, length);
+        default:
+            return buffer_step(in_fd, out_fd, length);
+    }
+}
+
+/*
+ * Копирует строго length байт из in_fd в out_fd с текущих позиций,
+ * самым дешёвым из доступных способов.
+ * Возвращает 0 при успехе, -1 при ошибке (EIO, если вход кончился раньше).
+ */
+int copy_bytes(int in_fd, int out_fd, off_t length) {
+    int method = forced_method >= 0 ? forced_method : COPY_METHOD_RANGE;
+    off_t remaining = length;
+    while (remaining > 0) {
+        size_t chunk = remaining > COPY_MAX_CHUNK ? (size_t)COPY_MAX_CHUNK : (size_t)remaining;
+        uint64_t started = now_ns();
+        ssize_t copied = copy_step(method, in_fd, out_fd, chunk);
+        if (copied > 0) {
+            account(method, copied, started);
+            remaining -= copied;
+            continue;
+        }
+        if (copied == 0) {
+            errno = EIO;
+            return -1;
+        }
+        if (errno == EINTR) continue;
+        if (forced_method >= 0 || method == COPY_METHOD_BUFFER || !method_unsupported(errno)) {
+            return -1;
+        }
+        method++;
+    }
+    return 0;
+}
+
+/*
+ * Пропускает в потоке/файле length байт (через lseek или последовательное чтение).
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int skip_bytes(int fd, off_t length) {
+    if (length <= 0) return 0;
+    if (lseek(fd, length, SEEK_CUR) != -1) return 0;
+    /* если lseek недоступен (например, поток), читаем и выбрасываем */
+    char buf[4096];
+    off_t remaining = length;
+    while (remaining > 0) {
+        ssize_t to_read = (remaining > (off_t)sizeof(buf)) ? (ssize_t)sizeof(buf) : (ssize_t)remaining;
+        ssize_t br = read(fd, buf, to_read);
+        if (br < 0 && errno == EINTR) continue;
+        if (br <= 0) {
+            if (br == 0) errno = EIO;
+            return -1;
+        }
+        remaining -= br;
+    }
+    return 0;
+}
+
+/*
+ * Копирует length байт из in_fd (с in_offset) в out_fd (с out_offset), не
+ * трогая позиции файлов: copy_file_range с явными смещениями, а если ядро
+ * или ФС его не поддерживают (или задан другой способ) — pread/pwrite через
+ * буфер движка.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int copy_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t length) {
+    int method = (forced_method == -1 || forced_method == COPY_METHOD_RANGE) ? COPY_METHOD_RANGE
+                                                                              : COPY_METHOD_BUFFER;
+    while (length > 0 && method == COPY_METHOD_RANGE) {
+        size_t chunk = length > COPY_MAX_CHUNK ? (size_t)COPY_MAX_CHUNK : (size_t)length;
+        uint64_t started = now_ns();
+        ssize_t copied = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, chunk, 0);
+        if (copied > 0) {
+            account(method, copied, started);
+            length -= copied;
+            continue;
+        }
+        if (copied == 0) {
+            errno = EIO;
+            return -1;
+        }
+        if (errno == EINTR) continue;
+        if (forced_method >= 0 || !method_unsupported(errno)) {
+            return -1;
+        }
+        method = COPY_METHOD_BUFFER;
+    }
+
+    char *buf = length > 0 ? get_copy_buffer() : NULL;
+    if (length > 0 && buf == NULL) return -1;
+    while (length > 0) {
+        size_t chunk = (length > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : (size_t)length;
+        uint64_t started = now_ns();
+        if (pread_all(in_fd, buf, chunk, in_offset) == -1 ||
+            pwrite_all(out_fd, buf, chunk, out_offset) == -1) {
+            return -1;
+        }
+        account(COPY_METHOD_BUFFER, (ssize_t)chunk, started);
+        in_offset += (off_t)chunk;
+        out_offset += (off_t)chunk;
+        length -= (off_t)chunk;
+    }
+    return 0;
+}
+
+/*
+ * Копирует length байт из in_fd в out_fd (с out_offset) через буфер движка,
+ * по пути продолжая CRC32C данных в *crc: данные проходят через память
+ * один раз, отдельного прохода для суммы нет. Вход читается с in_offset,
+ * а при in_offset == -1 — с текущей позиции (так можно читать и каналы);
+ * выход при out_offset == -1 тоже пишется с текущей позиции, а при
+ * out_fd == -1 данные только суммируются.
+ * Возвращает 0 при успехе, -1 при ошибке (EIO, если вход кончился раньше).
+ */
+int copy_checksummed(int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t length, uint32_t *crc) {
+    char *buf = length > 0 ? get_copy_buffer() : NULL;
+    if (length > 0 && buf == NULL) return -1;
+    while (length > 0) {
+        size_t chunk = (length > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : (size_t)length;
+        uint64_t started = now_ns();
+        ssize_t got;
+        if (in_offset >= 0) {
+            got = pread(in_fd, buf, chunk, in_offset);
+        } else {
+            got = read(in_fd, buf, chunk);
+        }
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            if (got == 0) errno = EIO;
+            return -1;
+        }
+        *crc = crc32c(*crc, buf, (size_t)got);
+        if (out_fd != -1 && (out_offset >= 0 ? pwrite_all(out_fd, buf, (size_t)got, out_offset)
+                                              : write_all(out_fd, buf, (size_t)got)) == -1) {
+            return -1;
+        }
+        account(COPY_METHOD_BUFFER, got, started);
+        if (in_offset >= 0) in_offset += got;
+        if (out_offset >= 0) out_offset += got;
+        length -= got;
+    }
+    return 0;
+}
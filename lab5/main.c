@@ -3,115 +3,105 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
-#include <utime.h>
 #include <getopt.h>
 #include <errno.h>
 
-struct file_header {
-    char name[1024];
-    struct stat metadata;
-    char is_deleted;
-};
-
-#define MAX_FILE_SIZE (1024LL * 1024LL * 1024LL)
+#include "archiver.h"
 
-/* ===== Вспомогательные функции (рефакторинг, без изменения логики) ===== */
+/* Доля удалённых данных, после которой извлечение запускает сжатие */
+#define DEFAULT_COMPACT_THRESHOLD 0.5
 
-/*
- * Полностью записывает переданный буфер в дескриптор файла.
- * Возвращает 0 при успехе, -1 при ошибке (errno выставлен системой).
- */
-static int write_all(int fd, const void *buffer, size_t length) {
-    const char *ptr = (const char *)buffer;
-    size_t remaining = length;
-    while (remaining > 0) {
-        ssize_t written = write(fd, ptr, remaining);
-        if (written < 0) {
-            return -1;
-        }
-        if (written == 0) {
-            errno = EIO;
-            return -1;
-        }
-        ptr += written;
-        remaining -= (size_t)written;
-    }
-    return 0;
-}
+/* Размер блока сжатия по умолчанию */
+#define DEFAULT_BLOCK_SIZE (256 * 1024)
+#define MAX_BLOCK_SIZE (64 * 1024 * 1024)
 
-/*
- * Копирует строго length байт из in_fd в out_fd, чтением/записью порциями.
- * Возвращает 0 при успехе, -1 при ошибке.
- */
-static int copy_bytes(int in_fd, int out_fd, off_t length) {
-    char buf[4096];
-    off_t remaining = length;
-    while (remaining > 0) {
-        ssize_t to_read = (remaining > (off_t)sizeof(buf)) ? (ssize_t)sizeof(buf) : (ssize_t)remaining;
-        ssize_t br = read(in_fd, buf, to_read);
-        if (br <= 0) {
-            return -1; /* читать ошибку будет вызывающая сторона */
-        }
-        if (write_all(out_fd, buf, (size_t)br) == -1) {
-            return -1;
-        }
-        remaining -= br;
-    }
-    return 0;
-}
+/* Коды длинных опций без короткого эквивалента */
+#define OPT_COPY_METHOD 256
+#define OPT_COPY_STATS 257
+#define OPT_BLOCK_SIZE 258
+#define OPT_CAT 259
+#define OPT_OFFSET 260
+#define OPT_LENGTH 261
+#define OPT_EXTRACT_KEEP 262
+#define OPT_EXTRACT_ALL 263
+#define OPT_EXTRACT_GLOB 264
+#define OPT_VERIFY 265
+#define OPT_UPDATE 266
 
-/*
- * Пропускает в потоке/файле length байт (через lseek или последовательное чтение).
- * Возвращает 0 при успехе, -1 при ошибке.
- */
-static int skip_bytes(int fd, off_t length) {
-    if (length <= 0) return 0;
-    if (lseek(fd, length, SEEK_CUR) != -1) return 0;
-    /* если lseek недоступен (например, поток), читаем и выбрасываем */
-    char buf[4096];
-    off_t remaining = length;
-    while (remaining > 0) {
-        ssize_t to_read = (remaining > (off_t)sizeof(buf)) ? (ssize_t)sizeof(buf) : (ssize_t)remaining;
-        ssize_t br = read(fd, buf, to_read);
-        if (br <= 0) return -1;
-        remaining -= br;
-    }
-    return 0;
-}
+/* Параметры сжатия при добавлении и распаковки при извлечении */
+struct compression_options {
+    int codec;            /* CODEC_NONE — хранить как есть */
+    uint32_t block_size;
+    unsigned jobs;        /* потоков в пуле, 0 — по числу процессоров */
+    int dedup;            /* хранить данные списками чанков (dedup.c) */
+};
 
-/*
- * Восстанавливает права доступа, владельца и времена из структуры stat для файла path.
- */
-static void restore_metadata_from_stat(const char *path, const struct stat *st) {
-    if (!path || !st) return;
-    if (chmod(path, st->st_mode) == -1) {
-        perror("Предупреждение: не удалось восстановить права доступа");
-    }
-    /* chown может не сработать без root, это не критично */
-    (void)chown(path, st->st_uid, st->st_gid);
-    struct utimbuf times = { st->st_atime, st->st_mtime };
-    if (utime(path, &times) == -1) {
-        perror("Предупреждение: не удалось восстановить время модификации");
-    }
-}
+/* ===== Вспомогательные функции ===== */
 
 /*
  * Выводит краткую справку по использованию утилиты и ключам.
  */
 void print_help() {
     printf("Использование: ./archiver <имя_архива> [опции] [файл]\n");
+    printf("Архив '-' — поток: -i пишет архив в stdout, а -s, --extract-all и\n");
+    printf("--extract-glob читают его из stdin за один проход.\n");
     printf("Опции:\n");
-    printf("  -i, --input <file>    Добавить файл в архив\n");
+    printf("  -i, --input <path>... Добавить файлы в архив (каталоги — рекурсивно)\n");
+    printf("  --update <path>...    Заменить файлы в архиве: на месте, если новые данные\n");
+    printf("                        помещаются в старую запись, иначе дописать в конец\n");
     printf("  -e, --extract <file>  Извлечь файл из архива (с удалением записи)\n");
+    printf("  -k, --extract-keep <file>\n");
+    printf("                        Извлечь файл, не меняя архив\n");
+    printf("  --extract-all         Извлечь все файлы параллельно, не меняя архив\n");
+    printf("  --extract-glob <pat>  Извлечь файлы, имена которых подходят под шаблон\n");
+    printf("                        (как в shell, '*' захватывает и '/'), не меняя архив\n");
+    printf("  --cat <file>          Вывести файл из архива в stdout\n");
+    printf("  --offset <n>          С какого байта выводить (для --cat)\n");
+    printf("  --length <n>          Сколько байт выводить (для --cat, по умолчанию до конца)\n");
     printf("  -s, --stat            Показать содержимое архива\n");
+    printf("  --verify              Проверить контрольные суммы всего архива (параллельно, -j)\n");
+    printf("  -z, --compress <c>    Сжимать добавляемые файлы: lz4 или zlib\n");
+    printf("  --block-size <KiB>    Размер независимо сжимаемого блока (по умолчанию %d)\n",
+           DEFAULT_BLOCK_SIZE / 1024);
+    printf("  -j, --jobs <n>        Потоков для сжатия, распаковки и извлечения многих файлов\n");
+    printf("                        (по умолчанию по числу CPU)\n");
+    printf("  -d, --dedup           Дедупликация: уже известные архиву фрагменты не пишутся повторно\n");
+    printf("  -c, --compact         Сжать архив, удалив помеченные записи\n");
+    printf("  -t, --threshold <r>   Доля удалённых данных (0..1), после которой\n");
+    printf("                        извлечение сжимает архив (по умолчанию %.2f)\n", DEFAULT_COMPACT_THRESHOLD);
+    printf("  --copy-method <m>     Способ копирования данных: auto, copy_file_range,\n");
+    printf("                        sendfile, splice или buffer (по умолчанию auto)\n");
+    printf("  --copy-stats          Вывести в stderr объём и скорость по способам копирования\n");
     printf("  -h, --help            Показать эту справку\n");
 }
 
 /*
- * Сжимает архив: копирует только актуальные записи (is_deleted == 0)
- * во временный файл и атомарно заменяет им исходный архив.
+ * Печатает в stderr, сколько данных перенёс каждый способ копирования и с какой скоростью.
+ */
+static void print_copy_stats(void) {
+    struct copy_stats stats[COPY_METHOD_COUNT];
+    copy_get_stats(stats);
+    for (int i = 0; i < COPY_METHOD_COUNT; i++) {
+        if (stats[i].calls == 0) continue;
+        double seconds = (double)stats[i].nanoseconds / 1e9;
+        double mib = (double)stats[i].bytes / (1024.0 * 1024.0);
+        fprintf(stderr, "%-16s %12llu байт  %8llu вызовов  %8.3f с  %9.1f МБ/с\n",
+                copy_method_name(i), (unsigned long long)stats[i].bytes,
+                (unsigned long long)stats[i].calls, seconds, seconds > 0 ? mib / seconds : 0.0);
+    }
+}
+
+/*
+ * Сжимает архив: копирует только актуальные записи во временный файл,
+ * строит для него новый индекс и атомарно заменяет им исходный архив.
+ * Идущие подряд живые записи v2 переносятся одним copy_file_range, не
+ * проходя через пространство пользователя; заголовки v1 перекодируются,
+ * так что результат всегда в формате v2.
+ * Пакеты чанков переписываются отдельно: в них остаются только чанки,
+ * на которые ссылаются живые члены, остальные — мусор после удалений.
  * Возвращает 0 при успехе, -1 при ошибке.
  */
 int compact_archive(const char *archive_name) {
@@ -141,46 +131,126 @@ int compact_archive(const char *archive_name) {
         fchmod(tmp_fd, arch_st.st_mode);
     }
 
-    struct file_header header;
-    ssize_t r;
+    struct member_header member;
+    struct archive_index index;
+    struct chunk_store live;
+    memset(&index, 0, sizeof(index));
+    memset(&live, 0, sizeof(live));
+    int version = archive_version(in_fd);
+    off_t data_end = archive_data_end(in_fd);
+    off_t offset = archive_records_start(version);
+    off_t out_offset = ARCHIVE_SUPERBLOCK_SIZE;
+    /* Непрерывный диапазон живых записей, ещё не перенесённый в новый файл */
+    off_t run_start = 0;
+    off_t run_length = 0;
+    int failed = (version == -1 || data_end == -1 || archive_write_superblock(tmp_fd) == -1);
 
-    while ((r = read(in_fd, &header, sizeof(header))) == sizeof(header)) {
-        off_t remaining = header.metadata.st_size;
+    /* Первый проход: какие чанки ещё нужны живым членам */
+    while (!failed && offset < data_end) {
+        if (member_read(in_fd, version, offset, &member) == -1 ||
+            ((member.flags & MEMBER_CHUNKED) && !(member.flags & MEMBER_DELETED) &&
+             chunked_mark_live(in_fd, &member, &live) == -1)) {
+            failed = 1;
+            break;
+        }
+        offset = member_end(&member);
+    }
+    offset = archive_records_start(version);
 
-        if (!header.is_deleted) {
-            /* Переписать заголовок */
-            if (write_all(tmp_fd, &header, sizeof(header)) == -1) {
-                perror("compact: ошибка записи заголовка во временный файл");
-                close(in_fd);
-                close(tmp_fd);
-                unlink(tmp_name);
-                free(tmp_name);
-                return -1;
+    /* Индекс в конце архива записью не является: читаем только до data_end */
+    while (!failed && offset < data_end) {
+        if (member_read(in_fd, version, offset, &member) == -1) {
+            failed = 1;
+            break;
+        }
+        offset = member_end(&member);
+        /* Фиксации старого архива не нужны: в конце будет одна общая */
+        if (member.flags & (MEMBER_DELETED | MEMBER_COMMIT)) {
+            continue;
+        }
+
+        if (member.flags & MEMBER_CHUNK_PACK) {
+            /* Диапазон прерывается: пакет пишется заново без мёртвых чанков */
+            if (run_length > 0) {
+                if (copy_range(in_fd, run_start, tmp_fd, out_offset, run_length) == -1) {
+                    failed = 1;
+                    break;
+                }
+                out_offset += run_length;
+                run_length = 0;
+            }
+            if (pack_compact(in_fd, &member, &live, tmp_fd, &out_offset, &index.chunks) == -1) {
+                failed = 1;
+                break;
             }
+            continue;
+        }
 
-            if (copy_bytes(in_fd, tmp_fd, remaining) == -1) {
-                perror("compact: ошибка копирования данных");
-                close(in_fd);
-                close(tmp_fd);
-                unlink(tmp_name);
-                free(tmp_name);
-                return -1;
+        if (member.version == ARCHIVE_VERSION) {
+            /* Запись переносится как есть: продолжаем или начинаем диапазон */
+            if (run_length > 0 && run_start + run_length != member.header_offset) {
+                if (copy_range(in_fd, run_start, tmp_fd, out_offset, run_length) == -1) {
+                    failed = 1;
+                    break;
+                }
+                out_offset += run_length;
+                run_length = 0;
             }
-        } else {
-            /* Пропустить данные удалённой записи */
-            if (skip_bytes(in_fd, header.metadata.st_size) == -1) {
-                perror("compact: ошибка пропуска данных");
-                close(in_fd);
-                close(tmp_fd);
-                unlink(tmp_name);
-                free(tmp_name);
-                return -1;
+            if (run_length == 0) {
+                run_start = member.header_offset;
             }
+            off_t record_size = member_end(&member) - member.header_offset;
+            member.header_offset = out_offset + run_length;
+            run_length += record_size;
+            if (index_append(&index, &member) == -1) {
+                failed = 1;
+                break;
+            }
+            continue;
+        }
+
+        /* Заголовок v1 перекодируется в v2, данные копируются отдельно */
+        unsigned char buf[MEMBER_HEADER_MAX];
+        off_t data_offset = member_data_offset(&member);
+        member.version = ARCHIVE_VERSION;
+        member.header_offset = out_offset;
+        member.header_size = (uint32_t)member_encode(&member, buf);
+        if (pwrite_all(tmp_fd, buf, member.header_size, out_offset) == -1 ||
+            index_append(&index, &member) == -1) {
+            perror("compact: ошибка записи заголовка во временный файл");
+            chunk_store_free(&live);
+            index_free(&index);
+            close(in_fd);
+            close(tmp_fd);
+            unlink(tmp_name);
+            free(tmp_name);
+            return -1;
+        }
+        if (copy_range(in_fd, data_offset, tmp_fd, member_data_offset(&member), (off_t)member.size) == -1) {
+            perror("compact: ошибка копирования данных");
+            chunk_store_free(&live);
+            index_free(&index);
+            close(in_fd);
+            close(tmp_fd);
+            unlink(tmp_name);
+            free(tmp_name);
+            return -1;
         }
+        out_offset = member_end(&member);
+    }
+
+    if (!failed && run_length > 0) {
+        failed = copy_range(in_fd, run_start, tmp_fd, out_offset, run_length) == -1;
+        out_offset += run_length;
+    }
+    if (!failed) {
+        failed = commit_write(tmp_fd, out_offset, ARCHIVE_SUPERBLOCK_SIZE, &out_offset) == -1;
     }
 
-    if (r == -1) {
+    if (failed || index_write(tmp_fd, out_offset, &index) == -1) {
         perror("compact: ошибка чтения архива");
+        chunk_store_free(&live);
+        index_free(&index);
         close(in_fd);
         close(tmp_fd);
         unlink(tmp_name);
@@ -188,6 +258,9 @@ int compact_archive(const char *archive_name) {
         return -1;
     }
 
+    chunk_store_free(&live);
+    index_free(&index);
+
     /* flush & close */
     fsync(tmp_fd);
     close(tmp_fd);
@@ -205,192 +278,838 @@ int compact_archive(const char *archive_name) {
     return 0;
 }
 
+/* Пачка записей фиксируется, когда набирается столько файлов или байт */
+#define COMMIT_BATCH_FILES 256
+#define COMMIT_BATCH_BYTES (64 * 1024 * 1024)
+
+/*
+ * Фиксирует пачку записей [batch_start, *data_end): сначала записи уходят
+ * на диск, потом за ними пишется запись фиксации. Сама фиксация становится
+ * надёжной вместе со следующей пачкой или финальным fdatasync, так что на
+ * пачку приходится один fdatasync.
+ */
+static int commit_batch(int arch_fd, off_t batch_start, off_t *data_end) {
+    if (fdatasync(arch_fd) == -1) return -1;
+    return commit_write(arch_fd, *data_end, batch_start, data_end);
+}
+
 /*
- * Добавляет файл file_name в архив archive_name: записывает заголовок и данные.
+ * Добавляет в архив archive_name файлы и каталоги (рекурсивно) из paths.
+ * Архив открывается один раз: записи пишутся подряд на место старого
+ * индекса, пока отдельный поток открывает следующие файлы, а индекс
+ * переписывается один раз в конце. Если запись в архив прервалась, индекс
+ * всё равно покрывает все целиком записанные файлы.
+ * В архив v2 записи дописываются пачками с записями фиксации (см. format.c):
+ * старый индекс отрезается сразу, и после сбоя читатели видят архив до
+ * последней фиксации, а следующее добавление продолжает с неё.
+ * Новый архив создаётся в формате v2; в старый дописываются записи v1.
+ * При сжатии файлы режутся на блоки, которые сжимает пул потоков; при
+ * дедупликации в архив попадают только ещё не известные ему чанки. В старом
+ * формате ни то, ни другое недоступно, и файлы пишутся как есть.
+ * Файлы, которые не удалось прочитать или назвать, пропускаются и
+ * считаются в *errors.
+ * Возвращает 0, если все записи дописаны, -1, если добавление прервалось.
  */
-void archive_file(const char *archive_name, const char *file_name) {
-    int arch_fd = open(archive_name, O_WRONLY | O_CREAT | O_APPEND, 0666);
+int archive_files(const char *archive_name, char **paths, size_t count,
+                  const struct compression_options *compression, int *errors) {
+    *errors = 0;
+    int arch_fd = open(archive_name, O_RDWR | O_CREAT, 0666);
     if (arch_fd == -1) {
         perror("Ошибка: не удалось открыть или создать архив");
-        return;
+        return -1;
     }
 
-    int in_fd = open(file_name, O_RDONLY);
-    if (in_fd == -1) {
-        perror("Ошибка: не удалось открыть входной файл");
+    struct stat arch_st;
+    if (fstat(arch_fd, &arch_st) == -1) {
+        perror("Ошибка: не удалось получить метаданные архива");
         close(arch_fd);
-        return;
+        return -1;
     }
 
-    struct file_header header;
+    int version = archive_version(arch_fd);
+    if (version == 0) {
+        version = ARCHIVE_VERSION;
+        if (archive_write_superblock(arch_fd) == -1) {
+            perror("Ошибка: запись заголовка архива не удалась");
+            close(arch_fd);
+            return -1;
+        }
+    }
+    if (version == -1) {
+        perror("Ошибка: не удалось определить формат архива");
+        close(arch_fd);
+        return -1;
+    }
 
-    if (strlen(file_name) >= sizeof(header.name)) {
-        printf("Ошибка: имя файла '%s' слишком длинное (максимум %zu символов)\n",
-               file_name, sizeof(header.name) - 1);
-        close(in_fd);
+    struct archive_index index;
+    off_t data_end;
+    /*
+     * Таблица чанков лежит в области индекса, которую затрут новые записи,
+     * поэтому её нужно прочитать заранее, даже если дедупликацию не просили.
+     */
+    if (index_load(arch_fd, &index, &data_end) == -1 || index_load_chunks(arch_fd, &index) == -1) {
+        perror("Ошибка: не удалось прочитать структуру архива");
+        index_free(&index);
         close(arch_fd);
-        return;
+        return -1;
     }
-    memset(&header, 0, sizeof(header));
-    strncpy(header.name, file_name, sizeof(header.name) - 1);
 
-    if (fstat(in_fd, &header.metadata) == -1) {
-        perror("Ошибка: не удалось получить метаданные файла");
-        close(in_fd);
+    /*
+     * Старый индекс и хвост оборванного добавления отрезаются до записи:
+     * иначе после сбоя старый индекс мог бы описывать уже затёртые записи.
+     * Архив v2 без фиксаций сначала получает фиксацию всех прежних записей
+     * и только после неё — флаг, чтобы их нельзя было потерять.
+     */
+    uint32_t archive_flag_bits = 0;
+    int commits = version == ARCHIVE_VERSION;
+    if (ftruncate(arch_fd, data_end) == -1 || archive_flags(arch_fd, &archive_flag_bits) == -1 ||
+        (commits && !(archive_flag_bits & ARCHIVE_FLAG_COMMITS) &&
+         (commit_batch(arch_fd, archive_records_start(version), &data_end) == -1 ||
+          fdatasync(arch_fd) == -1 ||
+          archive_set_flags(arch_fd, archive_flag_bits | ARCHIVE_FLAG_COMMITS) == -1))) {
+        perror("Ошибка: не удалось подготовить архив к добавлению");
+        index_free(&index);
         close(arch_fd);
-        return;
+        return -1;
     }
-    header.is_deleted = 0;
+    off_t batch_start = data_end;
+    unsigned batch_files = 0;
 
-    if (write_all(arch_fd, &header, sizeof(header)) == -1) {
-        perror("Ошибка: запись заголовка в архив не удалась");
-        close(in_fd);
+    int codec = compression->codec;
+    if (codec != CODEC_NONE && version != ARCHIVE_VERSION) {
+        printf("Предупреждение: архив старого формата, файлы будут добавлены без сжатия.\n");
+        codec = CODEC_NONE;
+    }
+    int dedup = compression->dedup;
+    if (dedup && version != ARCHIVE_VERSION) {
+        printf("Предупреждение: архив старого формата, файлы будут добавлены без дедупликации.\n");
+        dedup = 0;
+    }
+    struct block_pool *pool = NULL;
+    if (codec != CODEC_NONE && (pool = block_pool_create(compression->jobs)) == NULL) {
+        perror("Ошибка: не удалось запустить потоки сжатия");
+        index_free(&index);
         close(arch_fd);
-        return;
+        return -1;
     }
 
-    if (copy_bytes(in_fd, arch_fd, header.metadata.st_size) == -1) {
-        perror("Ошибка: добавление данных файла в архив не удалось");
-        close(in_fd);
+    struct input_walk *walk = input_walk_start(paths, count);
+    if (walk == NULL) {
+        perror("Ошибка: не удалось запустить обход файлов");
+        block_pool_destroy(pool);
+        index_free(&index);
         close(arch_fd);
-        return;
+        return -1;
     }
 
-    printf("Готово: файл '%s' добавлен в архив '%s'.\n", file_name, archive_name);
+    struct input_file file;
+    struct member_header member;
+    int failed = 0;
+    while (!failed && input_walk_next(walk, &file)) {
+        off_t record_start = data_end;
+        if (file.st.st_dev == arch_st.st_dev && file.st.st_ino == arch_st.st_ino) {
+            printf("Инфо: файл '%s' — это сам архив, пропущен.\n", file.name);
+        } else if (member_from_stat(&member, version, file.name, &file.st) == -1) {
+            printf("Ошибка: имя файла '%s' слишком длинное (максимум %d символов)\n",
+                   file.name, version == ARCHIVE_VERSION ? MEMBER_NAME_MAX - 1 : 1023);
+            (*errors)++;
+        } else if (dedup) {
+            uint64_t new_bytes = 0;
+            if (dedup_add_file(file.fd, arch_fd, data_end, &member, &index.chunks, &new_bytes) == -1) {
+                perror("Ошибка: добавление данных файла в архив не удалось");
+                failed = 1;
+            } else if (index_append(&index, &member) == -1) {
+                perror("Ошибка: запись индекса архива не удалась");
+                failed = 1;
+            } else {
+                data_end = member_end(&member);
+                printf("Готово: файл '%s' добавлен в архив '%s' (новых данных %llu из %llu байт).\n",
+                       file.name, archive_name, (unsigned long long)new_bytes,
+                       (unsigned long long)member.size);
+            }
+        } else if (codec != CODEC_NONE && member.size > 0) {
+            /* Длина заголовка не зависит от размеров, поэтому он пишется после данных */
+            unsigned char buf[MEMBER_HEADER_MAX];
+            member.flags |= MEMBER_COMPRESSED;
+            member.codec = (uint32_t)codec;
+            member.block_size = compression->block_size;
+            member.header_offset = data_end;
+            member.header_size = (uint32_t)member_encode(&member, buf);
+            if (block_compress_member(pool, file.fd, arch_fd, member_data_offset(&member), &member) == -1) {
+                perror("Ошибка: сжатие файла в архив не удалось");
+                failed = 1;
+            } else if (pwrite_all(arch_fd, buf, member_encode(&member, buf), data_end) == -1) {
+                perror("Ошибка: запись заголовка в архив не удалась");
+                failed = 1;
+            } else if (index_append(&index, &member) == -1) {
+                perror("Ошибка: запись индекса архива не удалась");
+                failed = 1;
+            } else {
+                data_end = member_end(&member);
+                printf("Готово: файл '%s' добавлен в архив '%s' (%s, %llu -> %llu байт).\n",
+                       file.name, archive_name, codec_name(codec), (unsigned long long)member.size,
+                       (unsigned long long)member.stored_size);
+            }
+        } else if (member.flags & MEMBER_CHECKSUM) {
+            /*
+             * Сумма считается по ходу копирования, заголовок с ней пишется после
+             * данных. У файла с дырами пишутся только карта и экстенты.
+             */
+            unsigned char buf[MEMBER_HEADER_MAX];
+            struct sparse_map holes;
+            int sparse = sparse_scan(file.fd, &file.st, &holes);
+            if (sparse == 1) {
+                member.flags |= MEMBER_SPARSE;
+                member.stored_size = sparse_stored_size(&holes);
+            }
+            member.header_offset = data_end;
+            member.header_size = (uint32_t)member_encode(&member, buf);
+            off_t data_offset = member_data_offset(&member);
+            if (sparse == -1 ||
+                (sparse ? sparse_write(file.fd, &holes, arch_fd, data_offset, &member.data_crc)
+                        : copy_checksummed(file.fd, -1, arch_fd, data_offset, (off_t)member.size,
+                                           &member.data_crc)) == -1) {
+                perror("Ошибка: добавление данных файла в архив не удалось");
+                failed = 1;
+            } else if (pwrite_all(arch_fd, buf, member_encode(&member, buf), data_end) == -1) {
+                perror("Ошибка: запись заголовка в архив не удалась");
+                failed = 1;
+            } else if (index_append(&index, &member) == -1) {
+                perror("Ошибка: запись индекса архива не удалась");
+                failed = 1;
+            } else if (sparse) {
+                data_end = member_end(&member);
+                printf("Готово: файл '%s' добавлен в архив '%s' (разреженный, данных %llu из %llu байт).\n",
+                       file.name, archive_name, (unsigned long long)holes.data_bytes,
+                       (unsigned long long)member.size);
+            } else {
+                data_end = member_end(&member);
+                printf("Готово: файл '%s' добавлен в архив '%s'.\n", file.name, archive_name);
+            }
+            sparse_map_free(&holes);
+        } else {
+            member.header_offset = data_end;
+            if (lseek(arch_fd, data_end, SEEK_SET) == -1 ||
+                member_write(arch_fd, &member) == -1) {
+                perror("Ошибка: запись заголовка в архив не удалась");
+                failed = 1;
+            } else if (copy_bytes(file.fd, arch_fd, (off_t)member.size) == -1) {
+                perror("Ошибка: добавление данных файла в архив не удалось");
+                failed = 1;
+            } else if (index_append(&index, &member) == -1) {
+                perror("Ошибка: запись индекса архива не удалась");
+                failed = 1;
+            } else {
+                data_end = member_end(&member);
+                printf("Готово: файл '%s' добавлен в архив '%s'.\n", file.name, archive_name);
+            }
+        }
+        close(file.fd);
+        free(file.name);
+
+        if (commits && data_end != record_start &&
+            (++batch_files >= COMMIT_BATCH_FILES || data_end - batch_start >= COMMIT_BATCH_BYTES)) {
+            if (commit_batch(arch_fd, batch_start, &data_end) == -1) {
+                perror("Ошибка: фиксация записей архива не удалась");
+                failed = 1;
+            }
+            batch_start = data_end;
+            batch_files = 0;
+        }
+    }
+    *errors += input_walk_finish(walk);
+    block_pool_destroy(pool);
 
-    close(in_fd);
+    /* Недописанная запись, если была, отрезается вместе со старым индексом */
+    if (commits && data_end != batch_start && commit_batch(arch_fd, batch_start, &data_end) == -1) {
+        perror("Ошибка: фиксация записей архива не удалась");
+        failed = 1;
+    } else if (index_write(arch_fd, data_end, &index) == -1 || fdatasync(arch_fd) == -1) {
+        perror("Ошибка: запись индекса архива не удалась");
+        failed = 1;
+    }
+    index_free(&index);
     close(arch_fd);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Находит первый неудалённый член архива с именем file_name: через индекс,
+ * а в архиве без индекса — просмотром записей.
+ * Возвращает 1 (найден), 0 (нет такого) или -1 при ошибке.
+ */
+static int find_member(int arch_fd, const char *file_name, struct member_header *member) {
+    int version = archive_version(arch_fd);
+    if (version <= 0) {
+        return version;
+    }
+    int rc = index_lookup(arch_fd, version, file_name, member);
+    if (rc != -2) {
+        return rc;
+    }
+
+    off_t data_end = archive_data_end(arch_fd);
+    if (data_end == -1) {
+        return -1;
+    }
+    off_t offset = archive_records_start(version);
+    while (offset < data_end) {
+        if (member_read(arch_fd, version, offset, member) == -1) {
+            return -1;
+        }
+        if (strcmp(member->name, file_name) == 0 && !(member->flags & (MEMBER_DELETED | MEMBER_INTERNAL))) {
+            return 1;
+        }
+        offset = member_end(member);
+    }
+    return 0;
 }
 
 /*
  * Извлекает первый найденный файл по имени из архива и помечает его запись удалённой.
- * После пометки выполняет компактацию архива.
+ * Архив сжимается, только когда удалённые записи занимают больше threshold
+ * от области записей (или когда у архива нет индекса со счётчиком).
+ * С keep архив открывается только на чтение и не меняется.
+ * Возвращает 0 при успехе (и если файла в архиве нет), -1 при ошибке.
  */
-void extract_file(const char *archive_name, const char *file_name) {
-    int arch_fd = open(archive_name, O_RDWR);
+int extract_file(const char *archive_name, const char *file_name, double threshold, int keep,
+                  const struct compression_options *compression) {
+    int arch_fd = open(archive_name, keep ? O_RDONLY : O_RDWR);
     if (arch_fd == -1) {
         perror("Ошибка: не удалось открыть архив");
-        return;
+        return -1;
     }
 
-    struct file_header header;
-    ssize_t bytes_read;
-    int found = 0;
+    struct member_header member;
+    int found = find_member(arch_fd, file_name, &member);
 
-    while (1) {
-        off_t header_start = lseek(arch_fd, 0, SEEK_CUR);
-        if (header_start == -1) {
-            perror("Ошибка определения позиции в архиве");
-            break;
-        }
+    if (found == -1) {
+        perror("Ошибка: чтение заголовка из архива не удалось");
+        close(arch_fd);
+        return -1;
+    }
+    if (!found) {
+        printf("Инфо: файл '%s' не найден в архиве.\n", file_name);
+        close(arch_fd);
+        return 0;
+    }
+    if (!member_name_safe(member.name)) {
+        fprintf(stderr, "Ошибка: '%s': абсолютное имя или '..' в пути, файл не извлекается\n", member.name);
+        close(arch_fd);
+        return -1;
+    }
 
-        bytes_read = read(arch_fd, &header, sizeof(header));
-        if (bytes_read == 0) break; /* EOF */
-        if (bytes_read != sizeof(header)) {
-            perror("Ошибка: чтение заголовка из архива не удалось");
-            break;
+    int out_fd = open(member.name, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)member.mode);
+    if (out_fd == -1) {
+        perror("Ошибка: не удалось создать файл для извлечения");
+        close(arch_fd);
+        return -1;
+    }
+
+    int rc;
+    if (member.flags & MEMBER_COMPRESSED) {
+        /* Блоки независимы: распаковываются пулом потоков */
+        struct block_pool *pool = block_pool_create(compression->jobs);
+        rc = pool ? block_extract_member(pool, arch_fd, &member, out_fd) : -1;
+        block_pool_destroy(pool);
+    } else if (member.flags & MEMBER_CHUNKED) {
+        struct chunk_store chunks;
+        memset(&chunks, 0, sizeof(chunks));
+        rc = chunk_store_load(arch_fd, &chunks) == -1 ? -1
+             : chunked_read_range(arch_fd, &chunks, &member, 0, member.size, out_fd);
+        chunk_store_free(&chunks);
+    } else if (member.flags & MEMBER_SPARSE) {
+        /* Файл только что обрезан до нуля: дыры получаются сами */
+        rc = sparse_extract(arch_fd, &member, out_fd);
+    } else {
+        rc = (lseek(arch_fd, member_data_offset(&member), SEEK_SET) == -1 ||
+              copy_bytes(arch_fd, out_fd, (off_t)member.size) == -1) ? -1 : 0;
+    }
+    if (rc == -1) {
+        perror("Ошибка: извлечение данных файла не удалось");
+        close(out_fd);
+        close(arch_fd);
+        return -1;
+    }
+
+    /* Восстановить атрибуты по открытому файлу */
+    member_restore_metadata(out_fd, &member);
+    close(out_fd);
+
+    if (keep) {
+        close(arch_fd);
+        printf("Готово: файл '%s' извлечён, архив не изменён.\n", file_name);
+        return 0;
+    }
+
+    /* Пометить запись как удалённую в архиве и в индексе */
+    uint64_t dead_bytes = 0;
+    int counted = 0;
+    int result = 0;
+    if (member_mark_deleted(arch_fd, &member) == -1) {
+        perror("Ошибка: запись пометки удаления в архив не удалась");
+        result = -1;
+    } else {
+        counted = index_mark_deleted(arch_fd, member.name, member.header_offset,
+                                     (uint64_t)(member_end(&member) - member.header_offset), &dead_bytes);
+        if (counted == -1) {
+            perror("Ошибка: запись пометки удаления в индекс не удалась");
+            result = -1;
         }
+    }
 
-        /* если совпадает имя и не помечен как удалённый — извлекаем */
-        if (strcmp(header.name, file_name) == 0 && !header.is_deleted) {
-            found = 1;
+    /* Без счётчика в индексе долю мусора не узнать — сжимаем сразу */
+    int compact = (counted != 1);
+    if (counted == 1) {
+        off_t data_end = archive_data_end(arch_fd);
+        off_t records = data_end - archive_records_start(member.version);
+        compact = (data_end == -1 || records <= 0 || (double)dead_bytes > threshold * (double)records);
+    }
 
-            if (header.metadata.st_size > MAX_FILE_SIZE) {
-                printf("Предупреждение: файл '%s' слишком большой для извлечения (размер: %lld байт)\n",
-                       file_name, (long long)header.metadata.st_size);
-                /* пропустим данные и выйдем */
-                if (lseek(arch_fd, header.metadata.st_size, SEEK_CUR) == -1) {
-                    perror("Ошибка: пропуск данных большого файла не удался");
-                }
-                break;
-            }
+    close(arch_fd);
+    if (compact && compact_archive(archive_name) == -1) {
+        fprintf(stderr, "Предупреждение: сжатие архива после удаления не выполнено. Запись помечена, но размер может не уменьшиться.\n");
+    }
 
-            int out_fd = open(header.name, O_WRONLY | O_CREAT | O_TRUNC, header.metadata.st_mode);
-            if (out_fd == -1) {
-                perror("Ошибка: не удалось создать файл для извлечения");
-                /* пропустим данные */
-                if (lseek(arch_fd, header.metadata.st_size, SEEK_CUR) == -1) {
-                    perror("Ошибка: не удалось пропустить данные при неудачном создании файла");
-                }
-                break;
-            }
+    printf("Готово: файл '%s' извлечён и удалён из архива.\n", file_name);
+    return result;
+}
 
-            if (copy_bytes(arch_fd, out_fd, header.metadata.st_size) == -1) {
-                perror("Ошибка: извлечение данных файла не удалось");
-                close(out_fd);
-                break;
-            }
+/*
+ * Заменяет данные члена member на месте содержимым файла file, если новые
+ * данные помещаются в старую запись: пишутся только данные, заголовок
+ * (новые размер, время, сумма) и, если файл стал короче, заглушка на
+ * освободившийся хвост. Так можно менять только обычные члены v2 с
+ * контрольной суммой; разреженные файлы пишутся с картой, то есть заново.
+ * Замена на месте не атомарна: сбой посередине оставляет член с неверной
+ * суммой, что покажет --verify.
+ * Возвращает 1 (заменён), 0 (не помещается, нужно дописать) или -1.
+ */
+static int update_in_place(int arch_fd, struct member_header *member, const struct input_file *file) {
+    uint64_t size = (uint64_t)file->st.st_size;
+    if (member->version != ARCHIVE_VERSION || member->flags != MEMBER_CHECKSUM || size > member->stored_size) {
+        return 0;
+    }
+    uint64_t gap = member->stored_size - size;
+    if (gap > 0 && gap < FILLER_MIN_SIZE) {
+        return 0;
+    }
+    struct sparse_map holes;
+    int sparse = sparse_scan(file->fd, &file->st, &holes);
+    sparse_map_free(&holes);
+    if (sparse == -1) {
+        return -1;
+    }
+    if (sparse == 1) {
+        return 0;
+    }
 
-            close(out_fd);
+    struct member_header updated;
+    unsigned char buf[MEMBER_HEADER_MAX];
+    if (member_from_stat(&updated, ARCHIVE_VERSION, member->name, &file->st) == -1) {
+        return -1;
+    }
+    updated.header_offset = member->header_offset;
+    updated.header_size = (uint32_t)member_encode(&updated, buf);
+    off_t data_offset = member_data_offset(&updated);
+    if (copy_checksummed(file->fd, 0, arch_fd, data_offset, (off_t)size, &updated.data_crc) == -1 ||
+        (gap > 0 && filler_write(arch_fd, data_offset + (off_t)size, gap) == -1) ||
+        pwrite_all(arch_fd, buf, member_encode(&updated, buf), updated.header_offset) == -1 ||
+        index_update_member(arch_fd, updated.name, updated.header_offset, size, gap) == -1) {
+        return -1;
+    }
+    *member = updated;
+    return 1;
+}
 
-            /* Восстановить атрибуты */
-            restore_metadata_from_stat(header.name, &header.metadata);
+/*
+ * Обновляет в архиве файлы из paths (каталоги — рекурсивно). Член, новые
+ * данные которого помещаются в его запись, переписывается на месте; прочие
+ * файлы дописываются в конец обычным добавлением, и только после этого
+ * их старые версии помечаются удалёнными. Сбой между этими шагами
+ * оставляет обе версии, но не теряет ни одной. Объём ввода-вывода зависит
+ * только от обновляемых файлов, весь архив не переписывается.
+ * Файлы, которые не удалось прочитать, пропускаются и считаются в *errors.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int update_files(const char *archive_name, char **paths, size_t count,
+                 const struct compression_options *compression, int *errors) {
+    *errors = 0;
+    int arch_fd = open(archive_name, O_RDWR | O_CREAT, 0666);
+    if (arch_fd == -1) {
+        perror("Ошибка: не удалось открыть или создать архив");
+        return -1;
+    }
+    int version = archive_version(arch_fd);
+    if (version == -1) {
+        perror("Ошибка: не удалось определить формат архива");
+        close(arch_fd);
+        return -1;
+    }
+    /* Со сжатием и дедупликацией данные всегда дописываются заново */
+    int in_place = version == ARCHIVE_VERSION && compression->codec == CODEC_NONE && !compression->dedup;
 
-            /* Пометить запись как удалённую в архиве */
-            header.is_deleted = 1;
-            if (lseek(arch_fd, header_start, SEEK_SET) == -1) {
-                perror("Ошибка: позиционирование в архиве для пометки удаления не удалось");
-            } else if (write(arch_fd, &header, sizeof(header)) != sizeof(header)) {
-                perror("Ошибка: запись пометки удаления в архив не удалась");
-            }
+    struct input_walk *walk = input_walk_start(paths, count);
+    if (walk == NULL) {
+        perror("Ошибка: не удалось запустить обход файлов");
+        close(arch_fd);
+        return -1;
+    }
 
-            /* Закрываем дескриптор и запускаем компактацию архива */
-            close(arch_fd);
-            if (compact_archive(archive_name) == -1) {
-                fprintf(stderr, "Предупреждение: сжатие архива после удаления не выполнено. Запись помечена, но размер может не уменьшиться.\n");
-            }
+    /* Файлы для дописывания и заголовки их старых версий (-1 — не было) */
+    char **append = NULL;
+    off_t *stale = NULL;
+    size_t append_count = 0, append_capacity = 0;
+    int failed = 0;
 
-            printf("Готово: файл '%s' извлечён и удалён из архива.\n", file_name);
-            return;
+    struct input_file file;
+    struct member_header member;
+    while (input_walk_next(walk, &file)) {
+        int found = failed ? -1 : find_member(arch_fd, file.name, &member);
+        int rc = found == 1 && in_place ? update_in_place(arch_fd, &member, &file) : 0;
+        if (found == -1 || rc == -1) {
+            if (!failed) perror("Ошибка: обновление файла в архиве не удалось");
+            failed = 1;
+        } else if (rc == 1) {
+            printf("Готово: файл '%s' обновлён в архиве '%s' на месте.\n", file.name, archive_name);
         } else {
-            /* Пропустить данные этой записи и продолжить */
-            if (lseek(arch_fd, header.metadata.st_size, SEEK_CUR) == -1) {
-                perror("Ошибка: позиционирование в архиве при пропуске записи не удалось");
-                break;
+            if (append_count == append_capacity) {
+                append_capacity = append_capacity ? append_capacity * 2 : 64;
+                char **names = realloc(append, append_capacity * sizeof(*append));
+                if (names != NULL) append = names;
+                off_t *offsets = realloc(stale, append_capacity * sizeof(*stale));
+                if (offsets != NULL) stale = offsets;
+                if (names == NULL || offsets == NULL) append_capacity = append_count;
+            }
+            if (append_count < append_capacity && (append[append_count] = strdup(file.name)) != NULL) {
+                stale[append_count++] = found == 1 ? member.header_offset : -1;
+            } else {
+                perror("Ошибка: не хватает памяти");
+                failed = 1;
+            }
+        }
+        close(file.fd);
+        free(file.name);
+    }
+    *errors = input_walk_finish(walk);
+    if (fdatasync(arch_fd) == -1) {
+        failed = 1;
+    }
+    close(arch_fd);
+
+    if (!failed && append_count > 0) {
+        int append_errors = 0;
+        failed = archive_files(archive_name, append, append_count, compression, &append_errors) == -1;
+        *errors += append_errors;
+    }
+    /* Новые версии на месте: старые больше не нужны */
+    if (!failed && append_count > 0 && (arch_fd = open(archive_name, O_RDWR)) != -1) {
+        version = archive_version(arch_fd);
+        uint64_t dead_bytes;
+        for (size_t i = 0; i < append_count && !failed; i++) {
+            if (stale[i] == -1) continue;
+            if (member_read(arch_fd, version, stale[i], &member) == -1 ||
+                member_mark_deleted(arch_fd, &member) == -1 ||
+                index_mark_deleted(arch_fd, member.name, member.header_offset,
+                                   (uint64_t)(member_end(&member) - member.header_offset), &dead_bytes) == -1) {
+                perror("Ошибка: пометка старой версии файла удалённой не удалась");
+                failed = 1;
             }
         }
+        if (fdatasync(arch_fd) == -1) failed = 1;
+        close(arch_fd);
+    } else if (!failed && append_count > 0) {
+        perror("Ошибка: не удалось открыть архив");
+        failed = 1;
+    }
+
+    for (size_t i = 0; i < append_count; i++) free(append[i]);
+    free(append);
+    free(stale);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Пишет в stdout архив из файлов paths за один проход (см. stream.c).
+ * Сообщения идут в stderr, stdout занят архивом.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+static int archive_to_stream(char **paths, size_t count, const struct compression_options *compression) {
+    if (isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "Ошибка: архив не выводится в терминал, перенаправьте stdout\n");
+        return -1;
+    }
+    if (compression->codec != CODEC_NONE || compression->dedup) {
+        fprintf(stderr, "Предупреждение: в потоке файлы хранятся без сжатия и дедупликации.\n");
+    }
+    int errors = 0;
+    long written = stream_create(STDOUT_FILENO, paths, count, &errors);
+    if (written == -1) {
+        perror("Ошибка: запись архива в поток не удалась");
+        return -1;
+    }
+    fprintf(stderr, "Готово: в поток записано файлов: %ld, ошибок: %d.\n", written, errors);
+    return errors ? -1 : 0;
+}
+
+/*
+ * Извлекает из архива в stdin все члены или подходящие под шаблон pattern.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+static int extract_stream(const char *pattern) {
+    int errors = 0;
+    long extracted = stream_extract(STDIN_FILENO, pattern, &errors);
+    if (extracted == -1) {
+        if (errno == EINVAL) fprintf(stderr, "Ошибка: в stdin нет архива нового формата\n");
+        else perror("Ошибка: чтение архива из потока не удалось");
+        return -1;
+    }
+    if (extracted == 0 && errors == 0) {
+        printf("Инфо: подходящих файлов в архиве нет.\n");
+        return 0;
+    }
+    printf("Готово: извлечено файлов из потока: %ld, ошибок: %d.\n", extracted, errors);
+    return errors ? -1 : 0;
+}
+
+/*
+ * Извлекает все члены архива (pattern == NULL) или подходящие под шаблон,
+ * не меняя архив. Возвращает 0, если всё извлечено, иначе -1.
+ */
+int extract_many(const char *archive_name, const char *pattern, const struct compression_options *compression) {
+    if (strcmp(archive_name, "-") == 0) {
+        return extract_stream(pattern);
+    }
+    int arch_fd = open(archive_name, O_RDONLY);
+    if (arch_fd == -1) {
+        perror("Ошибка: не удалось открыть архив");
+        return -1;
+    }
+
+    int errors = 0;
+    long extracted = extract_members(arch_fd, pattern, compression->jobs, &errors);
+    close(arch_fd);
+    if (extracted == -1) {
+        perror("Ошибка: чтение архива не удалось");
+        return -1;
+    }
+    if (extracted == 0 && errors == 0) {
+        printf("Инфо: подходящих файлов в архиве нет.\n");
+        return 0;
+    }
+    printf("Готово: извлечено файлов: %ld, ошибок: %d, архив не изменён.\n", extracted, errors);
+    return errors ? -1 : 0;
+}
+
+/*
+ * Выводит в stdout байты [offset, offset + length) члена file_name (length
+ * == -1 — до конца). Член ищется через индекс, архив отображается в память
+ * только в пределах данных члена; у сжатого члена распаковываются только
+ * нужные блоки, у члена со списком чанков читаются только нужные чанки.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int cat_member(const char *archive_name, const char *file_name, uint64_t offset, int64_t length) {
+    int arch_fd = open(archive_name, O_RDONLY);
+    if (arch_fd == -1) {
+        perror("Ошибка: не удалось открыть архив");
+        return -1;
     }
 
+    struct member_header member;
+    int found = find_member(arch_fd, file_name, &member);
+    if (found == -1) {
+        perror("Ошибка: чтение заголовка из архива не удалось");
+        close(arch_fd);
+        return -1;
+    }
     if (!found) {
-        printf("Инфо: файл '%s' не найден в архиве.\n", file_name);
+        fprintf(stderr, "Инфо: файл '%s' не найден в архиве.\n", file_name);
+        close(arch_fd);
+        return -1;
     }
 
+    if (offset > member.size) offset = member.size;
+    uint64_t available = member.size - offset;
+    uint64_t count = (length < 0 || (uint64_t)length > available) ? available : (uint64_t)length;
+    if (count == 0) {
+        close(arch_fd);
+        return 0;
+    }
+
+    /* Чанки разбросаны по архиву: отображать нечего, читаем по одному */
+    if (member.flags & MEMBER_CHUNKED) {
+        struct chunk_store chunks;
+        memset(&chunks, 0, sizeof(chunks));
+        int rc = chunk_store_load(arch_fd, &chunks) == -1 ? -1
+                 : chunked_read_range(arch_fd, &chunks, &member, offset, count, STDOUT_FILENO);
+        if (rc == -1) {
+            perror("Ошибка: вывод данных файла не удался");
+        }
+        chunk_store_free(&chunks);
+        close(arch_fd);
+        return rc;
+    }
+    /* Дыры выводятся нулями, поэтому тоже читаем по экстентам */
+    if (member.flags & MEMBER_SPARSE) {
+        int rc = sparse_read_range(arch_fd, &member, offset, count, STDOUT_FILENO);
+        if (rc == -1) {
+            perror("Ошибка: вывод данных файла не удался");
+        }
+        close(arch_fd);
+        return rc;
+    }
+
+    /* mmap требует смещения, кратного странице: отображаем с ближайшей границы */
+    long page = sysconf(_SC_PAGESIZE);
+    off_t data_offset = member_data_offset(&member);
+    uint64_t map_from, map_to;
+    if (member.flags & MEMBER_COMPRESSED) {
+        map_from = 0;
+        map_to = member.stored_size;
+    } else {
+        map_from = offset;
+        map_to = offset + count;
+    }
+    off_t map_start = (data_offset + (off_t)map_from) / page * page;
+    size_t map_length = (size_t)(data_offset + (off_t)map_to - map_start);
+    unsigned char *map = mmap(NULL, map_length, PROT_READ, MAP_SHARED, arch_fd, map_start);
+    if (map == MAP_FAILED) {
+        perror("Ошибка: не удалось отобразить архив в память");
+        close(arch_fd);
+        return -1;
+    }
+
+    const unsigned char *data = map + (data_offset + (off_t)map_from - map_start);
+    int rc;
+    if (member.flags & MEMBER_COMPRESSED) {
+        rc = block_read_range(data, &member, offset, count, STDOUT_FILENO);
+    } else {
+        rc = write_all(STDOUT_FILENO, data, (size_t)count);
+    }
+    if (rc == -1) {
+        perror("Ошибка: вывод данных файла не удался");
+    }
+
+    munmap(map, map_length);
     close(arch_fd);
+    return rc;
 }
 
 /*
- * Печатает список актуальных файлов в архиве с размерами и временем модификации.
+ * Проверяет целостность архива и печатает итог. Возвращает 0, если ошибок
+ * не найдено, иначе -1.
  */
-void show_stat(const char *archive_name) {
+int verify_command(const char *archive_name, const struct compression_options *compression) {
     int arch_fd = open(archive_name, O_RDONLY);
     if (arch_fd == -1) {
         perror("Ошибка: не удалось открыть архив");
-        return;
+        return -1;
     }
 
-    struct file_header header;
-    ssize_t bytes_read;
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    struct verify_result result;
+    int rc = verify_archive(arch_fd, compression->jobs, &result);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    close(arch_fd);
+    if (rc == -1) {
+        perror("Ошибка: проверка архива не удалась");
+        return -1;
+    }
+
+    double seconds = (double)(finished.tv_sec - started.tv_sec) + (double)(finished.tv_nsec - started.tv_nsec) / 1e9;
+    double mib = (double)result.bytes / (1024.0 * 1024.0);
+    printf("Проверено записей: %llu (без контрольной суммы: %llu), данных: %.1f МБ за %.3f с (%.1f МБ/с, crc32c: %s).\n",
+           (unsigned long long)result.records, (unsigned long long)result.unchecked, mib, seconds,
+           seconds > 0 ? mib / seconds : 0.0, crc32c_implementation());
+    if (result.errors > 0) {
+        printf("Найдено ошибок: %llu.\n", (unsigned long long)result.errors);
+        return -1;
+    }
+    printf("Готово: архив '%s' цел.\n", archive_name);
+    return 0;
+}
+
+static void print_stat_header(const char *archive_name) {
     printf("Содержимое архива '%s' (помеченные как удалённые скрыты):\n", archive_name);
     printf("--------------------------------------------------\n");
     printf("%-30s %-12s %-20s\n", "Имя файла", "Размер (байт)", "Дата изменения");
     printf("--------------------------------------------------\n");
+}
 
-    while ((bytes_read = read(arch_fd, &header, sizeof(header))) > 0) {
-        if (bytes_read != sizeof(header)) {
-            perror("Ошибка: чтение заголовка при просмотре архива не удалось");
+/* Строка списка для члена; удалённые и служебные записи не печатаются */
+static void print_stat_row(const struct member_header *member) {
+    if (member->flags & (MEMBER_DELETED | MEMBER_INTERNAL)) {
+        return;
+    }
+    char time_buf[80];
+    time_t mtime = (time_t)member->mtime_sec;
+    struct tm *tm = localtime(&mtime);
+    if (tm) strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm);
+    else strncpy(time_buf, "unknown", sizeof(time_buf));
+    printf("%-30s %-10llu %-20s\n", member->name, (unsigned long long)member->size, time_buf);
+}
+
+/*
+ * Печатает список файлов архива, читая его из stdin за один проход:
+ * данные записей пропускаются, индекс в конце потока не нужен.
+ */
+static void show_stat_stream(void) {
+    if (archive_read_stream_superblock(STDIN_FILENO) == -1) {
+        if (errno == EINVAL) fprintf(stderr, "Ошибка: в stdin нет архива нового формата\n");
+        else perror("Ошибка: чтение архива из потока не удалось");
+        return;
+    }
+    print_stat_header("-");
+
+    struct member_header member;
+    off_t offset = ARCHIVE_SUPERBLOCK_SIZE;
+    int rc;
+    while ((rc = member_read_stream(STDIN_FILENO, offset, &member)) == 1) {
+        print_stat_row(&member);
+        offset = member_end(&member);
+        if (skip_bytes(STDIN_FILENO, (off_t)member.stored_size) == -1) {
+            rc = -1;
             break;
         }
-        if (!header.is_deleted) {
-            char time_buf[80];
-            struct tm *tm = localtime(&header.metadata.st_mtime);
-            if (tm) strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm);
-            else strncpy(time_buf, "unknown", sizeof(time_buf));
-            printf("%-30s %-10lld %-20s\n", header.name, (long long)header.metadata.st_size, time_buf);
-        }
-        if (lseek(arch_fd, header.metadata.st_size, SEEK_CUR) == -1) {
-            perror("Ошибка: позиционирование в архиве при просмотре не удалось");
+    }
+    if (rc == -1) {
+        perror("Ошибка: чтение архива из потока не удалось");
+    }
+}
+
+/*
+ * Печатает список актуальных файлов в архиве с размерами и временем модификации.
+ */
+void show_stat(const char *archive_name) {
+    if (strcmp(archive_name, "-") == 0) {
+        show_stat_stream();
+        return;
+    }
+    int arch_fd = open(archive_name, O_RDONLY);
+    if (arch_fd == -1) {
+        perror("Ошибка: не удалось открыть архив");
+        return;
+    }
+
+    struct member_header member;
+    int version = archive_version(arch_fd);
+    off_t data_end = archive_data_end(arch_fd);
+    if (version == -1 || data_end == -1) {
+        perror("Ошибка: не удалось прочитать структуру архива");
+        close(arch_fd);
+        return;
+    }
+    print_stat_header(archive_name);
+
+    off_t offset = archive_records_start(version);
+    while (offset < data_end) {
+        if (member_read(arch_fd, version, offset, &member) == -1) {
+            perror("Ошибка: чтение заголовка при просмотре архива не удалось");
             break;
         }
+        print_stat_row(&member);
+        offset = member_end(&member);
     }
 
     close(arch_fd);
@@ -416,28 +1135,209 @@ int main(int argc, char *argv[]) {
     const char *archive_name = argv[1];
 
     static struct option long_options[] = {
-        {"input",   required_argument, 0, 'i'},
-        {"extract", required_argument, 0, 'e'},
-        {"stat",    no_argument,       0, 's'},
-        {"help",    no_argument,       0, 'h'},
+        {"input",        required_argument, 0, 'i'},
+        {"update",       required_argument, 0, OPT_UPDATE},
+        {"extract",      required_argument, 0, 'e'},
+        {"extract-keep", required_argument, 0, 'k'},
+        {"extract-all",  no_argument,       0, OPT_EXTRACT_ALL},
+        {"extract-glob", required_argument, 0, OPT_EXTRACT_GLOB},
+        {"cat",          required_argument, 0, OPT_CAT},
+        {"offset",       required_argument, 0, OPT_OFFSET},
+        {"length",       required_argument, 0, OPT_LENGTH},
+        {"stat",         no_argument,       0, 's'},
+        {"verify",       no_argument,       0, OPT_VERIFY},
+        {"compact",      no_argument,       0, 'c'},
+        {"threshold",    required_argument, 0, 't'},
+        {"compress",     required_argument, 0, 'z'},
+        {"block-size",   required_argument, 0, OPT_BLOCK_SIZE},
+        {"jobs",         required_argument, 0, 'j'},
+        {"dedup",        no_argument,       0, 'd'},
+        {"copy-method",  required_argument, 0, OPT_COPY_METHOD},
+        {"copy-stats",   no_argument,       0, OPT_COPY_STATS},
+        {"help",         no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     optind = 2;
     int opt;
     int option_index = 0;
-    opt = getopt_long(argc, argv, "i:e:sh", long_options, &option_index);
+    int action = 0;
+    const char *action_arg = NULL;
+    double threshold = DEFAULT_COMPACT_THRESHOLD;
+    int copy_stats = 0;
+    struct compression_options compression = { CODEC_NONE, DEFAULT_BLOCK_SIZE, 0, 0 };
+    uint64_t cat_offset = 0;
+    int64_t cat_length = -1;
+    /* Все -i накапливаются; путей не больше, чем аргументов */
+    char **inputs = malloc((size_t)argc * sizeof(*inputs));
+    size_t input_count = 0;
+    if (inputs == NULL) {
+        perror("malloc");
+        return 1;
+    }
 
-    switch (opt) {
+    /*
+     * Выполняется первое действие; --threshold можно указать в любом месте.
+     * "-" в начале строки опций сохраняет порядок путей: свободные аргументы
+     * приходят как opt == 1 там же, где стоят в командной строке.
+     */
+    while ((opt = getopt_long(argc, argv, "-i:e:k:scht:z:j:d", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 1:
+                inputs[input_count++] = optarg;
+                break;
+            case 't': {
+                char *end;
+                threshold = strtod(optarg, &end);
+                if (*end != '\0' || threshold < 0.0 || threshold > 1.0) {
+                    fprintf(stderr, "Ошибка: порог сжатия должен быть числом от 0 до 1\n");
+                    return 1;
+                }
+                break;
+            }
+            case 'z':
+                compression.codec = codec_from_name(optarg);
+                if (compression.codec == -1) {
+                    fprintf(stderr, "Ошибка: неизвестный кодек '%s' (доступны lz4, zlib, none)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_BLOCK_SIZE: {
+                char *end;
+                unsigned long kib = strtoul(optarg, &end, 10);
+                if (*end != '\0' || kib == 0 || kib > MAX_BLOCK_SIZE / 1024) {
+                    fprintf(stderr, "Ошибка: размер блока должен быть от 1 до %d КиБ\n", MAX_BLOCK_SIZE / 1024);
+                    return 1;
+                }
+                compression.block_size = (uint32_t)(kib * 1024);
+                break;
+            }
+            case 'j': {
+                char *end;
+                unsigned long jobs = strtoul(optarg, &end, 10);
+                if (*end != '\0' || jobs == 0 || jobs > 1024) {
+                    fprintf(stderr, "Ошибка: число потоков должно быть от 1 до 1024\n");
+                    return 1;
+                }
+                compression.jobs = (unsigned)jobs;
+                break;
+            }
+            case OPT_OFFSET:
+            case OPT_LENGTH: {
+                char *end;
+                errno = 0;
+                unsigned long long value = strtoull(optarg, &end, 10);
+                if (*end != '\0' || optarg[0] == '-' || errno != 0 || value > INT64_MAX) {
+                    fprintf(stderr, "Ошибка: неверное значение '%s'\n", optarg);
+                    return 1;
+                }
+                if (opt == OPT_OFFSET) cat_offset = value;
+                else cat_length = (int64_t)value;
+                break;
+            }
+            case OPT_COPY_METHOD: {
+                int method = copy_method_from_name(optarg);
+                if (method == -2) {
+                    fprintf(stderr, "Ошибка: неизвестный способ копирования '%s'\n", optarg);
+                    return 1;
+                }
+                copy_set_method(method);
+                break;
+            }
+            case 'd':
+                compression.dedup = 1;
+                break;
+            case OPT_COPY_STATS:
+                copy_stats = 1;
+                break;
+            case 'i':
+            case OPT_UPDATE:
+                inputs[input_count++] = optarg;
+                /* fallthrough */
+            case 'e':
+            case 'k':
+            case OPT_EXTRACT_ALL:
+            case OPT_EXTRACT_GLOB:
+            case OPT_CAT:
+            case OPT_VERIFY:
+            case 's':
+            case 'c':
+            case 'h':
+                if (!action) {
+                    action = opt;
+                    action_arg = optarg;
+                }
+                break;
+            default:
+                print_help();
+                return 1;
+        }
+    }
+
+    if (compression.dedup && compression.codec != CODEC_NONE) {
+        fprintf(stderr, "Ошибка: --dedup и --compress нельзя использовать вместе\n");
+        return 1;
+    }
+
+    /* Архив "-" — поток: пишется в stdout, читается из stdin за один проход */
+    if (strcmp(archive_name, "-") == 0 && action != 'i' && action != 's' && action != 'h' &&
+        action != OPT_EXTRACT_ALL && action != OPT_EXTRACT_GLOB) {
+        fprintf(stderr, "Ошибка: с потоком работают только -i, -s, --extract-all и --extract-glob\n");
+        return 1;
+    }
+
+    int input_errors = 0;
+    switch (action) {
         case 'i':
-            if (optarg) archive_file(archive_name, optarg);
+            /* Свободные пути тоже добавляются: -i a b c */
+            if (strcmp(archive_name, "-") == 0) {
+                if (archive_to_stream(inputs, input_count, &compression) == -1) {
+                    return 1;
+                }
+                break;
+            }
+            if (archive_files(archive_name, inputs, input_count, &compression, &input_errors) == -1 ||
+                input_errors > 0) {
+                return 1;
+            }
+            break;
+        case OPT_UPDATE:
+            if (update_files(archive_name, inputs, input_count, &compression, &input_errors) == -1 ||
+                input_errors > 0) {
+                return 1;
+            }
             break;
         case 'e':
-            if (optarg) extract_file(archive_name, optarg);
+        case 'k':
+            if (extract_file(archive_name, action_arg, threshold, action == 'k', &compression) == -1) {
+                return 1;
+            }
+            break;
+        case OPT_EXTRACT_ALL:
+        case OPT_EXTRACT_GLOB:
+            if (extract_many(archive_name, action_arg, &compression) == -1) {
+                return 1;
+            }
+            break;
+        case OPT_CAT:
+            if (cat_member(archive_name, action_arg, cat_offset, cat_length) == -1) {
+                return 1;
+            }
             break;
         case 's':
             show_stat(archive_name);
             break;
+        case OPT_VERIFY:
+            if (verify_command(archive_name, &compression) == -1) {
+                return 1;
+            }
+            break;
+        case 'c':
+            if (compact_archive(archive_name) == -1) {
+                return 1;
+            }
+            printf("Готово: архив '%s' сжат.\n", archive_name);
+            break;
         case 'h':
             print_help();
             break;
@@ -445,6 +1345,10 @@ int main(int argc, char *argv[]) {
             print_help();
             return 1;
     }
+    free(inputs);
 
+    if (copy_stats) {
+        print_copy_stats();
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Разреженные файлы (MEMBER_SPARSE).
+ *
+ * Дыры находятся через SEEK_DATA/SEEK_HOLE, и в архив попадают только
+ * участки с данными. Данные записи — карта экстентов (u64 число
+ * экстентов, затем по u64 смещение и u64 длина на экстент, по возрастанию
+ * смещений), а за ней подряд содержимое экстентов. Всё между экстентами и
+ * после последнего до размера файла — дыры. Карта стоит перед данными,
+ * так что член можно и записать в поток, и извлечь из потока.
+ *
+ * При извлечении новый файл сразу растягивается ftruncate до полного
+ * размера, а экстенты пишутся на свои места: в дыры не пишется ни байта,
+ * и ФС их не выделяет. Контрольная сумма записи охватывает карту и данные.
+ */
+
+#define MAP_HEAD_SIZE 8
+#define MAP_ENTRY_SIZE 16
+/* Буфер для вывода диапазона (--cat) */
+#define RANGE_BUFFER_SIZE (1024 * 1024)
+
+static int map_append(struct sparse_map *map, size_t *capacity, uint64_t offset, uint64_t length) {
+    if (map->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        struct sparse_extent *grown = realloc(map->extents, *capacity * sizeof(*map->extents));
+        if (grown == NULL) return -1;
+        map->extents = grown;
+    }
+    map->extents[map->count].offset = offset;
+    map->extents[map->count].length = length;
+    map->count++;
+    map->data_bytes += length;
+    return 0;
+}
+
+void sparse_map_free(struct sparse_map *map) {
+    free(map->extents);
+    memset(map, 0, sizeof(*map));
+}
+
+/*
+ * Строит карту экстентов открытого файла fd. Файлы, которые занимают на
+ * диске не меньше своего размера, не просматриваются вовсе.
+ * Возвращает 1, если в файле есть дыры (карта заполнена), 0, если хранить
+ * его нужно как обычно (дыр нет или ФС не умеет их искать), -1 при ошибке.
+ */
+int sparse_scan(int fd, const struct stat *st, struct sparse_map *map) {
+    memset(map, 0, sizeof(*map));
+    if (!S_ISREG(st->st_mode) || st->st_size == 0 || (uint64_t)st->st_blocks * 512 >= (uint64_t)st->st_size) {
+        return 0;
+    }
+
+    size_t capacity = 0;
+    off_t size = st->st_size;
+    off_t position = 0;
+    while (position < size) {
+        off_t data = lseek(fd, position, SEEK_DATA);
+        if (data == -1 && errno == ENXIO) break;  /* дальше до конца одни дыры */
+        if (data == -1) {
+            int saved = errno;
+            sparse_map_free(map);
+            errno = saved;
+            return (saved == EINVAL || saved == EOPNOTSUPP) ? 0 : -1;
+        }
+        if (data >= size) break;
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1 || map_append(map, &capacity, (uint64_t)data,
+                                     (uint64_t)((hole < size ? hole : size) - data)) == -1) {
+            int saved = errno;
+            sparse_map_free(map);
+            errno = saved;
+            return -1;
+        }
+        position = hole;
+    }
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        sparse_map_free(map);
+        return -1;
+    }
+    /* Блоков меньше размера, а дыр нет (например, сжатие в ФС): карта не нужна */
+    if (map->count == 1 && map->extents[0].offset == 0 && map->data_bytes == (uint64_t)size) {
+        sparse_map_free(map);
+        return 0;
+    }
+    return 1;
+}
+
+static uint64_t map_size(size_t count) {
+    return MAP_HEAD_SIZE + (uint64_t)count * MAP_ENTRY_SIZE;
+}
+
+/* Сколько байт член с картой map занимает в архиве */
+uint64_t sparse_stored_size(const struct sparse_map *map) {
+    return map_size(map->count) + map->data_bytes;
+}
+
+/*
+ * Пишет карту экстентов в out_fd с out_offset (-1 — с текущей позиции,
+ * out_fd == -1 — только сумма), продолжая CRC32C в *crc.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int sparse_write_map(const struct sparse_map *map, int out_fd, off_t out_offset, uint32_t *crc) {
+    size_t length = (size_t)map_size(map->count);
+    unsigned char *raw = malloc(length);
+    if (raw == NULL) return -1;
+    put_le64(raw, map->count);
+    for (size_t i = 0; i < map->count; i++) {
+        put_le64(raw + MAP_HEAD_SIZE + i * MAP_ENTRY_SIZE, map->extents[i].offset);
+        put_le64(raw + MAP_HEAD_SIZE + i * MAP_ENTRY_SIZE + 8, map->extents[i].length);
+    }
+    *crc = crc32c(*crc, raw, length);
+    int rc = 0;
+    if (out_fd != -1) {
+        rc = out_offset >= 0 ? pwrite_all(out_fd, raw, length, out_offset) : write_all(out_fd, raw, length);
+    }
+    free(raw);
+    return rc;
+}
+
+/*
+ * Пишет карту и экстенты файла in_fd в out_fd с out_offset (-1 — с текущей
+ * позиции, out_fd == -1 — только сумма), продолжая CRC32C в *crc.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int sparse_write(int in_fd, const struct sparse_map *map, int out_fd, off_t out_offset, uint32_t *crc) {
+    int rc = sparse_write_map(map, out_fd, out_offset, crc);
+    if (out_offset >= 0) out_offset += (off_t)map_size(map->count);
+
+    for (size_t i = 0; rc == 0 && i < map->count; i++) {
+        const struct sparse_extent *extent = &map->extents[i];
+        rc = copy_checksummed(in_fd, (off_t)extent->offset, out_fd, out_offset, (off_t)extent->length, crc);
+        if (out_offset >= 0) out_offset += (off_t)extent->length;
+    }
+    return rc;
+}
+
+/*
+ * Разбирает count записей карты из raw и проверяет, что экстенты идут по
+ * порядку, не выходят за размер члена и вместе с картой занимают ровно
+ * stored_size. Возвращает 0 или -1 (EIO — карта повреждена).
+ */
+static int map_decode(const unsigned char *raw, size_t count, const struct member_header *member,
+                      struct sparse_map *map) {
+    memset(map, 0, sizeof(*map));
+    map->extents = malloc((count ? count : 1) * sizeof(*map->extents));
+    if (map->extents == NULL) return -1;
+    map->count = count;
+    uint64_t previous_end = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct sparse_extent *extent = &map->extents[i];
+        extent->offset = get_le64(raw + i * MAP_ENTRY_SIZE);
+        extent->length = get_le64(raw + i * MAP_ENTRY_SIZE + 8);
+        if (extent->offset < previous_end || extent->length > member->size ||
+            extent->offset > member->size - extent->length) {
+            sparse_map_free(map);
+            errno = EIO;
+            return -1;
+        }
+        previous_end = extent->offset + extent->length;
+        map->data_bytes += extent->length;
+    }
+    if (sparse_stored_size(map) != member->stored_size) {
+        sparse_map_free(map);
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Число экстентов по заголовку карты, если карта помещается в запись */
+static int map_count(const unsigned char *head, const struct member_header *member, size_t *count) {
+    uint64_t value = get_le64(head);
+    if (member->stored_size < MAP_HEAD_SIZE || value > (member->stored_size - MAP_HEAD_SIZE) / MAP_ENTRY_SIZE) {
+        errno = EIO;
+        return -1;
+    }
+    *count = (size_t)value;
+    return 0;
+}
+
+/* Читает карту члена из архива fd */
+static int read_map(int fd, const struct member_header *member, struct sparse_map *map) {
+    unsigned char head[MAP_HEAD_SIZE];
+    size_t count;
+    off_t offset = member_data_offset(member);
+    if (pread_all(fd, head, sizeof(head), offset) == -1 || map_count(head, member, &count) == -1) return -1;
+    unsigned char *raw = malloc(count ? count * MAP_ENTRY_SIZE : 1);
+    if (raw == NULL) return -1;
+    int rc = pread_all(fd, raw, count * MAP_ENTRY_SIZE, offset + MAP_HEAD_SIZE);
+    if (rc == 0) rc = map_decode(raw, count, member, map);
+    free(raw);
+    return rc;
+}
+
+/*
+ * Извлекает разреженный член в только что созданный (пустой) файл out_fd:
+ * файл растягивается до полного размера, экстенты пишутся на свои места.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int sparse_extract(int fd, const struct member_header *member, int out_fd) {
+    struct sparse_map map;
+    if (read_map(fd, member, &map) == -1) return -1;
+    int rc = ftruncate(out_fd, (off_t)member->size);
+    off_t source = member_data_offset(member) + (off_t)map_size(map.count);
+    for (size_t i = 0; rc == 0 && i < map.count; i++) {
+        rc = copy_range(fd, source, out_fd, (off_t)map.extents[i].offset, (off_t)map.extents[i].length);
+        source += (off_t)map.extents[i].length;
+    }
+    sparse_map_free(&map);
+    return rc;
+}
+
+/*
+ * То же для архива, читаемого из потока in_fd с начала данных члена;
+ * CRC32C прочитанного продолжается в *crc.
+ */
+int sparse_extract_stream(int in_fd, const struct member_header *member, int out_fd, uint32_t *crc) {
+    unsigned char head[MAP_HEAD_SIZE];
+    size_t count;
+    ssize_t got = read_full(in_fd, head, sizeof(head));
+    if (got == -1) return -1;
+    if (got < (ssize_t)sizeof(head)) {
+        errno = EIO;
+        return -1;
+    }
+    if (map_count(head, member, &count) == -1) return -1;
+    unsigned char *raw = malloc(count ? count * MAP_ENTRY_SIZE : 1);
+    if (raw == NULL) return -1;
+    got = read_full(in_fd, raw, count * MAP_ENTRY_SIZE);
+    struct sparse_map map;
+    int rc = -1;
+    if (got != -1 && (size_t)got < count * MAP_ENTRY_SIZE) {
+        errno = EIO;
+    } else if (got != -1 && map_decode(raw, count, member, &map) == 0) {
+        *crc = crc32c(*crc, head, sizeof(head));
+        *crc = crc32c(*crc, raw, count * MAP_ENTRY_SIZE);
+        rc = ftruncate(out_fd, (off_t)member->size);
+        for (size_t i = 0; rc == 0 && i < map.count; i++) {
+            rc = copy_checksummed(in_fd, -1, out_fd, (off_t)map.extents[i].offset,
+                                  (off_t)map.extents[i].length, crc);
+        }
+        sparse_map_free(&map);
+    }
+    free(raw);
+    return rc;
+}
+
+static int write_zeros(int out_fd, uint64_t length) {
+    static const unsigned char zeros[64 * 1024];
+    while (length > 0) {
+        size_t chunk = length > sizeof(zeros) ? sizeof(zeros) : (size_t)length;
+        if (write_all(out_fd, zeros, chunk) == -1) return -1;
+        length -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Выдаёт в out_fd подряд байты [offset, offset + length) разреженного
+ * члена: дыры — нулями, данные — из экстентов.
+ * Возвращает 0 при успехе, -1 при ошибке.
+ */
+int sparse_read_range(int fd, const struct member_header *member, uint64_t offset, uint64_t length, int out_fd) {
+    struct sparse_map map;
+    if (read_map(fd, member, &map) == -1) return -1;
+    unsigned char *buf = malloc(RANGE_BUFFER_SIZE);
+    if (buf == NULL) {
+        sparse_map_free(&map);
+        return -1;
+    }
+
+    int rc = 0;
+    uint64_t end = offset + length;
+    uint64_t position = offset;
+    off_t source = member_data_offset(member) + (off_t)map_size(map.count);
+    for (size_t i = 0; rc == 0 && i < map.count && position < end; i++) {
+        const struct sparse_extent *extent = &map.extents[i];
+        uint64_t extent_end = extent->offset + extent->length;
+        off_t extent_source = source;
+        source += (off_t)extent->length;
+        if (extent_end <= position) continue;
+        if (extent->offset > position) {
+            uint64_t hole_end = extent->offset < end ? extent->offset : end;
+            rc = write_zeros(out_fd, hole_end - position);
+            position = hole_end;
+        }
+        uint64_t stop = extent_end < end ? extent_end : end;
+        while (rc == 0 && position < stop) {
+            size_t chunk = stop - position > RANGE_BUFFER_SIZE ? RANGE_BUFFER_SIZE : (size_t)(stop - position);
+            rc = pread_all(fd, buf, chunk, extent_source + (off_t)(position - extent->offset));
+            if (rc == 0) rc = write_all(out_fd, buf, chunk);
+            position += chunk;
+        }
+    }
+    if (rc == 0 && position < end) rc = write_zeros(out_fd, end - position);
+    free(buf);
+    sparse_map_free(&map);
+    return rc;
+}
@@ -0,0 +1,275 @@
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Потоковый режим: архив пишется в канал (stdout) и читается из канала
+ * (stdin) за один проход вперёд — без lseek, временных файлов и индекса,
+ * так что архив можно передать через ssh или nc, не сохраняя на диск.
+ *
+ * В поток идут суперблок, записи v2 с контрольными суммами и в конце —
+ * запись фиксации, поэтому сохранённый поток — обычный архив без индекса
+ * (индекс построит первое же добавление в него). Заголовок с суммой данных
+ * стоит перед данными, поэтому файл читается дважды: сначала считается
+ * только сумма, затем данные уходят в поток через движок копирования
+ * (у разреженных файлов — только карта и экстенты, см. sparse.c);
+ * второе чтение обычно обслуживает кэш страниц. Если файл между чтениями
+ * укоротился, запись добивается нулями до объявленной длины: поток не
+ * обрывается, а член не пройдёт сверку суммы при чтении. Сжатие и дедупликация
+ * дописывают заголовки и таблицы задним числом, так что в поток файлы
+ * пишутся как есть.
+ *
+ * При чтении записи разбираются по порядку: данные нужных членов
+ * копируются в файлы со сверкой суммы (разреженные — с дырами на местах),
+ * остальные пропускаются. Сжатые члены и члены со списком чанков из потока
+ * не извлекаются: таблица блоков лежит после блоков, а чанки — в более
+ * ранних записях. Из одноимённых членов, как и при извлечении из файла,
+ * берётся первый, поэтому помнятся имена уже встреченных; кроме них в
+ * памяти только один заголовок, карта экстентов и буфер копирования.
+ */
+
+/* Дописывает в поток length нулевых байт */
+static int write_zeros(int fd, off_t length) {
+    static const char zeros[64 * 1024];
+    while (length > 0) {
+        size_t chunk = length > (off_t)sizeof(zeros) ? sizeof(zeros) : (size_t)length;
+        if (write_all(fd, zeros, chunk) == -1) return -1;
+        length -= (off_t)chunk;
+    }
+    return 0;
+}
+
+/*
+ * Копирует в поток length байт файла in_fd с offset. Если файл укоротился
+ * и данных не хватило, недостающее дописывается нулями (сколько ушло,
+ * говорит позиция в файле: движок копирования её сдвигает).
+ * Возвращает 0 — скопировано целиком, 1 — дополнено нулями, -1 — ошибка.
+ */
+static int stream_copy_extent(int in_fd, off_t offset, int out_fd, off_t length) {
+    if (lseek(in_fd, offset, SEEK_SET) == -1) return -1;
+    if (copy_bytes(in_fd, out_fd, length) == 0) return 0;
+
+    int saved = errno;
+    struct stat st;
+    off_t done = lseek(in_fd, 0, SEEK_CUR) - offset;
+    if (done < 0 || done > length || fstat(in_fd, &st) == -1 || st.st_size >= offset + length) {
+        errno = saved;
+        return -1;
+    }
+    return write_zeros(out_fd, length - done) == -1 ? -1 : 1;
+}
+
+/*
+ * Второй проход по файлу: данные записи (для разреженного — карта holes и
+ * экстенты). Возвращает 0, 1 — файл укоротился и запись дополнена нулями,
+ * -1 — ошибка записи в поток.
+ */
+static int stream_copy_data(int in_fd, const struct sparse_map *holes, int out_fd, uint64_t size) {
+    if (holes == NULL) return stream_copy_extent(in_fd, 0, out_fd, (off_t)size);
+
+    uint32_t crc = 0;
+    if (sparse_write_map(holes, out_fd, -1, &crc) == -1) return -1;
+    int result = 0;
+    for (size_t i = 0; i < holes->count; i++) {
+        int rc = stream_copy_extent(in_fd, (off_t)holes->extents[i].offset, out_fd,
+                                    (off_t)holes->extents[i].length);
+        if (rc == -1) return -1;
+        if (rc == 1) result = 1;
+    }
+    return result;
+}
+
+/*
+ * Пишет в out_fd архив из файлов и каталогов (рекурсивно) paths.
+ * Файлы, которые не удалось прочитать, пропускаются и считаются в *errors;
+ * там же считаются файлы, укоротившиеся во время записи.
+ * Возвращает число записанных файлов или -1, если запись в поток
+ * прервалась (поток тогда оборван и дальше не пишется).
+ */
+long stream_create(int out_fd, char **paths, size_t count, int *errors) {
+    unsigned char buf[MEMBER_HEADER_MAX + COMMIT_DATA_SIZE];
+    archive_encode_superblock(buf);
+    if (write_all(out_fd, buf, ARCHIVE_SUPERBLOCK_SIZE) == -1) return -1;
+
+    /* stdout может быть перенаправлен в файл внутри архивируемого каталога */
+    struct stat out_st;
+    if (fstat(out_fd, &out_st) == -1) return -1;
+
+    struct input_walk *walk = input_walk_start(paths, count);
+    if (walk == NULL) return -1;
+
+    struct input_file file;
+    struct member_header member;
+    off_t offset = ARCHIVE_SUPERBLOCK_SIZE;
+    long written = 0;
+    int failed = 0;
+    *errors = 0;
+    while (!failed && input_walk_next(walk, &file)) {
+        if (file.st.st_dev == out_st.st_dev && file.st.st_ino == out_st.st_ino) {
+            fprintf(stderr, "Инфо: файл '%s' — это сам архив, пропущен.\n", file.name);
+        } else if (member_from_stat(&member, ARCHIVE_VERSION, file.name, &file.st) == -1) {
+            fprintf(stderr, "Ошибка: имя файла '%s' слишком длинное (максимум %d символов)\n",
+                    file.name, MEMBER_NAME_MAX - 1);
+            (*errors)++;
+        } else {
+            /* У файла с дырами в поток идут только карта и экстенты */
+            struct sparse_map holes;
+            int sparse = sparse_scan(file.fd, &file.st, &holes);
+            if (sparse == 1) {
+                member.flags |= MEMBER_SPARSE;
+                member.stored_size = sparse_stored_size(&holes);
+            }
+            if (sparse == -1 ||
+                (sparse ? sparse_write(file.fd, &holes, -1, -1, &member.data_crc)
+                        : copy_checksummed(file.fd, 0, -1, -1, (off_t)member.size, &member.data_crc)) == -1) {
+                fprintf(stderr, "Ошибка: не удалось прочитать файл '%s': %s\n", file.name, strerror(errno));
+                (*errors)++;
+            } else {
+                int copied = -1;
+                member.header_offset = offset;
+                member.header_size = (uint32_t)member_encode(&member, buf);
+                if (write_all(out_fd, buf, member.header_size) == -1 ||
+                    (copied = stream_copy_data(file.fd, sparse ? &holes : NULL, out_fd, member.size)) == -1) {
+                    failed = 1;
+                } else {
+                    offset = member_end(&member);
+                    if (copied == 1) {
+                        fprintf(stderr, "Ошибка: файл '%s' укоротился во время записи, "
+                                        "запись дополнена нулями\n", file.name);
+                        (*errors)++;
+                    } else {
+                        written++;
+                    }
+                }
+            }
+            sparse_map_free(&holes);
+        }
+        close(file.fd);
+        free(file.name);
+    }
+    input_walk_finish(walk);
+    if (failed) return -1;
+
+    size_t length = commit_encode(offset, ARCHIVE_SUPERBLOCK_SIZE, buf);
+    if (write_all(out_fd, buf, length) == -1) return -1;
+    return written;
+}
+
+/* Множество имён с открытой адресацией (ключ — name_hash из index.c) */
+struct name_set {
+    char **slots;
+    size_t capacity;           /* степень двойки */
+    size_t count;
+};
+
+static int name_set_grow(struct name_set *set) {
+    size_t capacity = set->capacity ? set->capacity * 2 : 256;
+    char **slots = calloc(capacity, sizeof(*slots));
+    if (slots == NULL) return -1;
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->slots[i] == NULL) continue;
+        size_t slot = name_hash(set->slots[i]) & (capacity - 1);
+        while (slots[slot] != NULL) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = set->slots[i];
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->capacity = capacity;
+    return 0;
+}
+
+/* Добавляет name; возвращает 1 — добавлено, 0 — уже было, -1 — нет памяти */
+static int name_set_add(struct name_set *set, const char *name) {
+    if ((set->count + 1) * 2 > set->capacity && name_set_grow(set) == -1) return -1;
+    size_t slot = name_hash(name) & (set->capacity - 1);
+    while (set->slots[slot] != NULL) {
+        if (strcmp(set->slots[slot], name) == 0) return 0;
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    if ((set->slots[slot] = strdup(name)) == NULL) return -1;
+    set->count++;
+    return 1;
+}
+
+static void name_set_free(struct name_set *set) {
+    for (size_t i = 0; i < set->capacity; i++) free(set->slots[i]);
+    free(set->slots);
+}
+
+/*
+ * Читает архив из in_fd и извлекает члены, имена которых подходят под
+ * шаблон fnmatch pattern (NULL — все). Из одноимённых членов, как и в
+ * extract_members, извлекается первый, следующие пропускаются. Проблемы
+ * с отдельными членами считаются в *errors. Возвращает число извлечённых
+ * файлов или -1, если поток не удалось дочитать (errno: EINVAL — не архив
+ * v2, EIO — обрыв или повреждённый заголовок).
+ */
+long stream_extract(int in_fd, const char *pattern, int *errors) {
+    *errors = 0;
+    if (archive_read_stream_superblock(in_fd) == -1) return -1;
+
+    struct member_header member;
+    struct name_set seen = { NULL, 0, 0 };
+    off_t offset = ARCHIVE_SUPERBLOCK_SIZE;
+    long extracted = 0;
+    int rc;
+    while ((rc = member_read_stream(in_fd, offset, &member)) == 1) {
+        offset = member_end(&member);
+        int wanted = !(member.flags & (MEMBER_DELETED | MEMBER_INTERNAL)) &&
+                     (pattern == NULL || fnmatch(pattern, member.name, 0) == 0);
+        if (wanted && (wanted = name_set_add(&seen, member.name)) == -1) {
+            rc = -1;
+            break;
+        }
+        if (wanted && !member_name_safe(member.name)) {
+            fprintf(stderr, "Ошибка: '%s': абсолютное имя или '..' в пути, файл не извлекается\n", member.name);
+            (*errors)++;
+            wanted = 0;
+        }
+        if (wanted && (member.flags & (MEMBER_COMPRESSED | MEMBER_CHUNKED))) {
+            fprintf(stderr, "Ошибка: '%s': сжатый или дедуплицированный файл нельзя извлечь из потока\n",
+                    member.name);
+            (*errors)++;
+            wanted = 0;
+        }
+        int out_fd = -1;
+        uint64_t reserve = (member.flags & MEMBER_SPARSE) ? 0 : member.size;
+        if (wanted && (out_fd = member_create_output(member.name, member.mode, reserve)) == -1) {
+            fprintf(stderr, "Ошибка: не удалось создать файл '%s': %s\n", member.name, strerror(errno));
+            (*errors)++;
+        }
+        if (out_fd == -1) {
+            if (skip_bytes(in_fd, (off_t)member.stored_size) == -1) {
+                rc = -1;
+                break;
+            }
+            continue;
+        }
+
+        uint32_t crc = 0;
+        if (((member.flags & MEMBER_SPARSE) ? sparse_extract_stream(in_fd, &member, out_fd, &crc)
+                                            : copy_checksummed(in_fd, -1, out_fd, 0, (off_t)member.size, &crc)) == -1) {
+            int saved = errno;
+            close(out_fd);
+            errno = saved;
+            rc = -1;
+            break;
+        }
+        if ((member.flags & MEMBER_CHECKSUM) && crc != member.data_crc) {
+            fprintf(stderr, "Ошибка: '%s': контрольная сумма данных не совпадает\n", member.name);
+            (*errors)++;
+        }
+        member_restore_metadata(out_fd, &member);
+        close(out_fd);
+        extracted++;
+    }
+    int saved = errno;
+    name_set_free(&seen);
+    errno = saved;
+    return rc == -1 ? -1 : extracted;
+}
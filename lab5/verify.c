@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Проверка целостности архива (--verify).
+ *
+ * Главный поток проходит по цепочке записей: member_read сам проверяет
+ * сумму каждого заголовка, а цепочка обязана ровно дойти до начала индекса.
+ * Данные записей с контрольной суммой режутся на диапазоны, и пул потоков
+ * считает CRC32C диапазонов по отображённому в память архиву; суммы
+ * диапазонов одной записи потом склеиваются crc32c_combine и сравниваются
+ * с суммой из заголовка. Для членов со списком чанков дополнительно
+ * проверяется, что все чанки есть в таблице чанков.
+ */
+
+/* Сколько данных считает одна задача */
+#define VERIFY_RANGE_SIZE (16 * 1024 * 1024)
+
+/* Запись с контрольной суммой */
+struct verify_record {
+    char *name;
+    uint32_t expected;
+    size_t first_task;
+    size_t task_count;
+};
+
+/* Диапазон данных одной записи */
+struct verify_task {
+    uint64_t offset;  /* от начала архива */
+    uint64_t length;
+    uint32_t crc;
+};
+
+struct verify_job {
+    const unsigned char *map;
+    struct verify_task *tasks;
+    size_t task_count;
+    atomic_size_t next_task;
+};
+
+static void *verify_worker(void *arg) {
+    struct verify_job *job = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next_task, 1);
+        if (i >= job->task_count) break;
+        struct verify_task *task = &job->tasks[i];
+        task->crc = crc32c(0, job->map + task->offset, (size_t)task->length);
+    }
+    return NULL;
+}
+
+/* Имя записи для сообщений: у служебных записей своего имени нет */
+static const char *record_name(const struct member_header *member) {
+    if (member->flags & MEMBER_COMMIT) return "(запись фиксации)";
+    return (member->flags & MEMBER_CHUNK_PACK) ? "(пакет чанков)" : member->name;
+}
+
+/*
+ * Проверяет архив пулом из workers потоков (0 — по числу процессоров).
+ * О каждой найденной проблеме пишет в stderr и заполняет result.
+ * Возвращает 0, если проверку удалось провести (даже с найденными
+ * ошибками), -1 при ошибке ввода-вывода или нехватке памяти.
+ */
+int verify_archive(int arch_fd, unsigned workers, struct verify_result *result) {
+    memset(result, 0, sizeof(*result));
+    int version = archive_version(arch_fd);
+    off_t data_end = archive_data_end(arch_fd);
+    if (version == -1 || data_end == -1) return -1;
+    if (version == 0) return 0;
+
+    struct verify_record *records = NULL;
+    size_t record_count = 0, record_capacity = 0;
+    struct verify_job job;
+    memset(&job, 0, sizeof(job));
+    size_t task_capacity = 0;
+    int has_chunked = 0;
+    int rc = 0;
+
+    /* Проход по цепочке заголовков */
+    struct member_header member;
+    off_t offset = archive_records_start(version);
+    while (offset < data_end) {
+        if (member_read(arch_fd, version, offset, &member) == -1) {
+            if (errno != EIO) {
+                rc = -1;
+                break;
+            }
+            fprintf(stderr, "Ошибка: повреждён заголовок записи по смещению %lld, дальше архив не читается\n",
+                    (long long)offset);
+            result->errors++;
+            break;
+        }
+        if (member_end(&member) > data_end) {
+            fprintf(stderr, "Ошибка: '%s': данные выходят за конец области записей\n", record_name(&member));
+            result->errors++;
+            break;
+        }
+        offset = member_end(&member);
+        result->records++;
+        if ((member.flags & MEMBER_CHUNKED) && !(member.flags & MEMBER_DELETED)) has_chunked = 1;
+        if (!(member.flags & MEMBER_CHECKSUM)) {
+            result->unchecked++;
+            continue;
+        }
+
+        if (record_count == record_capacity) {
+            record_capacity = record_capacity ? record_capacity * 2 : 256;
+            struct verify_record *grown = realloc(records, record_capacity * sizeof(*records));
+            if (grown == NULL) {
+                rc = -1;
+                break;
+            }
+            records = grown;
+        }
+        uint64_t parts = member.stored_size ? (member.stored_size + VERIFY_RANGE_SIZE - 1) / VERIFY_RANGE_SIZE : 0;
+        if (job.task_count + parts > task_capacity) {
+            task_capacity = (job.task_count + parts) * 2 + 256;
+            struct verify_task *grown = realloc(job.tasks, task_capacity * sizeof(*job.tasks));
+            if (grown == NULL) {
+                rc = -1;
+                break;
+            }
+            job.tasks = grown;
+        }
+        struct verify_record *record = &records[record_count];
+        if ((record->name = strdup(record_name(&member))) == NULL) {
+            rc = -1;
+            break;
+        }
+        record->expected = member.data_crc;
+        record->first_task = job.task_count;
+        record->task_count = (size_t)parts;
+        record_count++;
+        for (uint64_t p = 0; p < parts; p++) {
+            struct verify_task *task = &job.tasks[job.task_count++];
+            task->offset = (uint64_t)member_data_offset(&member) + p * VERIFY_RANGE_SIZE;
+            task->length = member.stored_size - p * VERIFY_RANGE_SIZE;
+            if (task->length > VERIFY_RANGE_SIZE) task->length = VERIFY_RANGE_SIZE;
+            result->bytes += task->length;
+        }
+    }
+    if (rc == 0 && offset < data_end && result->errors == 0) {
+        errno = EIO;
+        rc = -1;
+    }
+
+    /* Данные: пул потоков по отображённому архиву */
+    void *map = MAP_FAILED;
+    if (rc == 0 && job.task_count > 0) {
+        map = mmap(NULL, (size_t)data_end, PROT_READ, MAP_SHARED, arch_fd, 0);
+        if (map == MAP_FAILED) {
+            rc = -1;
+        } else {
+            (void)madvise(map, (size_t)data_end, MADV_SEQUENTIAL);
+            job.map = map;
+            if (workers == 0) {
+                long online = sysconf(_SC_NPROCESSORS_ONLN);
+                workers = online > 0 ? (unsigned)online : 1;
+            }
+            if (workers > job.task_count) workers = (unsigned)job.task_count;
+            pthread_t *threads = calloc(workers, sizeof(*threads));
+            unsigned started = 0;
+            if (threads != NULL) {
+                /* Вызывающий поток тоже считает, поэтому запускаем на один меньше */
+                for (; started + 1 < workers; started++) {
+                    if (pthread_create(&threads[started], NULL, verify_worker, &job) != 0) break;
+                }
+            }
+            verify_worker(&job);
+            for (unsigned i = 0; i < started; i++) pthread_join(threads[i], NULL);
+            free(threads);
+        }
+    }
+
+    for (size_t i = 0; rc == 0 && i < record_count; i++) {
+        struct verify_record *record = &records[i];
+        uint32_t crc = 0;
+        for (size_t t = 0; t < record->task_count; t++) {
+            const struct verify_task *task = &job.tasks[record->first_task + t];
+            crc = crc32c_combine(crc, task->crc, task->length);
+        }
+        if (crc != record->expected) {
+            fprintf(stderr, "Ошибка: '%s': контрольная сумма данных не совпадает\n", record->name);
+            result->errors++;
+        }
+    }
+    if (map != MAP_FAILED) munmap(map, (size_t)data_end);
+    for (size_t i = 0; i < record_count; i++) free(records[i].name);
+    free(records);
+    free(job.tasks);
+
+    /* Ссылки членов со списком чанков */
+    if (rc == 0 && has_chunked && result->errors == 0) {
+        struct chunk_store chunks;
+        memset(&chunks, 0, sizeof(chunks));
+        rc = chunk_store_load(arch_fd, &chunks);
+        offset = archive_records_start(version);
+        while (rc == 0 && offset < data_end) {
+            if (member_read(arch_fd, version, offset, &member) == -1) {
+                rc = -1;
+                break;
+            }
+            offset = member_end(&member);
+            if (!(member.flags & MEMBER_CHUNKED) || (member.flags & MEMBER_DELETED)) continue;
+            if (chunked_check(arch_fd, &chunks, &member) == -1) {
+                if (errno != EIO) {
+                    rc = -1;
+                    break;
+                }
+                fprintf(stderr, "Ошибка: '%s': в архиве нет чанков, на которые ссылается файл\n", member.name);
+                result->errors++;
+            }
+        }
+        chunk_store_free(&chunks);
+    }
+    return rc;
+}
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archiver.h"
+
+/*
+ * Обход входных путей в отдельном потоке. Поток-читатель открывает файлы,
+ * снимает с них stat и кладёт в ограниченную очередь, а поток-писатель
+ * (вызывающий) забирает их и пишет в архив — чтение каталогов и открытие
+ * файлов идут параллельно с записью данных. Каталоги обходятся в глубину,
+ * имена внутри каталога сортируются, поэтому порядок членов архива не
+ * зависит от порядка, который выдаёт readdir.
+ */
+
+#define WALK_QUEUE_SIZE 64
+
+struct input_walk {
+    char **paths;
+    size_t count;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    struct input_file queue[WALK_QUEUE_SIZE];
+    size_t head;
+    size_t length;
+    int done;       /* читатель закончил */
+    int cancelled;  /* писатель больше не берёт файлы */
+    int errors;
+};
+
+/* Кладёт файл в очередь; возвращает -1, если писатель уже ушёл */
+static int walk_push(struct input_walk *walk, struct input_file *file) {
+    pthread_mutex_lock(&walk->lock);
+    while (walk->length == WALK_QUEUE_SIZE && !walk->cancelled) {
+        pthread_cond_wait(&walk->not_full, &walk->lock);
+    }
+    if (walk->cancelled) {
+        pthread_mutex_unlock(&walk->lock);
+        return -1;
+    }
+    walk->queue[(walk->head + walk->length) % WALK_QUEUE_SIZE] = *file;
+    walk->length++;
+    pthread_cond_signal(&walk->not_empty);
+    pthread_mutex_unlock(&walk->lock);
+    return 0;
+}
+
+static void walk_error(struct input_walk *walk, const char *path) {
+    fprintf(stderr, "Ошибка: '%s': %s\n", path, strerror(errno));
+    pthread_mutex_lock(&walk->lock);
+    walk->errors++;
+    pthread_mutex_unlock(&walk->lock);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int walk_path(struct input_walk *walk, const char *path, int top_level);
+
+/* Обходит каталог path: сначала читает и сортирует имена, затем спускается */
+static int walk_directory(struct input_walk *walk, const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        walk_error(walk, path);
+        return 0;
+    }
+
+    char **names = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *entry;
+    errno = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            char **grown = realloc(names, capacity * sizeof(*names));
+            if (grown == NULL) break;
+            names = grown;
+        }
+        if ((names[count] = strdup(entry->d_name)) == NULL) break;
+        count++;
+        errno = 0;
+    }
+    if (errno != 0) {
+        walk_error(walk, path);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(*names), compare_names);
+
+    int rc = 0;
+    size_t prefix = strlen(path);
+    while (prefix > 1 && path[prefix - 1] == '/') prefix--;
+    for (size_t i = 0; i < count; i++) {
+        if (rc == 0) {
+            char *child = malloc(prefix + strlen(names[i]) + 2);
+            if (child == NULL) {
+                walk_error(walk, path);
+            } else {
+                sprintf(child, "%.*s/%s", (int)prefix, path, names[i]);
+                rc = walk_path(walk, child, 0);
+                free(child);
+            }
+        }
+        free(names[i]);
+    }
+    free(names);
+    return rc;
+}
+
+/*
+ * Обрабатывает один путь: каталог — рекурсивно, обычный файл — в очередь.
+ * Символические ссылки явно указанных путей разыменовываются, найденные
+ * внутри каталогов — пропускаются, как и прочие специальные файлы.
+ * Возвращает -1, если писатель прекратил работу.
+ */
+static int walk_path(struct input_walk *walk, const char *path, int top_level) {
+    struct stat st;
+    if (fstatat(AT_FDCWD, path, &st, top_level ? 0 : AT_SYMLINK_NOFOLLOW) == -1) {
+        walk_error(walk, path);
+        return 0;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return walk_directory(walk, path);
+    }
+    if (!S_ISREG(st.st_mode) && !top_level) {
+        return 0;
+    }
+
+    struct input_file file;
+    file.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (file.fd == -1) {
+        walk_error(walk, path);
+        return 0;
+    }
+    if (fstat(file.fd, &file.st) == -1 || (file.name = strdup(path)) == NULL) {
+        walk_error(walk, path);
+        close(file.fd);
+        return 0;
+    }
+    if (walk_push(walk, &file) == -1) {
+        free(file.name);
+        close(file.fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void *walk_thread(void *arg) {
+    struct input_walk *walk = arg;
+    for (size_t i = 0; i < walk->count; i++) {
+        if (walk_path(walk, walk->paths[i], 1) == -1) break;
+    }
+    pthread_mutex_lock(&walk->lock);
+    walk->done = 1;
+    pthread_cond_signal(&walk->not_empty);
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+/*
+ * Запускает поток-читатель по списку путей.
+ * Возвращает NULL при ошибке (errno выставлен).
+ */
+struct input_walk *input_walk_start(char **paths, size_t count) {
+    struct input_walk *walk = calloc(1, sizeof(*walk));
+    if (walk == NULL) return NULL;
+    walk->paths = paths;
+    walk->count = count;
+    pthread_mutex_init(&walk->lock, NULL);
+    pthread_cond_init(&walk->not_empty, NULL);
+    pthread_cond_init(&walk->not_full, NULL);
+
+    int rc = pthread_create(&walk->thread, NULL, walk_thread, walk);
+    if (rc != 0) {
+        pthread_mutex_destroy(&walk->lock);
+        pthread_cond_destroy(&walk->not_empty);
+        pthread_cond_destroy(&walk->not_full);
+        free(walk);
+        errno = rc;
+        return NULL;
+    }
+    return walk;
+}
+
+/*
+ * Забирает следующий файл в порядке обхода. Возвращает 1, если файл получен
+ * (вызывающий закрывает fd и освобождает name), 0 — если файлы кончились.
+ */
+int input_walk_next(struct input_walk *walk, struct input_file *file) {
+    pthread_mutex_lock(&walk->lock);
+    while (walk->length == 0 && !walk->done) {
+        pthread_cond_wait(&walk->not_empty, &walk->lock);
+    }
+    if (walk->length == 0) {
+        pthread_mutex_unlock(&walk->lock);
+        return 0;
+    }
+    *file = walk->queue[walk->head];
+    walk->head = (walk->head + 1) % WALK_QUEUE_SIZE;
+    walk->length--;
+    pthread_cond_signal(&walk->not_full);
+    pthread_mutex_unlock(&walk->lock);
+    return 1;
+}
+
+/*
+ * Останавливает читателя, закрывает невостребованные файлы и освобождает
+ * очередь. Возвращает число путей, которые не удалось прочитать.
+ */
+int input_walk_finish(struct input_walk *walk) {
+    pthread_mutex_lock(&walk->lock);
+    walk->cancelled = 1;
+    pthread_cond_signal(&walk->not_full);
+    pthread_mutex_unlock(&walk->lock);
+    pthread_join(walk->thread, NULL);
+
+    while (walk->length > 0) {
+        struct input_file *file = &walk->queue[walk->head];
+        close(file->fd);
+        free(file->name);
+        walk->head = (walk->head + 1) % WALK_QUEUE_SIZE;
+        walk->length--;
+    }
+
+    int errors = walk->errors;
+    pthread_mutex_destroy(&walk->lock);
+    pthread_cond_destroy(&walk->not_empty);
+    pthread_cond_destroy(&walk->not_full);
+    free(walk);
+    return errors;
+}
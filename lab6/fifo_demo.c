@@ -8,6 +8,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/wait.h>
+
+#include "frame.h"
 
 // Объявления функций из utils.c
 extern void format_time(time_t t, char *buf, size_t bufsz);
@@ -41,8 +46,10 @@ void run_fifo_writer(void) {
         exit(EXIT_FAILURE);
     }
 
-    ssize_t w = write(fd, out, (size_t)written);
-    if (w == -1) {
+    // Один кадр не длиннее PIPE_BUF уходит атомарно даже при нескольких писателях
+    struct frame_batch batch;
+    frame_batch_init(&batch, fd, PIPE_BUF);
+    if (frame_batch_add(&batch, out, (uint32_t)written) == -1 || frame_batch_flush(&batch) == -1) {
         perror("fifo writer: write");
         close(fd);
         exit(EXIT_FAILURE);
@@ -66,20 +73,40 @@ void run_fifo_reader(void) {
     int fd = open(fifo, O_RDONLY);
     if (fd == -1) die("fifo reader: open O_RDONLY");
 
+    // Разбираем кадры до EOF: сообщение может прийти несколькими read
+    struct frame_ring ring;
+    if (frame_ring_init(&ring, 0) == -1) die("fifo reader: malloc");
     char buf[512];
-    ssize_t r = read(fd, buf, sizeof(buf)-1);
-    if (r == -1) {
-        perror("fifo reader: read");
-        close(fd);
-        exit(EXIT_FAILURE);
-    }
-    if (r == 0) {
-        buf[0] = '\0';
-        close(fd);
-    } else {
-        buf[r] = '\0';
-        close(fd);
+    buf[0] = '\0';
+    int frames = 0;
+    for (;;) {
+        const char *payload;
+        uint32_t length;
+        int got = frame_ring_next(&ring, &payload, &length);
+        if (got == -1) {
+            perror("fifo reader: bad frame");
+            break;
+        }
+        if (got == 1) {
+            if (frames++ == 0) {
+                size_t n = length < sizeof(buf) - 1 ? length : sizeof(buf) - 1;
+                memcpy(buf, payload, n);
+                buf[n] = '\0';
+            }
+            continue;
+        }
+        ssize_t r = frame_ring_fill(&ring, fd);
+        if (r == -1) {
+            perror("fifo reader: read");
+            frame_ring_free(&ring);
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+        if (r == 0) break;
     }
+    if (ring.head != ring.tail) fprintf(stderr, "fifo reader: incomplete frame at EOF\n");
+    frame_ring_free(&ring);
+    close(fd);
 
     // Ждем 11 секунд перед выводом
     const unsigned int SLEEP_SECONDS = 11;
@@ -102,3 +129,209 @@ void run_fifo_reader(void) {
     }
 }
 
+/* ========== Бенчмарк кадрового протокола ========== */
+
+#define BENCH_PAYLOAD 64
+
+// Сообщение бенчмарка; sent_ns — момент создания, до попадания в пакет
+struct bench_message {
+    uint32_t writer;
+    uint32_t seq;
+    uint64_t sent_ns;
+    char pad[BENCH_PAYLOAD - 16];
+};
+
+struct bench_result {
+    double seconds;
+    unsigned long long messages;
+    unsigned long long reads;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Писатель бенчмарка (дочерний процесс): открывает FIFO, отмечается в
+ * ready_fd, ждёт общего старта (EOF в go_fd) и шлёт messages кадров пакетами
+ */
+static void bench_writer(const char *fifo, uint32_t id, long messages, size_t limit, int ready_fd, int go_fd) {
+    int fd = open(fifo, O_WRONLY);
+    if (fd == -1) die("bench writer: open O_WRONLY");
+    if (write(ready_fd, "r", 1) != 1) die("bench writer: ready");
+    close(ready_fd);
+    char c;
+    while (read(go_fd, &c, 1) == -1 && errno == EINTR) {
+    }
+    close(go_fd);
+
+    // Пакет ссылается на сообщения до отправки: в пакете их не больше
+    // FRAME_BATCH_MAX_FRAMES, поэтому слот с номером seq по модулю
+    // FRAME_BATCH_MAX_FRAMES + 1 не занят ожидающим кадром
+    static struct bench_message slots[FRAME_BATCH_MAX_FRAMES + 1];
+    struct frame_batch batch;
+    frame_batch_init(&batch, fd, limit);
+    for (long seq = 0; seq < messages; seq++) {
+        struct bench_message *m = &slots[seq % (FRAME_BATCH_MAX_FRAMES + 1)];
+        m->writer = id;
+        m->seq = (uint32_t)seq;
+        m->sent_ns = now_ns();
+        if (frame_batch_add(&batch, m, sizeof(*m)) == -1) die("bench writer: writev");
+    }
+    if (frame_batch_flush(&batch) == -1) die("bench writer: writev");
+    close(fd);
+    _exit(EXIT_SUCCESS);
+}
+
+/**
+ * Один прогон: writers писателей одновременно шлют по messages сообщений,
+ * родитель разбирает кадры и проверяет порядок номеров каждого писателя
+ * @return 0 при успехе, -1 если поток испорчен или сообщения потерялись
+ */
+static int bench_round(const char *fifo, int writers, long messages, size_t limit, struct bench_result *res) {
+    int ready[2], go[2];
+    if (pipe(ready) == -1 || pipe(go) == -1) die("pipe");
+    pid_t *pids = calloc((size_t)writers, sizeof(*pids));
+    uint32_t *next_seq = calloc((size_t)writers, sizeof(*next_seq));
+    unsigned long long expected = (unsigned long long)writers * (unsigned long long)messages;
+    uint64_t *latencies = malloc((expected ? expected : 1) * sizeof(*latencies));
+    if (pids == NULL || next_seq == NULL || latencies == NULL) die("malloc");
+
+    for (int i = 0; i < writers; i++) {
+        pids[i] = fork();
+        if (pids[i] == -1) die("fork");
+        if (pids[i] == 0) {
+            close(ready[0]);
+            close(go[1]);
+            bench_writer(fifo, (uint32_t)i, messages, limit, ready[1], go[0]);
+        }
+    }
+    close(ready[1]);
+    close(go[0]);
+
+    // Открытие ждёт первого писателя; старт — когда открыли все
+    int fd = open(fifo, O_RDONLY);
+    if (fd == -1) die("bench reader: open O_RDONLY");
+    for (int i = 0; i < writers; i++) {
+        char c;
+        if (read(ready[0], &c, 1) != 1) die("bench reader: writer did not start");
+    }
+    close(ready[0]);
+
+    struct frame_ring ring;
+    if (frame_ring_init(&ring, 1024 * 1024) == -1) die("malloc");
+    uint64_t started = now_ns();
+    close(go[1]);
+
+    int ok = 1;
+    res->messages = 0;
+    res->reads = 0;
+    while (ok) {
+        const char *payload;
+        uint32_t length;
+        int got = frame_ring_next(&ring, &payload, &length);
+        if (got == 1) {
+            struct bench_message m;
+            if (length != sizeof(m)) {
+                fprintf(stderr, "bench reader: frame of %u bytes\n", length);
+                ok = 0;
+                break;
+            }
+            memcpy(&m, payload, sizeof(m));
+            if (m.writer >= (uint32_t)writers || m.seq != next_seq[m.writer] || res->messages >= expected) {
+                fprintf(stderr, "bench reader: unexpected message %u from writer %u\n", m.seq, m.writer);
+                ok = 0;
+                break;
+            }
+            next_seq[m.writer]++;
+            latencies[res->messages++] = now_ns() - m.sent_ns;
+            continue;
+        }
+        if (got == -1) {
+            perror("bench reader: bad frame");
+            ok = 0;
+            break;
+        }
+        ssize_t r = frame_ring_fill(&ring, fd);
+        if (r == -1) die("bench reader: read");
+        if (r == 0) break;
+        res->reads++;
+    }
+    res->seconds = (double)(now_ns() - started) / 1e9;
+    frame_ring_free(&ring);
+    close(fd);
+
+    for (int i = 0; i < writers; i++) {
+        int status = 0;
+        if (waitpid(pids[i], &status, 0) == -1) die("waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) ok = 0;
+    }
+    if (ok && res->messages != expected) {
+        fprintf(stderr, "bench reader: got %llu of %llu messages\n", res->messages, expected);
+        ok = 0;
+    }
+    if (ok && expected > 0) {
+        qsort(latencies, res->messages, sizeof(*latencies), compare_u64);
+        res->p50_ns = latencies[(res->messages - 1) * 50 / 100];
+        res->p99_ns = latencies[(res->messages - 1) * 99 / 100];
+    }
+    free(pids);
+    free(next_seq);
+    free(latencies);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Бенчмарк кадрового протокола поверх FIFO: для 1..max_writers писателей
+ * сравнивает запись по кадру на writev с пакетами до batch_limit байт
+ * @param max_writers - наибольшее число одновременных писателей
+ * @param messages - сообщений от каждого писателя
+ * @param batch_limit - предел пакета в байтах; больше PIPE_BUF — только
+ *                      для одного писателя, иначе кадры перемешаются
+ */
+void run_fifo_bench(int max_writers, long messages, size_t batch_limit) {
+    const char *fifo = make_fifo_path();
+    if (mkfifo(fifo, 0666) == -1) {
+        if (errno != EEXIST) die("mkfifo (bench)");
+    }
+
+    printf("### FIFO framed benchmark ###\n");
+    printf("Messages per writer: %ld, payload: %zu bytes, batch limit: %zu bytes, PIPE_BUF: %d\n",
+           messages, sizeof(struct bench_message), batch_limit, PIPE_BUF);
+    printf("%7s %7s %12s %8s %10s %10s\n", "writers", "batch", "msg/s", "reads", "p50 us", "p99 us");
+
+    for (int writers = 1; writers <= max_writers; writers++) {
+        size_t limits[2] = { FRAME_HEADER_SIZE + sizeof(struct bench_message), batch_limit };
+        if (writers > 1 && limits[1] > PIPE_BUF) limits[1] = PIPE_BUF;
+        if (limits[1] < limits[0]) limits[1] = limits[0];
+        for (int b = 0; b < 2; b++) {
+            struct bench_result res;
+            if (bench_round(fifo, writers, messages, limits[b], &res) == -1) {
+                fprintf(stderr, "fifo bench: round with %d writers failed\n", writers);
+                unlink(fifo);
+                exit(EXIT_FAILURE);
+            }
+            char batch_name[32];
+            if (b == 0) snprintf(batch_name, sizeof(batch_name), "single");
+            else snprintf(batch_name, sizeof(batch_name), "%zu", limits[1]);
+            printf("%7d %7s %12.0f %8llu %10.1f %10.1f\n", writers, batch_name,
+                   res.seconds > 0 ? (double)res.messages / res.seconds : 0.0, res.reads,
+                   (double)res.p50_ns / 1000.0, (double)res.p99_ns / 1000.0);
+        }
+    }
+
+    if (unlink(fifo) == -1) {
+        if (errno != ENOENT) {
+            perror("unlink fifo");
+        }
+    }
+}
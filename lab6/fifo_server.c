@@ -0,0 +1,175 @@
+//#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "frame.h"
+
+// Объявления функций из utils.c
+extern const char *make_fifo_path(void);
+
+/*
+ * Долгоживущий читатель FIFO. Канал открыт O_RDWR: сервер сам числится
+ * писателем, поэтому уход последнего клиента не даёт EOF и канал не
+ * приходится переоткрывать. Чтение неблокирующее, его будит epoll.
+ * Кадры до PIPE_BUF приходят от каждого писателя целиком, так что разбор
+ * общего потока сам разделяет их по отправителям; обработчик получает
+ * указатель прямо в кольцевой буфер — на сообщение ничего не выделяется.
+ * Целыми приходят только кадры до PIPE_BUF, поэтому более длинные сервер
+ * считает испорченными. Испорченный кадр (чужой писатель, мусор в канале)
+ * пропускается до следующей метки FRAME_MAGIC — один плохой клиент не
+ * останавливает сервер и не сбивает разбор кадров остальных.
+ */
+
+/**
+ * Вычитывает из fd всё доступное, передавая целые кадры обработчику
+ * @return 0 — данные кончились (EAGAIN), -1 — ошибка чтения
+ */
+static int drain_fifo(int fd, struct frame_ring *ring, frame_handler handler, void *ctx,
+                      struct fifo_server_stats *stats) {
+    for (;;) {
+        const char *payload;
+        uint32_t length;
+        int got;
+        while ((got = frame_ring_next(ring, &payload, &length)) == 1) {
+            stats->frames++;
+            stats->bytes += length;
+            handler(payload, length, ctx);
+        }
+        if (got == -1) {
+            size_t skipped = frame_ring_resync(ring);
+            fprintf(stderr, "fifo server: bad frame, skipped %zu bytes\n", skipped);
+            stats->dropped++;
+            stats->skipped += skipped;
+            continue;
+        }
+
+        ssize_t r = frame_ring_fill(ring, fd);
+        if (r > 0) {
+            stats->reads++;
+            continue;
+        }
+        if (r == 0 || errno == EAGAIN) return 0;
+        return -1;
+    }
+}
+
+/**
+ * Обслуживает FIFO path до SIGINT или SIGTERM, передавая каждый кадр
+ * handler(payload, length, ctx). payload действителен только на время вызова.
+ * @return 0 при остановке сигналом, -1 при ошибке
+ */
+int fifo_serve(const char *path, frame_handler handler, void *ctx, struct fifo_server_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (mkfifo(path, 0666) == -1 && errno != EEXIST) {
+        perror("mkfifo (server)");
+        return -1;
+    }
+
+    // Сигналы остановки приходят через signalfd в тот же epoll
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("sigprocmask");
+        return -1;
+    }
+
+    int result = -1;
+    int fd = open(path, O_RDWR | O_NONBLOCK);
+    int sig_fd = signalfd(-1, &mask, SFD_NONBLOCK);
+    int epoll_fd = epoll_create1(0);
+    struct frame_ring ring = { 0 };
+    if (fd == -1 || sig_fd == -1 || epoll_fd == -1) {
+        perror("fifo server: setup");
+        goto out;
+    }
+    if (frame_ring_init(&ring, 1024 * 1024) == -1) {
+        perror("fifo server: malloc");
+        goto out;
+    }
+    ring.max_payload = PIPE_BUF - FRAME_HEADER_SIZE;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    struct epoll_event sig_ev = { .events = EPOLLIN, .data.fd = sig_fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sig_fd, &sig_ev) == -1) {
+        perror("epoll_ctl");
+        goto out;
+    }
+
+    for (;;) {
+        struct epoll_event events[2];
+        int n = epoll_wait(epoll_fd, events, 2, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            goto out;
+        }
+        stats->wakeups++;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == sig_fd) {
+                // Забираем сигнал, иначе снятие блокировки при выходе доставит его снова
+                struct signalfd_siginfo info;
+                if (read(sig_fd, &info, sizeof(info)) != sizeof(info)) continue;
+                // Перед остановкой дочитываем то, что уже в канале
+                if (drain_fifo(fd, &ring, handler, ctx, stats) == -1) perror("fifo server: read");
+                result = 0;
+                goto out;
+            }
+            if (drain_fifo(fd, &ring, handler, ctx, stats) == -1) {
+                perror("fifo server: read");
+                goto out;
+            }
+        }
+    }
+
+out:
+    if (ring.head != ring.tail) fprintf(stderr, "fifo server: %zu bytes of an incomplete frame left\n",
+                                        ring.head - ring.tail);
+    frame_ring_free(&ring);
+    if (epoll_fd != -1) close(epoll_fd);
+    if (sig_fd != -1) close(sig_fd);
+    if (fd != -1) close(fd);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    return result;
+}
+
+// Демонстрационный обработчик: печатает сообщение строкой
+static void print_frame(const char *payload, uint32_t length, void *ctx) {
+    (void)ctx;
+    if (length > 0 && payload[length - 1] == '\n') length--;
+    printf("fifo-server: %.*s\n", (int)length, payload);
+}
+
+/**
+ * Сервер FIFO для демонстрации: печатает кадры от любых писателей
+ * (например, нескольких fifo-writer) до Ctrl+C, затем итоги
+ */
+void run_fifo_server(void) {
+    const char *fifo = make_fifo_path();
+    printf("fifo-server: listening on %s (Ctrl+C to stop)\n", fifo);
+    fflush(stdout);
+
+    struct fifo_server_stats stats;
+    int rc = fifo_serve(fifo, print_frame, NULL, &stats);
+    printf("fifo-server: %llu frames, %llu bytes, %llu reads, %llu wakeups, %llu dropped (%llu bytes skipped)\n",
+           stats.frames, stats.bytes, stats.reads, stats.wakeups, stats.dropped, stats.skipped);
+
+    if (unlink(fifo) == -1) {
+        if (errno != ENOENT) {
+            perror("unlink fifo");
+        }
+    }
+    if (rc == -1) exit(EXIT_FAILURE);
+}
@@ -0,0 +1,224 @@
+//#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "frame.h"
+
+/**
+ * Контрольная сумма кадра: FNV-1a по длине и данным. Ловит испорченную
+ * длину и чужие байты, попавшие в кадр; от намеренной подделки не защищает.
+ */
+uint32_t frame_checksum(const void *payload, uint32_t length) {
+    uint32_t hash = 2166136261u;
+    const unsigned char *len_bytes = (const unsigned char *)&length;
+    for (size_t i = 0; i < sizeof(length); i++) {
+        hash = (hash ^ len_bytes[i]) * 16777619u;
+    }
+    const unsigned char *bytes = payload;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* ========== Писатель: пакеты кадров через writev ========== */
+
+/**
+ * Готовит пустой пакет
+ * @param limit - предел байт в одном writev, он же предел одного кадра с
+ *                заголовком; PIPE_BUF сохраняет атомарность
+ */
+void frame_batch_init(struct frame_batch *batch, int fd, size_t limit) {
+    batch->fd = fd;
+    batch->limit = limit;
+    batch->bytes = 0;
+    batch->count = 0;
+    batch->writes = 0;
+}
+
+/**
+ * Отправляет накопленные кадры одним writev; недописанный хвост
+ * (после сигнала) дописывается следующими вызовами
+ * @return 0 при успехе, -1 при ошибке (errno сохранён)
+ */
+int frame_batch_flush(struct frame_batch *batch) {
+    struct iovec *iov = batch->iov;
+    int iovcnt = 2 * batch->count;
+    while (iovcnt > 0) {
+        ssize_t n = writev(batch->fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        batch->writes++;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    batch->bytes = 0;
+    batch->count = 0;
+    return 0;
+}
+
+/**
+ * Добавляет кадр в пакет. Если кадр не помещается в предел, сначала
+ * отправляется то, что накоплено; заполненный пакет отправляется сразу.
+ * Кадр длиннее предела не принимается: одиночным writev он превысил бы
+ * PIPE_BUF и перемешался бы с кадрами других писателей.
+ * @return 0 при успехе, -1 при ошибке (EMSGSIZE — кадр не помещается в предел
+ *         или длиннее FRAME_MAX_PAYLOAD)
+ */
+int frame_batch_add(struct frame_batch *batch, const void *payload, uint32_t length) {
+    size_t size = FRAME_HEADER_SIZE + (size_t)length;
+    if (length > FRAME_MAX_PAYLOAD || size > batch->limit) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (batch->count > 0 && (batch->bytes + size > batch->limit || batch->count == FRAME_BATCH_MAX_FRAMES)) {
+        if (frame_batch_flush(batch) == -1) return -1;
+    }
+
+    int i = batch->count++;
+    batch->headers[i] = (struct frame_header){ FRAME_MAGIC, length, frame_checksum(payload, length) };
+    batch->iov[2 * i].iov_base = &batch->headers[i];
+    batch->iov[2 * i].iov_len = FRAME_HEADER_SIZE;
+    batch->iov[2 * i + 1].iov_base = (void *)payload;
+    batch->iov[2 * i + 1].iov_len = length;
+    batch->bytes += size;
+
+    if (batch->bytes >= batch->limit) return frame_batch_flush(batch);
+    return 0;
+}
+
+/* ========== Читатель: разбор кадров из кольцевого буфера ========== */
+
+/**
+ * Выделяет буфер не меньше capacity байт (с округлением до степени двойки)
+ * и не меньше одного кадра максимальной длины
+ * @return 0 при успехе, -1 при нехватке памяти
+ */
+int frame_ring_init(struct frame_ring *ring, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity || size < FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD) size <<= 1;
+    ring->data = malloc(size);
+    ring->scratch = malloc(FRAME_MAX_PAYLOAD);
+    if (ring->data == NULL || ring->scratch == NULL) {
+        frame_ring_free(ring);
+        return -1;
+    }
+    ring->capacity = size;
+    ring->max_payload = FRAME_MAX_PAYLOAD;
+    ring->head = 0;
+    ring->tail = 0;
+    return 0;
+}
+
+void frame_ring_free(struct frame_ring *ring) {
+    free(ring->data);
+    free(ring->scratch);
+    ring->data = NULL;
+    ring->scratch = NULL;
+}
+
+/**
+ * Дочитывает из fd в свободное место буфера (одним readv на оба куска
+ * у края). Если буфер полон, в нём уже лежит целый кадр — сначала
+ * его нужно разобрать.
+ * @return результат readv; -1 с ENOBUFS, если места нет
+ */
+ssize_t frame_ring_fill(struct frame_ring *ring, int fd) {
+    size_t used = ring->head - ring->tail;
+    size_t free_bytes = ring->capacity - used;
+    if (free_bytes == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    size_t pos = ring->head & (ring->capacity - 1);
+    size_t first = ring->capacity - pos < free_bytes ? ring->capacity - pos : free_bytes;
+    struct iovec iov[2] = {
+        { ring->data + pos, first },
+        { ring->data, free_bytes - first },
+    };
+    ssize_t n;
+    do {
+        n = readv(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+    } while (n == -1 && errno == EINTR);
+    if (n > 0) ring->head += (size_t)n;
+    return n;
+}
+
+// Копирует length байт буфера с позиции-счётчика from, учитывая край
+static void ring_copy(const struct frame_ring *ring, size_t from, void *out, size_t length) {
+    size_t pos = from & (ring->capacity - 1);
+    size_t first = ring->capacity - pos < length ? ring->capacity - pos : length;
+    memcpy(out, ring->data + pos, first);
+    memcpy((char *)out + first, ring->data, length - first);
+}
+
+/**
+ * Извлекает следующий целый кадр. payload указывает в буфер (или в
+ * scratch, если кадр разрезан краем) и действителен до следующего
+ * вызова frame_ring_fill или frame_ring_next.
+ * @return 1 — кадр есть, 0 — нужно дочитать, -1 — нет метки, длина больше
+ *         max_payload или не сошлась сумма (EBADMSG); кадр остаётся в
+ *         буфере, пропустить его можно frame_ring_resync
+ */
+int frame_ring_next(struct frame_ring *ring, const char **payload, uint32_t *length) {
+    size_t used = ring->head - ring->tail;
+    if (used < FRAME_HEADER_SIZE) return 0;
+    struct frame_header header;
+    ring_copy(ring, ring->tail, &header, FRAME_HEADER_SIZE);
+    if (header.magic != FRAME_MAGIC || header.length > ring->max_payload) {
+        errno = EBADMSG;
+        return -1;
+    }
+    uint32_t len = header.length;
+    if (used < FRAME_HEADER_SIZE + (size_t)len) return 0;
+
+    size_t start = ring->tail + FRAME_HEADER_SIZE;
+    size_t pos = start & (ring->capacity - 1);
+    const char *data;
+    if (pos + len <= ring->capacity) {
+        data = ring->data + pos;
+    } else {
+        ring_copy(ring, start, ring->scratch, len);
+        data = ring->scratch;
+    }
+    if (frame_checksum(data, len) != header.checksum) {
+        errno = EBADMSG;
+        return -1;
+    }
+    *payload = data;
+    *length = len;
+    ring->tail = start + len;
+    return 1;
+}
+
+/**
+ * Пропускает испорченный кадр: сдвигается хотя бы на байт и дальше до
+ * ближайшей метки FRAME_MAGIC. Кадры целых писателей не длиннее PIPE_BUF
+ * лежат в потоке непрерывно, поэтому следующий из них будет найден; ложную
+ * метку внутри мусора отвергнет контрольная сумма.
+ * @return число пропущенных байт
+ */
+size_t frame_ring_resync(struct frame_ring *ring) {
+    size_t start = ring->tail;
+    if (ring->tail == ring->head) return 0;
+    ring->tail++;
+    while (ring->head - ring->tail >= sizeof(uint32_t)) {
+        uint32_t word;
+        ring_copy(ring, ring->tail, &word, sizeof(word));
+        if (word == FRAME_MAGIC) break;
+        ring->tail++;
+    }
+    return ring->tail - start;
+}
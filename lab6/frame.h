@@ -0,0 +1,84 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Кадр: заголовок struct frame_header (порядок байт хоста — канал
+ * локальный), затем сами данные. Метка FRAME_MAGIC и контрольная сумма
+ * длины и данных позволяют читателю отвергнуть испорченный кадр и найти
+ * начало следующего (frame_ring_resync). Кадры от нескольких писателей не
+ * перемешиваются, пока каждый writev пакета не больше PIPE_BUF: при пределе
+ * пакета PIPE_BUF кадр длиннее PIPE_BUF - FRAME_HEADER_SIZE отвергается
+ * с EMSGSIZE. Предел больше PIPE_BUF допустим только для одного писателя.
+ */
+#define FRAME_MAGIC 0x4d524621u
+#define FRAME_HEADER_SIZE 12
+#define FRAME_MAX_PAYLOAD (64 * 1024)
+#define FRAME_BATCH_MAX_FRAMES 256
+
+struct frame_header {
+    uint32_t magic;                // FRAME_MAGIC
+    uint32_t length;               // байт полезных данных
+    uint32_t checksum;             // FNV-1a по length и данным
+};
+
+uint32_t frame_checksum(const void *payload, uint32_t length);
+
+/**
+ * Пакет кадров для одного writev. Данные кадров не копируются: указатель
+ * на payload должен оставаться действительным до frame_batch_flush.
+ */
+struct frame_batch {
+    int fd;
+    size_t limit;                  // предел байт в одном writev
+    size_t bytes;                  // накоплено в пакете
+    int count;                     // кадров в пакете
+    struct frame_header headers[FRAME_BATCH_MAX_FRAMES];
+    struct iovec iov[2 * FRAME_BATCH_MAX_FRAMES];
+    unsigned long long writes;     // выполнено writev
+};
+
+void frame_batch_init(struct frame_batch *batch, int fd, size_t limit);
+int frame_batch_add(struct frame_batch *batch, const void *payload, uint32_t length);
+int frame_batch_flush(struct frame_batch *batch);
+
+/**
+ * Кольцевой буфер читателя. head и tail — счётчики записанных и
+ * разобранных байт; позиция в буфере — счётчик по модулю capacity.
+ */
+struct frame_ring {
+    char *data;
+    size_t capacity;               // степень двойки
+    size_t head;
+    size_t tail;
+    char *scratch;                 // для кадров, разрезанных краем буфера
+    uint32_t max_payload;          // кадр длиннее считается испорченным
+};
+
+int frame_ring_init(struct frame_ring *ring, size_t capacity);
+void frame_ring_free(struct frame_ring *ring);
+ssize_t frame_ring_fill(struct frame_ring *ring, int fd);
+int frame_ring_next(struct frame_ring *ring, const char **payload, uint32_t *length);
+size_t frame_ring_resync(struct frame_ring *ring);
+
+/* ===== fifo_server.c: долгоживущий читатель FIFO на epoll ===== */
+
+// Обработчик кадра; payload действителен только на время вызова
+typedef void (*frame_handler)(const char *payload, uint32_t length, void *ctx);
+
+struct fifo_server_stats {
+    unsigned long long frames;
+    unsigned long long bytes;
+    unsigned long long reads;      // успешных readv
+    unsigned long long wakeups;    // возвратов epoll_wait
+    unsigned long long dropped;    // испорченных кадров
+    unsigned long long skipped;    // байт, пропущенных при поиске следующего кадра
+};
+
+int fifo_serve(const char *path, frame_handler handler, void *ctx, struct fifo_server_stats *stats);
+
+#endif
@@ -2,27 +2,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 // Объявления функций из других модулей
 extern void run_pipe_demo(void);
+extern void run_pipe_bulk(double gigabytes, const char *sink_path);
 extern void run_fifo_writer(void);
 extern void run_fifo_reader(void);
+extern void run_fifo_bench(int max_writers, long messages, size_t batch_limit);
+extern void run_fifo_server(void);
 
 static void usage(const char *prog) {
     fprintf(stderr,
             "Use:\n"
             "1)  %s pipe\n"
-            "2)  %s fifo-writer\n"
-            "3)  %s fifo-reader\n\n"
+            "2)  %s pipe-bulk [GiB] [sink]\n"
+            "3)  %s fifo-writer\n"
+            "4)  %s fifo-reader\n"
+            "5)  %s fifo-bench [max_writers] [messages] [batch_bytes]\n"
+            "6)  %s fifo-server\n\n"
             "Examples:\n"
             "    pipe demo (single run):\n"
             "1)  %s pipe\n\n"
+            "    pipe bulk transfer, 4 GiB into /dev/null (read/write vs vmsplice/splice):\n"
+            "    %s pipe-bulk 4\n\n"
             "2)  fifo demo (two separate processes):\n"
             "3)  In terminal 1:\n"
             "4)  %s fifo-reader\n"
             "5)  In terminal 2:\n"
-            "6)  %s fifo-writer\n",
-            prog, prog, prog, prog, prog, prog);
+            "6)  %s fifo-writer\n\n"
+            "    framed fifo benchmark, 1..4 writers, PIPE_BUF batches:\n"
+            "    %s fifo-bench 4 100000\n\n"
+            "    long-running fifo server (any number of fifo-writer runs, Ctrl+C to stop):\n"
+            "    %s fifo-server\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
 }
 
 /* ========== Главная функция ========== */
@@ -36,10 +49,34 @@ int main(int argc, char **argv) {
 
     if (strcmp(argv[1], "pipe") == 0) {
         run_pipe_demo();
+    } else if (strcmp(argv[1], "pipe-bulk") == 0) {
+        double gigabytes = 1.0;
+        if (argc > 2) {
+            char *end;
+            gigabytes = strtod(argv[2], &end);
+            if (*end != '\0' || gigabytes <= 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        run_pipe_bulk(gigabytes, argc > 3 ? argv[3] : NULL);
     } else if (strcmp(argv[1], "fifo-writer") == 0) {
         run_fifo_writer();
     } else if (strcmp(argv[1], "fifo-reader") == 0) {
         run_fifo_reader();
+    } else if (strcmp(argv[1], "fifo-server") == 0) {
+        run_fifo_server();
+    } else if (strcmp(argv[1], "fifo-bench") == 0) {
+        long values[3] = { 4, 100000, PIPE_BUF };
+        for (int i = 0; i < 3 && i + 2 < argc; i++) {
+            char *end;
+            values[i] = strtol(argv[i + 2], &end, 10);
+            if (*end != '\0' || values[i] <= 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        run_fifo_bench((int)values[0], values[1], (size_t)values[2]);
     } else {
         usage(argv[0]);
         return EXIT_FAILURE;
@@ -1,10 +1,14 @@
 //#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE  // vmsplice, splice, F_SETPIPE_SZ
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <errno.h>
 
@@ -95,3 +99,189 @@ void run_pipe_demo(void) {
     }
 }
 
+/* ========== Потоковая передача больших объёмов ========== */
+
+// Желаемый размер буфера канала; больше pipe-max-size без CAP_SYS_RESOURCE не дадут
+#define BULK_PIPE_SIZE (1024 * 1024)
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Увеличивает буфер канала через F_SETPIPE_SZ
+ * @return фактический размер буфера (при отказе остаётся прежний)
+ */
+static size_t grow_pipe(int fd) {
+    if (fcntl(fd, F_SETPIPE_SZ, BULK_PIPE_SIZE) == -1 && errno != EPERM) {
+        perror("fcntl F_SETPIPE_SZ");
+    }
+    int size = fcntl(fd, F_GETPIPE_SZ);
+    return size > 0 ? (size_t)size : 65536;
+}
+
+/**
+ * Читатель: переносит всё из канала в sink, пока писатель не закроет канал.
+ * В режиме zero_copy данные идут splice без копирования в user space;
+ * если sink не поддерживает splice, читатель переходит на read/write.
+ * @return число полученных байт или -1 при ошибке
+ */
+static long long bulk_read(int rd, int sink, size_t chunk, int zero_copy) {
+    long long received = 0;
+    while (zero_copy) {
+        ssize_t n = splice(rd, NULL, sink, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0) return received;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && received == 0) {
+                fprintf(stderr, "pipe-bulk: sink does not support splice, using read/write\n");
+                break;
+            }
+            perror("child: splice");
+            return -1;
+        }
+        received += n;
+    }
+
+    char *buf = malloc(chunk);
+    if (buf == NULL) {
+        perror("child: malloc");
+        return -1;
+    }
+    for (;;) {
+        ssize_t n = read(rd, buf, chunk);
+        if (n == 0) break;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("child: read");
+            received = -1;
+            break;
+        }
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = write(sink, buf + done, (size_t)(n - done));
+            if (w == -1) {
+                if (errno == EINTR) continue;
+                perror("child: write");
+                free(buf);
+                return -1;
+            }
+            done += w;
+        }
+        received += n;
+    }
+    free(buf);
+    return received;
+}
+
+/**
+ * Писатель: отправляет total байт из buf (chunk байт, выровнен по странице).
+ * vmsplice передаёт в канал ссылки на страницы buf, поэтому буфер не
+ * меняется, пока передача не закончена.
+ * @return 0 при успехе, -1 при ошибке
+ */
+static int bulk_write(int wr, char *buf, size_t chunk, long long total, int zero_copy) {
+    long long sent = 0;
+    while (sent < total) {
+        size_t want = (size_t)(total - sent < (long long)chunk ? total - sent : (long long)chunk);
+        size_t done = 0;
+        while (done < want) {
+            ssize_t n;
+            if (zero_copy) {
+                struct iovec iov = { buf + done, want - done };
+                n = vmsplice(wr, &iov, 1, 0);
+            } else {
+                n = write(wr, buf + done, want - done);
+            }
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                perror(zero_copy ? "parent: vmsplice" : "parent: write");
+                return -1;
+            }
+            done += (size_t)n;
+        }
+        sent += (long long)want;
+    }
+    return 0;
+}
+
+/**
+ * Один прогон: родитель пишет total байт, дочерний процесс сливает их в sink
+ * @return время передачи в секундах или -1 при ошибке
+ */
+static double bulk_run(long long total, const char *sink_path, int zero_copy, size_t *pipe_size) {
+    int fds[2];
+    if (pipe(fds) == -1) die("pipe");
+    size_t chunk = grow_pipe(fds[1]);
+    *pipe_size = chunk;
+
+    int sink = open(sink_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sink == -1) die(sink_path);
+
+    char *buf;
+    if (posix_memalign((void **)&buf, (size_t)sysconf(_SC_PAGESIZE), chunk) != 0) die("posix_memalign");
+    for (size_t i = 0; i < chunk; i++) buf[i] = (char)('a' + i % 26);
+
+    double started = now_seconds();
+    pid_t pid = fork();
+    if (pid == -1) die("fork");
+
+    if (pid == 0) {
+        close(fds[1]);
+        long long received = bulk_read(fds[0], sink, chunk, zero_copy);
+        close(fds[0]);
+        close(sink);
+        if (received != total) {
+            if (received >= 0) fprintf(stderr, "child: received %lld of %lld bytes\n", received, total);
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[0]);
+    close(sink);
+    int failed = bulk_write(fds[1], buf, chunk, total, zero_copy) == -1;
+    close(fds[1]);
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) == -1) die("waitpid");
+    double elapsed = now_seconds() - started;
+    free(buf);
+    if (failed || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) return -1;
+    return elapsed;
+}
+
+/**
+ * Передаёт gigabytes ГиБ через pipe двумя способами — обычным циклом
+ * read/write и vmsplice у писателя со splice у читателя — и сравнивает скорость
+ * @param gigabytes - объём передачи в ГиБ
+ * @param sink_path - куда читатель сливает данные (NULL — /dev/null)
+ */
+void run_pipe_bulk(double gigabytes, const char *sink_path) {
+    if (sink_path == NULL) sink_path = "/dev/null";
+    long long total = (long long)(gigabytes * 1024.0 * 1024.0 * 1024.0);
+
+    // Если читатель упадёт, писатель получит EPIPE вместо завершения по сигналу
+    signal(SIGPIPE, SIG_IGN);
+
+    static const char *names[] = { "read/write", "vmsplice/splice" };
+    double seconds[2];
+    size_t pipe_size = 0;
+    for (int zero_copy = 0; zero_copy < 2; zero_copy++) {
+        seconds[zero_copy] = bulk_run(total, sink_path, zero_copy, &pipe_size);
+        if (seconds[zero_copy] < 0) {
+            fprintf(stderr, "pipe-bulk: %s transfer failed\n", names[zero_copy]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("### PIPE bulk transfer ###\n");
+    printf("Volume: %.2f GiB, pipe buffer: %zu bytes, sink: %s\n",
+           (double)total / (1024.0 * 1024.0 * 1024.0), pipe_size, sink_path);
+    for (int i = 0; i < 2; i++) {
+        printf("%-16s %8.3f s  %8.2f GiB/s\n", names[i], seconds[i],
+               (double)total / (1024.0 * 1024.0 * 1024.0) / seconds[i]);
+    }
+    printf("Speedup: %.2fx\n", seconds[0] / seconds[1]);
+}